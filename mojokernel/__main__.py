@@ -1,6 +1,5 @@
 import argparse, shutil, sys, tempfile
 from pathlib import Path
-from jupyter_client.kernelspec import install_kernel_spec
 
 
 def _run_kernel(argv):
@@ -19,6 +18,7 @@ def _install_kernelspec(argv):
     scope.add_argument("--sys-prefix", action="store_true", help="Install into current env")
     scope.add_argument("--prefix", help="Install into a given prefix")
     args = parser.parse_args(argv)
+    from jupyter_client.kernelspec import install_kernel_spec
 
     prefix = args.prefix or (sys.prefix if args.sys_prefix else None)
     kernel_dir = Path(__file__).resolve().parent / "kernelspec"
@@ -29,13 +29,18 @@ def _install_kernelspec(argv):
     print("Mojo kernel installed. Run `jupyter kernelspec list` to verify.")
 
 
+def _run_lsp_mux(argv):
+    from .lsp_mux import main as mux_main
+    mux_main(argv)
+
+
 def main():
     argv = sys.argv[1:]
     if argv and argv[0] in ('--version', '-V'):
         from . import __version__
         print(f'mojokernel {__version__}')
         return
-    commands = {"install": _install_kernelspec, "run": _run_kernel}
+    commands = {"install": _install_kernelspec, "run": _run_kernel, "lsp-mux": _run_lsp_mux}
     if argv and argv[0] in commands: commands[argv[0]](argv[1:])
     else: _run_kernel(argv)
 
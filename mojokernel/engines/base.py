@@ -8,3 +8,6 @@ class ExecutionResult:
     ename: str = ''
     evalue: str = ''
     traceback: list[str] = field(default_factory=list)
+    display_data: list[dict] = field(default_factory=list)
+    # Cells re-run because of this one: {cell_id, status, stdout, ...}.
+    dependents: list[dict] = field(default_factory=list)
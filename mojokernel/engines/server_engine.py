@@ -1,4 +1,4 @@
-import json,os,signal,subprocess
+import json,os,queue,signal,subprocess,threading,time
 from pathlib import Path
 from .base import ExecutionResult
 
@@ -19,9 +19,17 @@ def _find_server_binary():
 
 
 class ServerEngine:
+    # execute() accepts on_output for live output.
+    streams_output = True
+
     def __init__(self):
         self.proc = None
         self._next_id = 0
+        # Replies are matched to requests by id, so `status()` can be asked
+        # from another thread while a cell runs.
+        self._pending = {}
+        self._lock = threading.Lock()
+        self._reader = None
 
     def start(self):
         server_bin = _find_server_binary()
@@ -49,27 +57,68 @@ class ServerEngine:
             raise RuntimeError(f"Server failed to start: {ready.get('message', 'unknown error')}")
         if ready.get('status') != 'ready':
             raise RuntimeError(f"Unexpected server response: {ready}")
-
-    def _send(self, req):
-        self._next_id += 1
-        req['id'] = self._next_id
-        line = json.dumps(req, separators=(',', ':')) + '\n'
-        self.proc.stdin.write(line.encode())
-        self.proc.stdin.flush()
-        return self._read_response()
-
-    def _read_response(self):
-        line = self.proc.stdout.readline()
+        self._reader = threading.Thread(target=self._reader_loop, args=(self.proc,), daemon=True)
+        self._reader.start()
+
+    def _send(self, req, timeout=None, on_stream=None, on_display=None):
+        "Send `req` and wait for its reply; `stream` and `display_data` messages for it go to `on_stream(name, text)` and `on_display(bundle)` on this thread."
+        slot = queue.Queue()
+        with self._lock:
+            if not self.alive: raise RuntimeError("Server process not running")
+            self._next_id += 1
+            req['id'] = self._next_id
+            self._pending[req['id']] = slot
+            line = json.dumps(req, separators=(',', ':')) + '\n'
+            self.proc.stdin.write(line.encode())
+            self.proc.stdin.flush()
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while True:
+            try: msg = slot.get(timeout=None if deadline is None else max(0, deadline - time.monotonic()))
+            except queue.Empty:
+                with self._lock: self._pending.pop(req['id'], None)
+                raise TimeoutError(f"No reply to {req['type']} within {timeout} s")
+            if isinstance(msg, Exception): raise msg
+            status = msg.get('status')
+            if status == 'stream':
+                if on_stream: on_stream(msg.get('name', 'stdout'), msg.get('text', ''))
+            elif status == 'display_data':
+                if on_display: on_display(dict(data=msg.get('data', {}), metadata=msg.get('metadata', {})))
+            else: return msg
+
+    def _reader_loop(self, proc):
+        err = None
+        try:
+            while True:
+                msg = self._read_response(proc)
+                with self._lock:
+                    if msg.get('status') in ('stream', 'display_data'): slot = self._pending.get(msg.get('id'))
+                    else: slot = self._pending.pop(msg.get('id'), None)
+                if slot: slot.put(msg)
+        except Exception as e: err = e
+        with self._lock: pending, self._pending = self._pending, {}
+        for slot in pending.values(): slot.put(err)
+
+    def _read_response(self, proc=None):
+        proc = proc or self.proc
+        line = proc.stdout.readline()
         if not line:
-            stderr = self.proc.stderr.read().decode() if self.proc.stderr else ''
+            stderr = proc.stderr.read().decode() if proc.stderr else ''
             raise RuntimeError(f"Server process died. stderr: {stderr}")
         return json.loads(line)
 
-    def execute(self, code):
+    def execute(self, code, timeout_ms=None, session=None, on_output=None, on_display=None, cell_id=None, execute_dependents=False):
+        """With `on_output(name, text)`, output and `display()` bundles (to `on_display(bundle)`) are delivered while the cell runs and not repeated in the result.
+        `cell_id` records the cell in the server's dependency graph; `execute_dependents` also re-runs the later cells that depend on it."""
         code = code.strip()
         if not code: return ExecutionResult()
 
-        resp = self._send({'type': 'execute', 'code': code})
+        req = {'type': 'execute', 'code': code}
+        if timeout_ms: req['timeout_ms'] = int(timeout_ms)
+        if session: req['session'] = session
+        if on_output: req['stream'] = True
+        if cell_id: req['cell_id'] = cell_id
+        if execute_dependents: req['execute_dependents'] = True
+        resp = self._send(req, on_stream=on_output, on_display=on_display)
 
         if resp.get('status') == 'error':
             return ExecutionResult(
@@ -78,11 +127,71 @@ class ServerEngine:
                 success=False,
                 ename=resp.get('ename', 'MojoError'),
                 evalue=resp.get('evalue', ''),
-                traceback=resp.get('traceback', []))
+                traceback=resp.get('traceback', []),
+                display_data=resp.get('display_data', []),
+                dependents=resp.get('dependents', []))
 
         return ExecutionResult(
             stdout=resp.get('stdout', ''),
-            stderr=resp.get('stderr', ''))
+            stderr=resp.get('stderr', ''),
+            display_data=resp.get('display_data', []),
+            dependents=resp.get('dependents', []))
+
+    def stats(self): return self._send({'type': 'stats'})
+
+    def dependents(self, cell_id, code=None):
+        "Ids of the cells an edit of `cell_id` (to `code`, if given) would re-run, in order."
+        req = {'type': 'dependents', 'cell_id': cell_id}
+        if code is not None: req['code'] = code
+        return [d['cell_id'] for d in self._send(req)['dependents']]
+
+    def status(self, session=None, timeout=5.0):
+        "Health of a session, answered even while a cell runs or a compile hangs."
+        req = {'type': 'status'}
+        if session: req['session'] = session
+        return self._send(req, timeout=timeout)
+
+    def replay(self, cells, stop_on_error=False):
+        "Re-run earlier cells (strings or {'code','side_effect_free'} dicts) with definition cells coalesced."
+        return self._send({'type': 'replay', 'cells': cells, 'stop_on_error': stop_on_error})
+
+    def read_output(self, path, offset=0, length=1<<20, encoding=None):
+        "Page through output a cell spilled to `path` once it exceeded the in-memory cap; continue from `next_offset`."
+        req = {'type': 'read_output', 'path': path, 'offset': offset, 'length': length}
+        if encoding: req['encoding'] = encoding
+        return self._send(req)
+
+    def checkpoint(self, path): return self._send({'type': 'checkpoint', 'path': str(path)})
+
+    def restore(self, path):
+        "Rebuild the session from a checkpoint file in a fresh Mojo process."
+        resp = self._send({'type': 'restore', 'path': str(path)})
+        if resp.get('status') != 'ok': raise RuntimeError(f"Restore failed: {resp.get('evalue', resp)}")
+        return resp
+
+    def open_session(self, new_session=None):
+        "Start a fresh session in the same server process; returns its id."
+        req = {'type': 'open_session'}
+        if new_session: req['new_session'] = new_session
+        resp = self._send(req)
+        if resp.get('status') != 'ok': raise RuntimeError(f"Opening session failed: {resp.get('evalue', resp)}")
+        return resp['session']
+
+    def fork_session(self, session=None, new_session=None):
+        "Branch `session` (default main) into a new session; returns the new session id."
+        req = {'type': 'fork_session'}
+        if session: req['session'] = session
+        if new_session: req['new_session'] = new_session
+        resp = self._send(req)
+        if resp.get('status') != 'ok': raise RuntimeError(f"Fork failed: {resp.get('evalue', resp)}")
+        return resp['session']
+
+    def close_session(self, session): return self._send({'type': 'close_session', 'session': session})
+
+    def reset(self):
+        "Relaunch the Mojo process and REPL, keeping the server and its debugger."
+        resp = self._send({'type': 'reset'})
+        if resp.get('status') != 'ok': raise RuntimeError(f"Session reset failed: {resp.get('evalue', resp)}")
 
     def interrupt(self):
         if self.proc and self.proc.poll() is None:
@@ -1,9 +1,11 @@
 import os
 import re
+import threading
 import time
+from concurrent.futures import Future
 from pathlib import Path
 from ipykernel.kernelbase import Kernel
-from .lsp_client import LSPError, MojoLSPClient, completion_matches, completion_metadata, hover_text, identifier_span, signature_text
+from .lsp_client import LSPError, MojoLSPClient, completion_matches, completion_metadata, hover_text, identifier_span, mux_socket_path, signature_text
 
 
 class MojoKernel(Kernel):
@@ -14,6 +16,9 @@ class MojoKernel(Kernel):
     language_info = dict(mimetype='text/x-mojo', name='mojo', file_extension='.mojo', pygments_lexer='python', codemirror_mode='python')
     banner = 'Mojo Jupyter Kernel'
     _builtin_signatures = {'print': 'print(value: Any)'}
+    # Last complete LSP completion list; see `_cached_completion`.
+    _complete_cache = None
+    _complete_stats = None
 
     def __init__(self, **kwargs):
         super().__init__(**kwargs)
@@ -26,9 +31,12 @@ class MojoKernel(Kernel):
             else:
                 from .engines.pexpect_engine import PexpectEngine
                 self.engine = PexpectEngine()
-        self.engine.start()
         self._lsp_preamble = ''
+        # MOJO_KERNEL_REACTIVE=1: executing a cell also re-runs the later
+        # cells that depend on it (server engine only).
+        self.reactive = os.environ.get('MOJO_KERNEL_REACTIVE', '') == '1'
         self.lsp = None
+        self._lsp_ready = None
         v = os.environ.get('MOJO_KERNEL_LSP', '1').lower()
         if v not in ('0', 'false', 'no', 'off'):
             try:
@@ -36,11 +44,37 @@ class MojoKernel(Kernel):
                 lsp_timeout = float(os.environ.get('MOJO_LSP_REQUEST_TIMEOUT', '2'))
                 lsp_shutdown = float(os.environ.get('MOJO_LSP_SHUTDOWN_TIMEOUT', '1'))
                 root_uri = Path.cwd().resolve().as_uri()
-                self.lsp = MojoLSPClient(include_dirs=include_dirs, root_uri=root_uri, request_timeout=lsp_timeout, shutdown_timeout=lsp_shutdown, logger=self.log.debug)
-                self.lsp.start()
+                # MOJO_LSP_MUX=1 (or a socket path): share one language server per host.
+                mux = os.environ.get('MOJO_LSP_MUX', '')
+                mux_socket = None if mux.lower() in ('', '0', 'false', 'no', 'off') else mux_socket_path(include_dirs) if mux == '1' else mux
+                self.lsp = MojoLSPClient(include_dirs=include_dirs, root_uri=root_uri, request_timeout=lsp_timeout, shutdown_timeout=lsp_shutdown, logger=self.log.debug, mux_socket=mux_socket)
+                # The two startups are independent: the LSP initializes while
+                # the engine bootstraps LLDB, and completion waits for it.
+                self._start_lsp(self.lsp.start)
+            except Exception as e:
+                self.log.warning(f"Mojo LSP unavailable, completions disabled: {e}")
+                self.lsp = None
+        self.engine.start()
+
+    def _start_lsp(self, fn):
+        "Run `fn` (the LSP client's start or restart) on a thread; `_lsp_available` waits for it."
+        fut = self._lsp_ready = Future()
+        def run():
+            try: fn()
+            except Exception as e: fut.set_exception(e)
+            else: fut.set_result(True)
+        threading.Thread(target=run, name='mojo-lsp-start', daemon=True).start()
+
+    def _lsp_available(self):
+        "Wait for a pending LSP start; False if there is no LSP or it failed to start."
+        fut = getattr(self, '_lsp_ready', None)
+        if self.lsp and fut:
+            try: fut.result()
             except Exception as e:
                 self.log.warning(f"Mojo LSP unavailable, completions disabled: {e}")
                 self.lsp = None
+            self._lsp_ready = None
+        return self.lsp is not None
 
     def _known_symbols(self, extra=''):
         text = self._lsp_preamble + '\n' + extra
@@ -108,15 +142,85 @@ class MojoKernel(Kernel):
         if cursor_pos > 0 and code[cursor_pos-1] == '.': return True
         return start > 0 and code[start-1] == '.'
 
-    def _lsp_complete(self, text, pos, start, end, prefix=''):
-        try: payload = self.lsp.complete(text, pos)
-        except Exception as e:
-            if not self._is_outdated_lsp_error(e): raise
-            payload = self.lsp.complete(text, pos)
+    def _send_completion(self, call, done):
+        call['t0'] = time.time()
+        try: call['pending'] = self.lsp.complete_async(call['text'], call['pos'], doc=call['stage'], notify=done)
+        except Exception as e: call['error'] = e
+
+    def _completion_failed(self, call, e, diag):
+        stage,es,st = call['stage'],self._diag_err(e),self._lsp_state()
+        entry = dict(stage=stage, ok=False, error=es, elapsed_ms=round(1000 * (time.time() - call['t0']), 1), lsp=st)
+        if self._is_outdated_lsp_error(e):
+            entry['stale'] = True
+            self.log.debug(f"{stage} stale request: {es}")
+        else: self.log.warning(f"{stage} failed: {es}; lsp={st}")
+        diag.append(entry)
+
+    def _race_complete(self, attempts, start, end, prefix, diag):
+        """Send every (stage, text, pos) attempt at once, each against its own document.
+        The first with matches wins (earlier attempts win ties) and the others
+        are cancelled; returns (matches, metadata, payload) or None."""
+        done = threading.Event()
+        live = [dict(stage=stage, text=t, pos=p) for stage,t,p in attempts]
+        for c in live: self._send_completion(c, done)
+        deadline = time.time() + getattr(self.lsp, 'request_timeout', 2.0)
+        won = None
+        while live and not won:
+            done.clear()
+            for c in list(live):
+                if 'pending' in c and not c['pending'].event.is_set(): continue
+                live.remove(c)
+                try:
+                    if 'error' in c: raise c['error']
+                    payload = self.lsp.finish(c['pending'])
+                except Exception as e:
+                    if self._is_outdated_lsp_error(e) and not c.get('retried'):
+                        # The document changed under the request: send it once more.
+                        c['retried'] = True
+                        c.pop('error', None)
+                        self._send_completion(c, done)
+                        live.append(c)
+                    else: self._completion_failed(c, e, diag)
+                    continue
+                matches,metadata = self._filter_completion(payload, start, end, prefix)
+                diag.append(dict(stage=c['stage'], ok=True, matches=len(matches), elapsed_ms=round(1000 * (time.time() - c['t0']), 1)))
+                if matches:
+                    won = matches,metadata,payload
+                    break
+            if won or not live: break
+            left = deadline - time.time()
+            if left <= 0 or not done.wait(left): break
+        for c in live:
+            self.lsp.cancel(c['pending'])
+            if won: diag.append(dict(stage=c['stage'], ok=False, cancelled=True, elapsed_ms=round(1000 * (time.time() - c['t0']), 1)))
+            else: self._completion_failed(c, TimeoutError("LSP request timed out: textDocument/completion"), diag)
+        return won
+
+    def _filter_completion(self, payload, start, end, prefix):
         matches = completion_matches(payload, prefix=prefix)
         typed = completion_metadata(payload, start, end, prefix=prefix)
         return matches,dict(_jupyter_types_experimental=typed) if typed else {}
 
+    def _cache_key(self, code, start, end, is_member):
+        # Everything but the identifier being typed: the preamble (grows on
+        # every execute), the text around the span, and the context.
+        return (len(self._lsp_preamble), code[:start], code[end:], is_member)
+
+    def _cached_completion(self, code, cursor_pos, start, end, is_member):
+        "The cached payload if this request only extends the prefix it was fetched for."
+        c = self._complete_cache
+        if not c or c['key'] != self._cache_key(code, start, end, is_member): return None
+        return c['payload'] if code[start:cursor_pos].startswith(c['prefix']) else None
+
+    def _completion_stats(self, hit, elapsed_ms):
+        st = self._complete_stats
+        if st is None: st = self._complete_stats = dict(hits=0, misses=0, hit_ms=0.0, miss_ms=0.0)
+        st['hits' if hit else 'misses'] += 1
+        st['hit_ms' if hit else 'miss_ms'] += elapsed_ms
+        n = st['hits'] + st['misses']
+        return dict(hits=st['hits'], misses=st['misses'], hit_rate=round(st['hits'] / n, 3),
+                    hit_ms=round(st['hit_ms'] / max(1, st['hits']), 2), miss_ms=round(st['miss_ms'] / max(1, st['misses']), 2))
+
     def _lsp_inspect(self, text, pos):
         txt = ''
         try: txt = signature_text(self.lsp.signature_help(text, pos))
@@ -142,58 +246,71 @@ class MojoKernel(Kernel):
         s = repr(e)
         return s if len(s) <= n else s[:n-3] + '...'
 
-    def do_execute(self, code, silent, store_history=True, user_expressions=None, allow_stdin=False):
+    def do_execute(self, code, silent, store_history=True, user_expressions=None, allow_stdin=False, *, cell_id=None):
         code = code.strip()
         if not code: return dict(status='ok', execution_count=self.execution_count, payload=[], user_expressions={})
-        result = self.engine.execute(code)
+        if silent or not getattr(self.engine, 'streams_output', False): result = self.engine.execute(code)
+        else:
+            on_output = lambda name, text: self.send_response(self.iopub_socket, 'stream', dict(name=name, text=text))
+            on_display = lambda bundle: self.send_response(self.iopub_socket, 'display_data', bundle)
+            result = self.engine.execute(code, on_output=on_output, on_display=on_display, cell_id=cell_id,
+                                         execute_dependents=bool(cell_id) and self.reactive)
 
         if not silent and result.stdout: self.send_response(self.iopub_socket, 'stream', dict(name='stdout', text=result.stdout))
         if not silent and result.stderr: self.send_response(self.iopub_socket, 'stream', dict(name='stderr', text=result.stderr))
+        if not silent:
+            for bundle in result.display_data: self.send_response(self.iopub_socket, 'display_data', bundle)
+            for dep in result.dependents: self._send_dependent(dep)
 
         if result.success:
             if self.lsp: self._lsp_preamble += code + '\n'
+            self._complete_cache = None
             return dict(status='ok', execution_count=self.execution_count, payload=[], user_expressions={})
 
         if not silent: self.send_response(self.iopub_socket, 'error', dict(ename=result.ename, evalue=result.evalue, traceback=result.traceback))
         return dict(status='error', execution_count=self.execution_count, ename=result.ename, evalue=result.evalue, traceback=result.traceback)
 
+    def _send_dependent(self, dep):
+        "Publish a re-run dependent cell: a status line, then its own output and error."
+        ok = dep['status'] == 'ok'
+        self.send_response(self.iopub_socket, 'stream', dict(name='stdout' if ok else 'stderr',
+                                                             text=f"[re-ran dependent cell {dep['cell_id']}: {dep['status']}]\n"))
+        for name in ('stdout', 'stderr'):
+            if dep.get(name): self.send_response(self.iopub_socket, 'stream', dict(name=name, text=dep[name]))
+        for bundle in dep.get('display_data', []): self.send_response(self.iopub_socket, 'display_data', bundle)
+        if dep.get('evalue'): self.send_response(self.iopub_socket, 'stream', dict(name='stderr', text=dep['evalue'] + '\n'))
+
     def do_complete(self, code, cursor_pos):
         cursor_pos = len(code) if cursor_pos is None else cursor_pos
         start,end = identifier_span(code, cursor_pos)
         metadata = {}
         matches = []
         diag = []
-        if self.lsp:
+        if self._lsp_available():
             text = self._lsp_preamble + code
             pos = len(self._lsp_preamble) + cursor_pos
             is_member = self._is_member_completion(code, cursor_pos, start)
             wtext,wpos = self._wrap_for_lsp(text, pos)
             prefix = code[start:cursor_pos]
+            t_req = time.time()
 
-            def try_complete(stage, t, p):
-                nonlocal matches,metadata
-                t0 = time.time()
-                try:
-                    matches,metadata = self._lsp_complete(t, p, start, end, prefix=prefix)
-                    diag.append(dict(stage=stage, ok=True, matches=len(matches), elapsed_ms=round(1000 * (time.time() - t0), 1)))
-                    return True
-                except Exception as e:
-                    es = self._diag_err(e)
-                    st = self._lsp_state()
-                    entry = dict(stage=stage, ok=False, error=es, elapsed_ms=round(1000 * (time.time() - t0), 1), lsp=st)
-                    if self._is_outdated_lsp_error(e):
-                        entry['stale'] = True
-                        self.log.debug(f"{stage} stale request: {es}")
-                    else: self.log.warning(f"{stage} failed: {es}; lsp={st}")
-                    diag.append(entry)
-                    return False
-
-            if is_member:
-                try_complete('lsp_wrapped', wtext, wpos)
-                if not matches: try_complete('lsp_raw', text, pos)
+            cached = self._cached_completion(code, cursor_pos, start, end, is_member)
+            if cached is not None:
+                # One more character of the same identifier: narrow in-process.
+                matches,metadata = self._filter_completion(cached, start, end, prefix)
+                ms = 1000 * (time.time() - t_req)
+                diag.append(dict(stage='cache', ok=True, matches=len(matches), elapsed_ms=round(ms, 2), cache=self._completion_stats(True, ms)))
             else:
-                try_complete('lsp_raw', text, pos)
-                if not matches: try_complete('lsp_wrapped', wtext, wpos)
+                self._complete_cache = None
+                raw,wrapped = ('lsp_raw', text, pos),('lsp_wrapped', wtext, wpos)
+                won = self._race_complete([wrapped, raw] if is_member else [raw, wrapped], start, end, prefix, diag)
+                if won:
+                    matches,metadata,payload = won
+                    # An incomplete list must be re-requested as the prefix grows.
+                    if not (isinstance(payload, dict) and payload.get('isIncomplete')):
+                        self._complete_cache = dict(key=self._cache_key(code, start, end, is_member), prefix=prefix, payload=payload)
+                ms = 1000 * (time.time() - t_req)
+                if diag: diag[-1]['cache'] = self._completion_stats(False, ms)
         force_diag = bool(self.lsp and not matches and self._is_member_completion(code, cursor_pos, start))
         if not matches: matches,metadata = self._fallback_complete(code, cursor_pos, start, end)
         if matches and diag and diag[-1].get('stage') != 'fallback': diag.append(dict(stage='final', ok=True, matches=len(matches)))
@@ -204,7 +321,7 @@ class MojoKernel(Kernel):
     def do_inspect(self, code, cursor_pos, detail_level=0, omit_sections=()):
         cursor_pos = len(code) if cursor_pos is None else cursor_pos
         txt = ''
-        if self.lsp:
+        if self._lsp_available():
             text = self._lsp_preamble + code
             pos = len(self._lsp_preamble) + cursor_pos
             txt = self._lsp_inspect(text, pos)
@@ -218,8 +335,12 @@ class MojoKernel(Kernel):
         return dict(status='ok', found=True, data={'text/plain': txt}, metadata={})
 
     def do_shutdown(self, restart):
-        if self.lsp:
-            try: self.lsp.restart() if restart else self.lsp.shutdown()
+        lsp = self.lsp if self._lsp_available() else None
+        if lsp and restart:
+            # As at startup, the LSP restarts alongside the engine.
+            self._start_lsp(lsp.restart)
+        elif lsp:
+            try: lsp.shutdown()
             except Exception as e: self.log.debug(f"LSP shutdown failed: {e}")
         self.engine.restart() if restart else self.engine.shutdown()
         return dict(status='ok', restart=restart)
@@ -1,4 +1,4 @@
-import json, os, shutil, subprocess, sys, tempfile, threading
+import hashlib, json, os, shutil, socket, subprocess, sys, tempfile, threading, time, uuid
 from collections import deque
 from pathlib import Path
 
@@ -139,16 +139,123 @@ def _is_invalid_request_error(e):
     return isinstance(d, dict) and d.get('code') == -32600
 
 
+def read_lsp_message(stream, log=None):
+    "Read one Content-Length framed JSON-RPC message; None at EOF. Non-LSP lines are logged and skipped."
+    headers = {}
+    while True:
+        headers.clear()
+        while True:
+            line = stream.readline()
+            if not line: return None
+            if line in (b'\r\n', b'\n'):
+                if headers: break
+                continue
+            if b':' not in line:
+                txt = line.decode('utf-8', errors='replace').rstrip()
+                if txt and log: log(f"[mojo-lsp/stdout] {txt}")
+                continue
+            k,v = line.decode('ascii', errors='replace').split(':', 1)
+            headers[k.strip().lower()] = v.strip()
+        try: n = int(headers.get('content-length', '0'))
+        except Exception:
+            if log: log(f"[mojo-lsp] bad headers: {headers}")
+            continue
+        if n <= 0:
+            if log: log(f"[mojo-lsp] ignoring message with content-length={n}: {headers}")
+            continue
+        body = _read_exact(stream, n)
+        if body is None: return None
+        try: return json.loads(body.decode('utf-8'))
+        except Exception as e:
+            if log: log(f"[mojo-lsp] bad json payload: {e}")
+
+
+def _read_exact(stream, n):
+    out = bytearray()
+    while len(out) < n:
+        chunk = stream.read(n - len(out))
+        if not chunk: return None
+        out.extend(chunk)
+    return bytes(out)
+
+
+def write_lsp_message(stream, msg):
+    payload = json.dumps(msg).encode('utf-8')
+    stream.write(f"Content-Length: {len(payload)}\r\n\r\n".encode('ascii') + payload)
+    stream.flush()
+
+
+def mux_socket_path(include_dirs=()):
+    "Default socket of the shared LSP daemon: one per user and include-dir set."
+    key = hashlib.sha1(os.pathsep.join(include_dirs).encode()).hexdigest()[:10]
+    base = os.environ.get('XDG_RUNTIME_DIR') or os.path.join(tempfile.gettempdir(), f'mojokernel-{os.getuid()}')
+    return os.path.join(base, f'mojo-lsp-mux-{os.getuid()}-{key}.sock')
+
+
+def ensure_private_dir(path):
+    "Create `path` (0700) if missing; PermissionError unless it is ours and nobody else can write to it."
+    os.makedirs(path, mode=0o700, exist_ok=True)
+    st = os.stat(path)
+    if st.st_uid != os.getuid() or st.st_mode & 0o022:
+        raise PermissionError(f"{path} must belong to uid {os.getuid()} and not be writable by others")
+
+
+class _SocketProc:
+    "A connection to the LSP multiplexer, shaped like the Popen the client otherwise drives."
+    pid = None
+    stderr = None
+
+    def __init__(self, sock):
+        self.sock = sock
+        self.stdin = sock.makefile('wb')
+        self.stdout = sock.makefile('rb')
+        self.returncode = None
+
+    def poll(self): return self.returncode
+
+    def wait(self, timeout=None):
+        self.terminate()
+        return self.returncode
+
+    def terminate(self):
+        if self.returncode is not None: return
+        self.returncode = 0
+        try: self.sock.shutdown(socket.SHUT_RDWR)
+        except OSError: pass
+        self.sock.close()
+
+    kill = terminate
+
+
 class _Pending:
-    def __init__(self):
+    def __init__(self, method='', notify=None):
+        self.method = method
+        self.req_id = None
         self.event = threading.Event()
+        self.notify = notify   # optional Event shared by several requests
         self.msg = None
         self.err = None
+        self.retry = None      # reopens the document and re-sends, for finish()
+
+    def set_done(self):
+        self.event.set()
+        if self.notify: self.notify.set()
+
+
+class _Document:
+    def __init__(self, uri):
+        self.uri = uri
+        self.text = ''
+        self.version = 0
+        self.open = False
 
 
 class MojoLSPClient:
-    def __init__(self, cmd=None, include_dirs=None, root_uri=None, env=None, request_timeout=2.0, shutdown_timeout=1.0, logger=None):
+    def __init__(self, cmd=None, include_dirs=None, root_uri=None, env=None, request_timeout=2.0, shutdown_timeout=1.0, logger=None, mux_socket=None):
         self.cmd = list(cmd) if cmd else None
+        # Path of a shared LSP daemon (lsp_mux.py) to use instead of a
+        # private mojo-lsp-server; it is spawned if nothing listens there.
+        self.mux_socket = mux_socket
         self.include_dirs = list(include_dirs or [])
         self.root_uri = root_uri or Path.cwd().resolve().as_uri()
         self.env = env
@@ -162,14 +269,37 @@ class MojoLSPClient:
         self._pending_lock = threading.Lock()
         self._pending = {}
         self._next_id = 1
-        self._doc_uri = 'file:///__mojokernel__/session.mojo'
-        self._doc_text = ''
-        self._doc_version = 0
-        self._doc_open = False
+        # Unique per client, so clients of a shared server don't collide.
+        self._doc = _Document(f'file:///__mojokernel__/{uuid.uuid4().hex[:12]}/session.mojo')
+        # Further documents by name, e.g. one per completion strategy so they
+        # can be in flight at the same time.
+        self._named_docs = {}
         self._supports_did_change = False
+        self.capabilities = {}
         self._stderr_tail = deque(maxlen=20)
         self._last_reader_error = ''
 
+    @property
+    def _doc_uri(self): return self._doc.uri
+
+    @_doc_uri.setter
+    def _doc_uri(self, uri): self._doc.uri = uri
+
+    @property
+    def _doc_text(self): return self._doc.text
+
+    @property
+    def _doc_version(self): return self._doc.version
+
+    @property
+    def _doc_open(self): return self._doc.open
+
+    def _document(self, name=None):
+        if name is None: return self._doc
+        d = self._named_docs.get(name)
+        if d is None: d = self._named_docs[name] = _Document(self._doc.uri.rsplit('/', 1)[0] + f'/{name}.mojo')
+        return d
+
     @property
     def pid(self): return None if not self._proc else self._proc.pid
 
@@ -208,11 +338,40 @@ class MojoLSPClient:
         env.setdefault('MODULAR_PROFILE_FILENAME', self._tmp_profile_base())
         return env
 
+    def _connect_mux(self, timeout=10.0):
+        def connect():
+            s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            try: s.connect(self.mux_socket)
+            except OSError:
+                s.close()
+                raise
+            return _SocketProc(s)
+        try: return connect()
+        except OSError: pass
+        # Checked here too: the daemon's errors go nowhere.
+        ensure_private_dir(os.path.dirname(self.mux_socket) or '.')
+        cmd = [sys.executable, '-m', 'mojokernel', 'lsp-mux', '--socket', self.mux_socket]
+        if self.cmd: cmd += ['--'] + self.cmd
+        else:
+            for o in self.include_dirs: cmd += ['-I', o]
+        self._log(f"[mojo-lsp] starting shared server: {cmd}")
+        daemon = subprocess.Popen(cmd, stdin=subprocess.DEVNULL, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, env=self._build_env(), start_new_session=True)
+        deadline = time.monotonic() + timeout
+        while True:
+            try: return connect()
+            except OSError:
+                # Exit status 0 means another daemon owns the socket and is still binding it.
+                if daemon.poll(): raise OSError(f"shared LSP server exited with status {daemon.returncode}")
+                if time.monotonic() > deadline: raise
+                time.sleep(0.05)
+
     def start(self):
         if self.is_running: return
-        cmd = self._build_cmd()
-        env = self._build_env()
-        self._proc = subprocess.Popen(cmd, stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE, bufsize=0, env=env)
+        if self.mux_socket: self._proc = self._connect_mux()
+        else:
+            cmd = self._build_cmd()
+            env = self._build_env()
+            self._proc = subprocess.Popen(cmd, stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE, bufsize=0, env=env)
         self._reader = threading.Thread(target=self._reader_loop, name='mojo-lsp-reader', daemon=True)
         self._stderr_reader = threading.Thread(target=self._stderr_loop, name='mojo-lsp-stderr', daemon=True)
         self._reader.start()
@@ -221,6 +380,7 @@ class MojoLSPClient:
             params = dict(processId=os.getpid(), rootUri=self.root_uri, capabilities={}, clientInfo=dict(name='mojokernel', version='0'))
             init = self._request('initialize', params, timeout=self.request_timeout)
             caps = init.get('capabilities') if isinstance(init, dict) else {}
+            self.capabilities = caps if isinstance(caps, dict) else {}
             self._supports_did_change = _sync_change_kind(caps) in (1, 2)
             self._notify('initialized', {})
         except Exception:
@@ -296,9 +456,7 @@ class MojoLSPClient:
         finally:
             self._close_streams(proc)
             self._proc = None
-            self._doc_open = False
-            self._doc_text = ''
-            self._doc_version = 0
+            for d in (self._doc, *self._named_docs.values()): d.open,d.text,d.version = False,'',0
             self._supports_did_change = False
             self._last_reader_error = ''
             self._fail_pending(RuntimeError("LSP client shut down"))
@@ -307,41 +465,48 @@ class MojoLSPClient:
             self._reader = None
             self._stderr_reader = None
 
-    def _did_open(self, text):
-        self._doc_open = True
-        self._doc_version += 1
-        self._doc_text = text
-        td = dict(uri=self._doc_uri, languageId='mojo', version=self._doc_version, text=text)
+    def _did_open(self, text, d=None):
+        d = d or self._doc
+        d.open = True
+        d.version += 1
+        d.text = text
+        td = dict(uri=d.uri, languageId='mojo', version=d.version, text=text)
         self._notify('textDocument/didOpen', dict(textDocument=td))
 
-    def _did_close(self):
-        if not self._doc_open: return
-        self._notify('textDocument/didClose', dict(textDocument=dict(uri=self._doc_uri)))
-        self._doc_open = False
+    def _did_close(self, d=None):
+        d = d or self._doc
+        if not d.open: return
+        self._notify('textDocument/didClose', dict(textDocument=dict(uri=d.uri)))
+        d.open = False
 
-    def _did_change(self, text):
-        self._doc_version += 1
-        self._doc_text = text
-        self._notify('textDocument/didChange', dict(textDocument=dict(uri=self._doc_uri, version=self._doc_version), contentChanges=[dict(text=text)]))
+    def _did_change(self, text, d=None):
+        d = d or self._doc
+        d.version += 1
+        d.text = text
+        self._notify('textDocument/didChange', dict(textDocument=dict(uri=d.uri, version=d.version), contentChanges=[dict(text=text)]))
 
-    def _reopen_document(self, text):
-        self._did_close()
-        self._did_open(text)
+    def _reopen_document(self, text, d=None):
+        self._did_close(d)
+        self._did_open(text, d)
 
-    def update_document(self, text):
+    def update_document(self, text, doc=None):
         if not self.is_running: self.start()
         text = text or ''
-        if not self._doc_open:
-            self._did_open(text)
+        d = self._document(doc)
+        if not d.open:
+            self._did_open(text, d)
             return
-        if text == self._doc_text: return
-        if self._supports_did_change: self._did_change(text)
-        else: self._reopen_document(text)
+        if text == d.text: return
+        if self._supports_did_change: self._did_change(text, d)
+        else: self._reopen_document(text, d)
+
+    def _position_params(self, text, cursor_offset, doc=None):
+        line, char = offset_to_lsp_position(text, cursor_offset)
+        return dict(textDocument=dict(uri=self._document(doc).uri), position=dict(line=line, character=char))
 
     def _text_document_request(self, method, text, cursor_offset, timeout=None):
         self.update_document(text)
-        line, char = offset_to_lsp_position(text, cursor_offset)
-        params = dict(textDocument=dict(uri=self._doc_uri), position=dict(line=line, character=char))
+        params = self._position_params(text, cursor_offset)
         try: return self._request(method, params, timeout=timeout)
         except Exception as e:
             if not _is_invalid_request_error(e): raise
@@ -349,6 +514,34 @@ class MojoLSPClient:
             self._reopen_document(text)
             return self._request(method, params, timeout=timeout)
 
+    def complete_async(self, text, cursor_offset, doc=None, notify=None):
+        "Send a completion request against document `doc` without waiting; see finish() and cancel()."
+        self.ensure_alive()
+        self.update_document(text, doc)
+        params = self._position_params(text, cursor_offset, doc)
+        pending = self._start_request('textDocument/completion', params, notify=notify)
+        def retry():
+            self._reopen_document(text, self._document(doc))
+            return self._request('textDocument/completion', params)
+        pending.retry = retry
+        return pending
+
+    def finish(self, pending, timeout=None):
+        "Wait for a request sent with complete_async and return its result."
+        try: return self._wait(pending, timeout)
+        except Exception as e:
+            if not (_is_invalid_request_error(e) and pending.retry): raise
+            return pending.retry()
+
+    def cancel(self, pending):
+        "Abandon a request: the server is told with $/cancelRequest and finish() raises."
+        with self._pending_lock: live = self._pending.pop(pending.req_id, None)
+        if not live: return
+        try: self._notify('$/cancelRequest', dict(id=pending.req_id))
+        except Exception: pass
+        pending.err = LSPError(dict(code=-32800, message='Request cancelled'))
+        pending.set_done()
+
     def complete(self, text, cursor_offset, timeout=None):
         return self._request_with_restart(lambda: self._text_document_request('textDocument/completion', text, cursor_offset, timeout=timeout))
 
@@ -368,25 +561,32 @@ class MojoLSPClient:
             try: s.close()
             except Exception: pass
 
-    def _request(self, method, params, timeout=None):
-        timeout = self.request_timeout if timeout is None else timeout
+    def _start_request(self, method, params, notify=None):
         if not self.is_running: raise RuntimeError("LSP process not running")
-        pending = _Pending()
+        pending = _Pending(method, notify)
         with self._pending_lock:
-            req_id = self._next_id
+            pending.req_id = self._next_id
             self._next_id += 1
-            self._pending[req_id] = pending
+            self._pending[pending.req_id] = pending
+        try: self._send(dict(jsonrpc='2.0', id=pending.req_id, method=method, params=params))
+        except Exception:
+            with self._pending_lock: self._pending.pop(pending.req_id, None)
+            raise
+        return pending
+
+    def _wait(self, pending, timeout=None):
+        timeout = self.request_timeout if timeout is None else timeout
         try:
-            self._send(dict(jsonrpc='2.0', id=req_id, method=method, params=params))
-            if not pending.event.wait(timeout):
-                with self._pending_lock: self._pending.pop(req_id, None)
-                raise TimeoutError(f"LSP request timed out: {method}")
+            if not pending.event.wait(timeout): raise TimeoutError(f"LSP request timed out: {pending.method}")
             if pending.err: raise pending.err
             msg = pending.msg or {}
             if msg.get('error'): raise LSPError(msg['error'])
             return msg.get('result')
         finally:
-            with self._pending_lock: self._pending.pop(req_id, None)
+            with self._pending_lock: self._pending.pop(pending.req_id, None)
+
+    def _request(self, method, params, timeout=None):
+        return self._wait(self._start_request(method, params), timeout)
 
     def _notify(self, method, params):
         if not self.is_running: raise RuntimeError("LSP process not running")
@@ -395,12 +595,7 @@ class MojoLSPClient:
     def _send(self, msg):
         proc = self._proc
         if not proc or not proc.stdin: raise RuntimeError("LSP stdin closed")
-        payload = json.dumps(msg).encode('utf-8')
-        header = f"Content-Length: {len(payload)}\r\n\r\n".encode('ascii')
-        with self._write_lock:
-            proc.stdin.write(header)
-            proc.stdin.write(payload)
-            proc.stdin.flush()
+        with self._write_lock: write_lsp_message(proc.stdin, msg)
 
     def _reader_loop(self):
         err = None
@@ -433,47 +628,14 @@ class MojoLSPClient:
     def _read_message(self):
         proc = self._proc
         if not proc or not proc.stdout: return None
-        headers = {}
-        while True:
-            headers.clear()
-            while True:
-                line = proc.stdout.readline()
-                if not line: return None
-                if line in (b'\r\n', b'\n'):
-                    if headers: break
-                    continue
-                if b':' not in line:
-                    txt = line.decode('utf-8', errors='replace').rstrip()
-                    if txt: self._log(f"[mojo-lsp/stdout] {txt}")
-                    continue
-                k,v = line.decode('ascii', errors='replace').split(':', 1)
-                headers[k.strip().lower()] = v.strip()
-            try: n = int(headers.get('content-length', '0'))
-            except Exception:
-                self._log(f"[mojo-lsp] bad headers: {headers}")
-                continue
-            if n <= 0:
-                self._log(f"[mojo-lsp] ignoring message with content-length={n}: {headers}")
-                continue
-            body = self._read_exact(proc.stdout, n)
-            if body is None: return None
-            try: return json.loads(body.decode('utf-8'))
-            except Exception as e: self._log(f"[mojo-lsp] bad json payload: {e}")
-
-    def _read_exact(self, stream, n):
-        out = bytearray()
-        while len(out) < n:
-            chunk = stream.read(n - len(out))
-            if not chunk: return None
-            out.extend(chunk)
-        return bytes(out)
+        return read_lsp_message(proc.stdout, self._log)
 
     def _handle_message(self, msg):
         if 'id' in msg and ('result' in msg or 'error' in msg):
             with self._pending_lock: pending = self._pending.get(msg['id'])
             if not pending: return
             pending.msg = msg
-            pending.event.set()
+            pending.set_done()
             return
         if 'id' in msg and 'method' in msg:
             self._send(dict(jsonrpc='2.0', id=msg['id'], error=dict(code=-32601, message='Method not found')))
@@ -482,4 +644,4 @@ class MojoLSPClient:
         with self._pending_lock: items = list(self._pending.values())
         for pending in items:
             pending.err = err
-            pending.event.set()
+            pending.set_done()
@@ -0,0 +1,314 @@
+"""One mojo-lsp-server shared by every kernel on a host.
+
+Each kernel otherwise runs its own language server, with its own parser and
+stdlib index. The multiplexer listens on a Unix socket and speaks plain LSP
+to each connected `MojoLSPClient`; every client edits its own virtual
+document URI, so requests from different kernels never see each other's
+cells. Requests are scheduled round-robin across clients, at most
+`per_client` in flight per client (two: a kernel races two completion
+strategies) and `max_inflight` overall, so a kernel issuing a burst of
+completions can't starve the others. Each client's messages reach the
+server in the order it sent them.
+
+`initialize` and `shutdown` are answered locally (the backend stays up for
+the next client); `exit` or a dropped connection closes that client's
+documents. If the backend dies it is restarted and the open documents are
+reopened. The daemon exits after `idle_timeout` seconds without clients.
+`mojokernel/muxStats` returns client, document and request counts.
+
+Usage: python -m mojokernel lsp-mux --socket PATH [-I DIR ...] [-- SERVER_CMD ...]
+"""
+import argparse, fcntl, os, socket, sys, threading, time
+from collections import deque
+from pathlib import Path
+from .lsp_client import LSPError, MojoLSPClient, ensure_private_dir, read_lsp_message, write_lsp_message
+
+
+class _Conn:
+    def __init__(self, n, sock):
+        self.n = n
+        self.sock = sock
+        self.rfile = sock.makefile('rb')
+        self.wfile = sock.makefile('wb')
+        self.write_lock = threading.Lock()
+        self.queue = deque()      # messages not yet passed to the backend, in order
+        self.busy = False         # a worker is passing on one of this client's messages
+        self.inflight = {}        # client request id -> backend request awaiting its reply
+        self.uris = set()
+        self.requests = 0
+        self.closed = False
+
+    def send(self, msg):
+        with self.write_lock:
+            if self.closed: return
+            try: write_lsp_message(self.wfile, msg)
+            except OSError: pass
+
+
+class LSPMux:
+    def __init__(self, socket_path, cmd=None, include_dirs=None, max_inflight=4, per_client=2, idle_timeout=300.0, request_timeout=30.0, logger=None):
+        self.socket_path = str(socket_path)
+        self.max_inflight = max(1, max_inflight)
+        self.per_client = max(1, per_client)
+        self.idle_timeout = idle_timeout
+        self.logger = logger
+        self.backend = MojoLSPClient(cmd=cmd, include_dirs=include_dirs, root_uri=Path.cwd().resolve().as_uri(),
+                                     request_timeout=request_timeout, shutdown_timeout=1.0, logger=logger)
+        self._cv = threading.Condition()
+        self._conns = []
+        self._rr = 0
+        self._next_conn = 1
+        self._docs = {}           # uri -> didOpen textDocument, kept current
+        self._backend_lock = threading.Lock()
+        self._stopping = False
+        self._listener = None
+        self._lock_file = None
+        self.backend_starts = 0
+        self.requests = 0
+
+    def _log(self, msg):
+        if self.logger: self.logger(msg)
+
+    def bind(self):
+        "Claim the socket path; False if another daemon already serves it."
+        # Others mustn't be able to replace the socket or its lock.
+        ensure_private_dir(os.path.dirname(self.socket_path) or '.')
+        self._lock_file = open(self.socket_path + '.lock', 'w')
+        try: fcntl.flock(self._lock_file, fcntl.LOCK_EX | fcntl.LOCK_NB)
+        except OSError: return False
+        # We hold the lock, so a socket file left here is stale.
+        try: os.unlink(self.socket_path)
+        except FileNotFoundError: pass
+        self._listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self._listener.bind(self.socket_path)
+        os.chmod(self.socket_path, 0o600)
+        self._listener.listen(64)
+        self._listener.settimeout(0.5)
+        return True
+
+    def serve_forever(self):
+        if not self._listener and not self.bind(): return False
+        idle_since = time.monotonic()
+        try:
+            self._start_backend()
+            for i in range(self.max_inflight):
+                threading.Thread(target=self._worker, name=f'lsp-mux-worker-{i}', daemon=True).start()
+            while not self._stopping:
+                try: sock,_ = self._listener.accept()
+                except socket.timeout:
+                    with self._cv: n = len(self._conns)
+                    if n: idle_since = time.monotonic()
+                    elif self.idle_timeout and time.monotonic() - idle_since > self.idle_timeout:
+                        self._log(f"[lsp-mux] idle for {self.idle_timeout}s, exiting")
+                        break
+                    continue
+                except OSError: break
+                sock.settimeout(None)
+                with self._cv:
+                    conn = _Conn(self._next_conn, sock)
+                    self._next_conn += 1
+                    self._conns.append(conn)
+                threading.Thread(target=self._client_loop, args=(conn,), name=f'lsp-mux-client-{conn.n}', daemon=True).start()
+                idle_since = time.monotonic()
+        finally: self.close()
+        return True
+
+    def close(self):
+        with self._cv:
+            self._stopping = True
+            conns = list(self._conns)
+            self._cv.notify_all()
+        for c in conns: self._drop(c)
+        if self._listener:
+            self._listener.close()
+            self._listener = None
+            try: os.unlink(self.socket_path)
+            except FileNotFoundError: pass
+        if self._lock_file:
+            self._lock_file.close()
+            self._lock_file = None
+        try: self.backend.shutdown()
+        except Exception as e: self._log(f"[lsp-mux] backend shutdown failed: {e}")
+
+    def stats(self):
+        with self._cv:
+            return dict(clients=len(self._conns), documents=len(self._docs), requests=self.requests,
+                        queued=sum(len(c.queue) for c in self._conns), backend_pid=self.backend.pid,
+                        backend_starts=self.backend_starts, max_inflight=self.max_inflight, per_client=self.per_client)
+
+    # Backend
+
+    def _start_backend(self):
+        with self._backend_lock:
+            self.backend.start()
+            self.backend_starts += 1
+
+    def _ensure_backend(self):
+        "Restart a dead backend and reopen every client's document in it."
+        with self._backend_lock:
+            if not self.backend._needs_restart(): return
+            self._log("[lsp-mux] backend stopped, restarting")
+            self.backend.restart()
+            self.backend_starts += 1
+            with self._cv: docs = list(self._docs.values())
+            for td in docs: self.backend._notify('textDocument/didOpen', dict(textDocument=td))
+
+    # Clients
+
+    def _client_loop(self, conn):
+        try:
+            while True:
+                msg = read_lsp_message(conn.rfile, self._log)
+                if msg is None or msg.get('method') == 'exit': break
+                self._receive(conn, msg)
+        except (OSError, ValueError): pass
+        finally: self._drop(conn)
+
+    def _receive(self, conn, msg):
+        method, mid = msg.get('method'), msg.get('id')
+        if method is None: return  # a reply; we never send clients requests
+        if method == 'initialize':
+            return conn.send(dict(jsonrpc='2.0', id=mid, result=dict(capabilities=self.backend.capabilities, serverInfo=dict(name='mojokernel-lsp-mux'))))
+        if method == 'shutdown': return conn.send(dict(jsonrpc='2.0', id=mid, result=None))
+        if method == 'mojokernel/muxStats': return conn.send(dict(jsonrpc='2.0', id=mid, result=self.stats()))
+        if method == 'initialized': return
+        if method == '$/cancelRequest': return self._cancel(conn, (msg.get('params') or {}).get('id'))
+        with self._cv:
+            conn.queue.append(msg)
+            self._cv.notify()
+
+    def _cancel(self, conn, cid):
+        with self._cv:
+            queued = next((o for o in conn.queue if o.get('id') == cid and 'method' in o), None)
+            if queued: conn.queue.remove(queued)
+            inflight = conn.inflight.get(cid)
+        if queued: return conn.send(dict(jsonrpc='2.0', id=cid, error=dict(code=-32800, message='Request cancelled')))
+        # The worker waiting on it replies with the cancellation error.
+        if inflight: self.backend.cancel(inflight)
+
+    def _drop(self, conn):
+        with self._cv:
+            if conn.closed: return
+            conn.closed = True
+            if conn in self._conns: self._conns.remove(conn)
+            conn.queue.clear()
+            uris = [o for o in conn.uris if o in self._docs]
+            for o in uris: del self._docs[o]
+            self._cv.notify_all()
+        for o in uris:
+            try: self.backend._notify('textDocument/didClose', dict(textDocument=dict(uri=o)))
+            except Exception: pass
+        for f in (conn.rfile, conn.wfile):
+            try: f.close()
+            except OSError: pass
+        try: conn.sock.close()
+        except OSError: pass
+
+    # Scheduling
+
+    def _next(self):
+        "Next message to pass on, round-robin over clients that may send one. Call with _cv held."
+        n = len(self._conns)
+        for i in range(n):
+            c = self._conns[(self._rr + i) % n]
+            if c.queue and not c.busy and ('id' not in c.queue[0] or len(c.inflight) < self.per_client):
+                self._rr = (self._rr + i + 1) % n
+                c.busy = True
+                return c, c.queue.popleft()
+        return None
+
+    def _worker(self):
+        while True:
+            with self._cv:
+                while not self._stopping and not (item := self._next()): self._cv.wait()
+                if self._stopping: return
+            conn,msg = item
+            released = []
+            def release():
+                # Once: a later release would free the client's next message while it is being forwarded.
+                if released: return
+                released.append(True)
+                self._release(conn)
+            try: self._forward(conn, msg, release)
+            except Exception as e: self._log(f"[lsp-mux] client {conn.n}: {msg.get('method')} failed: {e}")
+            finally: release()
+
+    def _release(self, conn):
+        "The client's next message may go out."
+        with self._cv:
+            conn.busy = False
+            self._cv.notify_all()
+
+    def _track(self, conn, method, params):
+        td = params.get('textDocument') or {}
+        uri = td.get('uri')
+        if not uri: return
+        with self._cv:
+            if method == 'textDocument/didOpen':
+                conn.uris.add(uri)
+                self._docs[uri] = dict(td)
+            elif method == 'textDocument/didClose':
+                conn.uris.discard(uri)
+                self._docs.pop(uri, None)
+            elif method == 'textDocument/didChange' and uri in self._docs:
+                changes = params.get('contentChanges') or []
+                # Clients send whole-document changes; keep the text for reopening.
+                if changes and 'range' not in changes[-1]: self._docs[uri]['text'] = changes[-1].get('text', '')
+                if 'version' in td: self._docs[uri]['version'] = td['version']
+
+    def _forward(self, conn, msg, release):
+        method, params, cid = msg['method'], msg.get('params') or {}, msg.get('id')
+        if cid is None:
+            self._track(conn, method, params)
+            try: self._ensure_backend()
+            except Exception: return
+            try: self.backend._notify(method, params)
+            except Exception as e: self._log(f"[lsp-mux] {method} not delivered: {e}")
+            return
+        with self._cv:
+            conn.requests += 1
+            self.requests += 1
+        def request():
+            self._ensure_backend()
+            pending = self.backend._start_request(method, params)
+            with self._cv: conn.inflight[cid] = pending
+            # Sent; wait for the reply without holding up the client's next message.
+            release()
+            return self.backend._wait(pending)
+        try:
+            try: result = request()
+            except Exception as e:
+                # The backend died under this request: once more on a new one.
+                if isinstance(e, (LSPError, TimeoutError)) or not self.backend._needs_restart(e): raise
+                result = request()
+            conn.send(dict(jsonrpc='2.0', id=cid, result=result))
+        except LSPError as e:
+            err = e.args[0] if e.args and isinstance(e.args[0], dict) else dict(code=-32603, message=str(e))
+            conn.send(dict(jsonrpc='2.0', id=cid, error=err))
+        except Exception as e:
+            conn.send(dict(jsonrpc='2.0', id=cid, error=dict(code=-32603, message=f"lsp-mux: {e}")))
+        finally:
+            with self._cv:
+                conn.inflight.pop(cid, None)
+                self._cv.notify_all()
+
+
+def main(argv=None):
+    argv = list(sys.argv[1:] if argv is None else argv)
+    cmd = None
+    if '--' in argv:
+        i = argv.index('--')
+        argv,cmd = argv[:i],argv[i+1:]
+    p = argparse.ArgumentParser(prog='mojokernel lsp-mux', description='Shared mojo-lsp-server for all kernels on this host.')
+    p.add_argument('--socket', required=True)
+    p.add_argument('-I', dest='include_dirs', action='append', default=[])
+    p.add_argument('--max-inflight', type=int, default=int(os.environ.get('MOJO_LSP_MUX_INFLIGHT', '4')))
+    p.add_argument('--idle-timeout', type=float, default=float(os.environ.get('MOJO_LSP_MUX_IDLE', '300')))
+    args = p.parse_args(argv)
+    log = (lambda m: print(m, file=sys.stderr, flush=True)) if os.environ.get('MOJO_LSP_MUX_DEBUG') else None
+    mux = LSPMux(args.socket, cmd=cmd, include_dirs=args.include_dirs, max_inflight=args.max_inflight, idle_timeout=args.idle_timeout, logger=log)
+    if not mux.bind(): return  # another daemon owns this socket
+    mux.serve_forever()
+
+
+if __name__ == '__main__': main()
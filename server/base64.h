@@ -0,0 +1,21 @@
+// Base64 for binary payloads in JSON replies (display bundles, spill pages).
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+inline std::string base64_encode(const char *data, size_t n) {
+    static const char *abc = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve((n + 2) / 3 * 4);
+    for (size_t i = 0; i < n; i += 3) {
+        uint32_t v = uint32_t(uint8_t(data[i])) << 16;
+        if (i + 1 < n) v |= uint32_t(uint8_t(data[i + 1])) << 8;
+        if (i + 2 < n) v |= uint8_t(data[i + 2]);
+        out += abc[v >> 18];
+        out += abc[(v >> 12) & 63];
+        out += i + 1 < n ? abc[(v >> 6) & 63] : '=';
+        out += i + 2 < n ? abc[v & 63] : '=';
+    }
+    return out;
+}
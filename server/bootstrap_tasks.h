@@ -0,0 +1,105 @@
+// Background work that overlaps the serial LLDB bootstrap: page-cache
+// readahead of the libraries and packages the REPL maps later, and other
+// steps with no dependency on the main thread. MOJO_REPL_SERIAL_STARTUP=1
+// turns it off.
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "startup_profile.h"
+
+// Ask the kernel to start reading a file into the page cache without
+// copying it anywhere. Returns the file size.
+inline size_t readahead_file(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    off_t size = lseek(fd, 0, SEEK_END);
+#ifdef __APPLE__
+    radvisory ra{0, static_cast<int>(std::min<off_t>(size, INT32_MAX))};
+    fcntl(fd, F_RDADVISE, &ra);
+#else
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+    close(fd);
+    return size > 0 ? size_t(size) : 0;
+}
+
+// Read a file through so its pages are resident, not just scheduled.
+inline size_t touch_file(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    static thread_local char buf[1 << 20];
+    size_t total = 0;
+    for (ssize_t n; (n = read(fd, buf, sizeof(buf))) > 0;) total += n;
+    close(fd);
+    return total;
+}
+
+// Apply fn to regular files under dir whose name ends with one of suffixes.
+inline void for_each_file(const std::string &dir, const std::vector<std::string> &suffixes,
+                          const std::function<void(const std::string &)> &fn) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec)) continue;
+        auto name = it->path().filename().string();
+        for (auto &suf : suffixes)
+            if (name.size() >= suf.size() && name.compare(name.size() - suf.size(), suf.size(), suf) == 0) {
+                fn(it->path().string());
+                break;
+            }
+    }
+}
+
+// Named tasks on their own threads, timed into the startup profile. Tasks
+// nothing waits for are joined when the object goes away.
+class BootstrapTasks {
+public:
+    explicit BootstrapTasks(StartupProfile &profile)
+        : profile_(profile), enabled_(std::getenv("MOJO_REPL_SERIAL_STARTUP") == nullptr) {}
+
+    BootstrapTasks(const BootstrapTasks &) = delete;
+    BootstrapTasks &operator=(const BootstrapTasks &) = delete;
+
+    ~BootstrapTasks() { WaitAll(); }
+
+    bool enabled() const { return enabled_; }
+
+    void Run(const std::string &name, std::function<void()> fn) {
+        if (!enabled_) return;
+        auto handle = profile_.StartTask(name);
+        threads_[name] = std::thread([this, handle, fn = std::move(fn)] {
+            fn();
+            profile_.FinishTask(handle);
+        });
+    }
+
+    // Block until the named task is done; no-op if it never ran.
+    void Wait(const std::string &name) {
+        auto it = threads_.find(name);
+        if (it == threads_.end()) return;
+        it->second.join();
+        threads_.erase(it);
+    }
+
+    void WaitAll() {
+        for (auto &[name, t] : threads_) t.join();
+        threads_.clear();
+    }
+
+private:
+    StartupProfile &profile_;
+    bool enabled_;
+    std::map<std::string, std::thread> threads_;
+};
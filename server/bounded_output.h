@@ -0,0 +1,181 @@
+// Bounded capture of one output stream. The first head_bytes and the
+// last tail_bytes stay in memory; everything after the head is spilled
+// to a file so huge outputs can still be paged through with `read_output`.
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "base64.h"
+#include "json.hpp"
+
+struct OutputLimits {
+    size_t head_bytes = 3 << 20;
+    size_t tail_bytes = 1 << 20;
+    std::string spill_dir;
+
+    // MOJO_REPL_OUTPUT_LIMIT_KB caps in-memory output per stream (3/4 head,
+    // 1/4 tail; 0 = unlimited). MOJO_REPL_SPILL_DIR defaults to $TMPDIR.
+    static OutputLimits FromEnv() {
+        OutputLimits l;
+        if (auto v = std::getenv("MOJO_REPL_OUTPUT_LIMIT_KB")) {
+            size_t kb = std::strtoull(v, nullptr, 10);
+            l.head_bytes = kb ? kb * 1024 / 4 * 3 : SIZE_MAX;
+            l.tail_bytes = kb ? kb * 1024 / 4 : 0;
+        }
+        auto dir = std::getenv("MOJO_REPL_SPILL_DIR");
+        if (!dir) dir = std::getenv("TMPDIR");
+        l.spill_dir = dir ? dir : "/tmp";
+        return l;
+    }
+
+    // Counts bytes but keeps nothing; used to drop stale output.
+    static OutputLimits Discard() {
+        OutputLimits l;
+        l.head_bytes = l.tail_bytes = 0;
+        return l;
+    }
+};
+
+// Length of the longest prefix of s[0, n) that does not end inside a UTF-8
+// sequence, and offset of the first byte in s that starts one.
+inline size_t utf8_prefix_len(const std::string &s, size_t n) {
+    size_t i = n;
+    while (i > 0 && n - i < 4 && (static_cast<unsigned char>(s[i - 1]) & 0xC0) == 0x80) i--;
+    if (i == 0) return n;
+    auto lead = static_cast<unsigned char>(s[i - 1]);
+    size_t len = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+    return n - (i - 1) >= len ? n : i - 1;
+}
+
+inline size_t utf8_start(const std::string &s) {
+    size_t i = 0;
+    while (i < s.size() && i < 4 && (static_cast<unsigned char>(s[i]) & 0xC0) == 0x80) i++;
+    return i;
+}
+
+class BoundedOutput {
+public:
+    // The spill file is created on the first overflow with mkstemps as
+    // spill_prefix + "-XXXXXX.out", so a name planted in a shared spill dir
+    // can't redirect the write. An empty prefix disables spilling.
+    BoundedOutput(OutputLimits limits, std::string spill_prefix)
+        : limits_(std::move(limits)), spill_prefix_(std::move(spill_prefix)) {}
+
+    BoundedOutput(const BoundedOutput &) = delete;
+    BoundedOutput &operator=(const BoundedOutput &) = delete;
+
+    ~BoundedOutput() {
+        if (spill_) fclose(spill_);
+    }
+
+    void Append(const char *data, size_t n) {
+        total_ += n;
+        if (head_.size() < limits_.head_bytes) {
+            size_t take = std::min(n, limits_.head_bytes - head_.size());
+            head_.append(data, take);
+            data += take;
+            n -= take;
+        }
+        if (n == 0) return;
+        if (!spill_ && !spill_tried_ && !spill_prefix_.empty() && !limits_.spill_dir.empty()) OpenSpill();
+        if (spill_) fwrite(data, 1, n, spill_);
+        spilled_ += n;
+        if (limits_.tail_bytes == 0) return;
+        tail_.append(data, n);
+        // Trim lazily so memory stays below 2x the tail cap.
+        if (tail_.size() > 2 * limits_.tail_bytes) tail_.erase(0, tail_.size() - limits_.tail_bytes);
+    }
+
+    void Append(const std::string &s) { Append(s.data(), s.size()); }
+
+    size_t size() const { return total_; }
+    bool empty() const { return total_ == 0; }
+    bool spilled() const { return spilled_ > 0; }
+    // Path of the spill file, once created.
+    const std::string &spill_path() const { return spill_path_; }
+
+    // Delete the spill file of output that is being thrown away.
+    void RemoveSpill() {
+        if (spill_) fclose(spill_);
+        spill_ = nullptr;
+        if (!spill_path_.empty()) unlink(spill_path_.c_str());
+        spill_path_.clear();
+    }
+
+    // In-memory view: the whole stream if it fit, otherwise head, an omission
+    // marker and tail.
+    std::string Text() const {
+        if (!spilled()) return head_;
+        std::string tail = tail_.size() > limits_.tail_bytes
+            ? tail_.substr(tail_.size() - limits_.tail_bytes) : tail_;
+        tail = tail.substr(utf8_start(tail));
+        std::string out = head_.substr(0, utf8_prefix_len(head_, head_.size()));
+        size_t omitted = total_ - head_.size() - tail.size();
+        out += "\n[... " + std::to_string(omitted) + " bytes omitted";
+        if (spill_) out += "; full output after byte " + std::to_string(head_.size()) + " in " + spill_path_;
+        out += " ...]\n";
+        return out + tail;
+    }
+
+    // Reference to the spill file for the reply, or null if nothing spilled.
+    nlohmann::json SpillInfo() {
+        if (!spill_) return nullptr;
+        fflush(spill_);
+        return {{"path", spill_path_}, {"size", spilled_}, {"offset", head_.size()}, {"total_bytes", total_}};
+    }
+
+private:
+    void OpenSpill() {
+        spill_tried_ = true;
+        std::string templ = spill_prefix_ + "-XXXXXX.out";
+        int fd = mkstemps(templ.data(), 4);
+        if (fd < 0) return;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        spill_ = fdopen(fd, "wb");
+        if (!spill_) {
+            close(fd);
+            unlink(templ.c_str());
+            return;
+        }
+        spill_path_ = templ;
+    }
+
+    OutputLimits limits_;
+    std::string spill_prefix_, spill_path_;
+    std::string head_, tail_;
+    FILE *spill_ = nullptr;
+    bool spill_tried_ = false;
+    size_t total_ = 0, spilled_ = 0;
+};
+
+// Read a page of a spill file for the `read_output` request. With
+// base64, data is the exact bytes. Otherwise it is text: a page ends
+// before a UTF-8 sequence it would cut, so next_offset (offset + length)
+// picks up where it left off and the pages join into the exact stream.
+// Bytes that aren't UTF-8 at all are still replaced when the reply is
+// serialized.
+inline nlohmann::json read_spill(const std::string &path, size_t offset, size_t length, bool base64 = false) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) return {{"status", "error"}, {"ename", "ProtocolError"}, {"evalue", "cannot open " + path},
+                    {"traceback", nlohmann::json::array()}};
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    std::string data;
+    if (offset < size) {
+        data.resize(std::min(length, size - offset));
+        fseek(f, offset, SEEK_SET);
+        data.resize(fread(&data[0], 1, data.size(), f));
+    }
+    fclose(f);
+    // A sequence longer than the whole page is returned as is.
+    if (!base64 && offset + data.size() < size)
+        if (auto n = utf8_prefix_len(data, data.size()); n > 0) data.resize(n);
+    size_t n = data.size();
+    return {{"status", "ok"}, {"data", base64 ? base64_encode(data.data(), n) : data},
+            {"encoding", base64 ? "base64" : "utf-8"}, {"offset", offset}, {"length", n},
+            {"next_offset", offset + n}, {"size", size}, {"eof", offset + n >= size}};
+}
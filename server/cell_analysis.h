@@ -0,0 +1,252 @@
+// Lightweight, line-based classification of Mojo cells. Not a parser: it
+// looks at top-level (unindented) lines only, which is enough to tell
+// definition-only cells from cells that run code or declare state.
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+enum class TopLevelKind { Blank, Definition, Import, Statement };
+
+inline std::string strip(const std::string &s) {
+    auto b = s.find_first_not_of(" \t\r");
+    if (b == std::string::npos) return "";
+    auto e = s.find_last_not_of(" \t\r");
+    return s.substr(b, e - b + 1);
+}
+
+inline bool starts_with_word(const std::string &s, const std::string &word) {
+    return s.compare(0, word.size(), word) == 0 &&
+           (s.size() == word.size() || s[word.size()] == ' ' || s[word.size()] == '\t' ||
+            s[word.size()] == '[' || s[word.size()] == '(' || s[word.size()] == ':');
+}
+
+inline TopLevelKind classify_line(const std::string &line) {
+    auto s = strip(line);
+    if (s.empty() || s[0] == '#' || s.compare(0, 3, "\"\"\"") == 0) return TopLevelKind::Blank;
+    if (starts_with_word(s, "import") || starts_with_word(s, "from")) return TopLevelKind::Import;
+    // Decorators introduce a definition on a later line.
+    if (s[0] == '@') return TopLevelKind::Definition;
+    for (auto kw : {"fn", "def", "struct", "trait", "alias", "comptime"})
+        if (starts_with_word(s, kw)) return TopLevelKind::Definition;
+    return TopLevelKind::Statement;
+}
+
+// Top-level lines with their classification. Indented lines and lines inside
+// a triple-quoted string belong to the preceding top-level line.
+struct TopLevelLine {
+    std::string text;
+    TopLevelKind kind;
+};
+
+inline std::vector<TopLevelLine> top_level_lines(const std::string &code) {
+    std::vector<TopLevelLine> out;
+    bool in_docstring = false;
+    size_t start = 0;
+    while (start <= code.size()) {
+        auto nl = code.find('\n', start);
+        auto end = nl == std::string::npos ? code.size() : nl;
+        auto line = code.substr(start, end - start);
+        start = end + 1;
+        // An odd number of """ toggles the docstring state for later lines.
+        size_t quotes = 0;
+        for (size_t p = line.find("\"\"\""); p != std::string::npos; p = line.find("\"\"\"", p + 3)) quotes++;
+        bool was_in_docstring = in_docstring;
+        if (quotes % 2) in_docstring = !in_docstring;
+        if (was_in_docstring || line.empty() || line[0] == ' ' || line[0] == '\t') continue;
+        out.push_back({line, classify_line(line)});
+        if (nl == std::string::npos) break;
+    }
+    return out;
+}
+
+// True for cells made only of fn/def/struct/trait/alias definitions and
+// imports: they declare no vars and run no code at the top level, so they
+// can be cached or submitted together with neighbouring definition cells.
+inline bool is_definition_cell(const std::string &code) {
+    bool any = false;
+    for (auto &l : top_level_lines(code)) {
+        if (l.kind == TopLevelKind::Statement) return false;
+        if (l.kind != TopLevelKind::Blank) any = true;
+    }
+    return any;
+}
+
+// The cell's top-level import lines, e.g. to re-establish imported names.
+inline std::string import_lines(const std::string &code) {
+    std::string out;
+    for (auto &l : top_level_lines(code))
+        if (l.kind == TopLevelKind::Import) out += l.text + "\n";
+    return out;
+}
+
+// True if the cell defines at least one fn/struct/trait/alias (as opposed
+// to only importing).
+inline bool defines_anything(const std::string &code) {
+    for (auto &l : top_level_lines(code))
+        if (l.kind == TopLevelKind::Definition) return true;
+    return false;
+}
+
+// A top-level `var` declaration: `var name`, `var name: Type` or
+// `var name[: Type] = expr`. type is empty when not annotated.
+struct VarDecl {
+    std::string name, type;
+};
+
+inline bool is_ident_char(char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; }
+
+inline bool parse_var_decl(const std::string &line, VarDecl &decl) {
+    auto s = strip(line);
+    if (!starts_with_word(s, "var")) return false;
+    size_t i = 3;
+    while (i < s.size() && (s[i] == ' ' || s[i] == '\t')) i++;
+    size_t b = i;
+    while (i < s.size() && is_ident_char(s[i])) i++;
+    if (i == b) return false;
+    decl.name = s.substr(b, i - b);
+    decl.type.clear();
+    while (i < s.size() && s[i] == ' ') i++;
+    if (i < s.size() && s[i] == ':') {
+        // The annotation ends at the first `=` outside brackets.
+        int depth = 0;
+        size_t t = ++i;
+        for (; i < s.size(); i++) {
+            if (s[i] == '[' || s[i] == '(') depth++;
+            else if (s[i] == ']' || s[i] == ')') depth--;
+            else if (s[i] == '=' && depth == 0) break;
+        }
+        decl.type = strip(s.substr(t, i - t));
+    }
+    return true;
+}
+
+inline std::vector<VarDecl> declared_vars(const std::string &code) {
+    std::vector<VarDecl> vars;
+    VarDecl d;
+    for (auto &l : top_level_lines(code))
+        if (l.kind == TopLevelKind::Statement && parse_var_decl(l.text, d)) vars.push_back(d);
+    return vars;
+}
+
+// True if every top-level statement of the cell is a `var` declaration.
+inline bool is_var_only_cell(const std::string &code) {
+    bool any = false;
+    VarDecl d;
+    for (auto &l : top_level_lines(code)) {
+        if (l.kind == TopLevelKind::Blank) continue;
+        if (l.kind != TopLevelKind::Statement || !parse_var_decl(l.text, d)) return false;
+        any = true;
+    }
+    return any;
+}
+
+// Identifiers in code outside comments and string literals. With
+// attributes false, names right after a `.` (`xs.append`) are left out.
+inline std::set<std::string> identifiers(const std::string &code, bool attributes = true) {
+    std::set<std::string> out;
+    size_t i = 0, n = code.size();
+    while (i < n) {
+        char c = code[i];
+        if (c == '#') {
+            while (i < n && code[i] != '\n') i++;
+        } else if (c == '"' || c == '\'') {
+            bool triple = code.compare(i, 3, std::string(3, c)) == 0;
+            size_t q = triple ? 3 : 1;
+            for (i += q; i < n; i++) {
+                if (code[i] == '\\') i++;
+                else if (triple ? code.compare(i, 3, std::string(3, c)) == 0 : code[i] == c || code[i] == '\n') break;
+            }
+            i += triple ? 3 : 1;
+        } else if (is_ident_char(c)) {
+            size_t b = i;
+            while (i < n && is_ident_char(code[i])) i++;
+            // Not number literals such as 3e5 or 0xff.
+            if (std::isdigit(static_cast<unsigned char>(c))) continue;
+            size_t p = b;
+            while (p > 0 && (code[p - 1] == ' ' || code[p - 1] == '\t')) p--;
+            if (attributes || p == 0 || code[p - 1] != '.') out.insert(code.substr(b, i - b));
+        } else {
+            i++;
+        }
+    }
+    return out;
+}
+
+// First identifier in s at or after pos.
+inline std::string ident_at(const std::string &s, size_t pos) {
+    while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t')) pos++;
+    size_t b = pos;
+    while (pos < s.size() && is_ident_char(s[pos])) pos++;
+    return s.substr(b, pos - b);
+}
+
+// Names a cell binds or writes at the top level: definitions, imported
+// names, vars, plain assignments (which overwrite a name another cell
+// bound) and statements that mutate a name in place, such as
+// `xs.append(4)`, `xs[0] = 1` or `p.x = 3`.
+inline std::set<std::string> defined_names(const std::string &code) {
+    std::set<std::string> out;
+    auto add = [&](const std::string &name) {
+        if (!name.empty()) out.insert(name);
+    };
+    for (auto &l : top_level_lines(code)) {
+        auto s = strip(l.text);
+        if (l.kind == TopLevelKind::Definition) {
+            for (auto kw : {"fn", "def", "struct", "trait", "alias", "comptime"})
+                if (starts_with_word(s, kw)) add(ident_at(s, std::string(kw).size()));
+        } else if (l.kind == TopLevelKind::Import) {
+            // `import a.b [as c]`, `from m import x, y as z`; `*` binds
+            // names we can't see.
+            bool from = starts_with_word(s, "from");
+            auto at = from ? s.find(" import ") : 0;
+            if (at == std::string::npos) continue;
+            std::string list = s.substr(at + (from ? 8 : 6));
+            list.erase(std::remove_if(list.begin(), list.end(), [](char c) { return c == '(' || c == ')'; }),
+                       list.end());
+            std::istringstream items(list);
+            for (std::string item; std::getline(items, item, ',');) {
+                item = strip(item);
+                auto as = item.find(" as ");
+                if (as != std::string::npos) add(ident_at(item, as + 4));
+                else if (item != "*") add(ident_at(item, 0));
+            }
+        } else if (l.kind == TopLevelKind::Statement) {
+            VarDecl d;
+            if (parse_var_decl(s, d)) {
+                add(d.name);
+                continue;
+            }
+            auto name = ident_at(s, 0);
+            if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0]))) continue;
+            auto rest = strip(s.substr(name.size()));
+            // A method call, subscript or attribute of the name may change
+            // its value; without types we can't tell, so count it.
+            if (!rest.empty() && (rest[0] == '.' || rest[0] == '[')) {
+                add(name);
+                continue;
+            }
+            // `x = ...` or `x += ...`, but not `x == ...`, `x <= ...`.
+            auto eq = rest.find('=');
+            if (eq != std::string::npos && eq <= 2 && rest.compare(eq, 2, "==") != 0 &&
+                rest.find_first_not_of("+-*/%&|^<>@", 0) == eq && rest.compare(0, eq, "<") != 0 &&
+                rest.compare(0, eq, ">") != 0)
+                add(name);
+        }
+    }
+    return out;
+}
+
+// True if name occurs in code as a whole identifier.
+inline bool mentions(const std::string &code, const std::string &name) {
+    for (size_t p = code.find(name); p != std::string::npos; p = code.find(name, p + 1)) {
+        bool left = p == 0 || !is_ident_char(code[p - 1]);
+        bool right = p + name.size() >= code.size() || !is_ident_char(code[p + name.size()]);
+        if (left && right) return true;
+    }
+    return false;
+}
@@ -0,0 +1,89 @@
+// Dependencies between executed cells, for re-running only what an edit
+// affects. Each cell the client tags with a cell_id is recorded with the
+// names it binds or mutates at the top level and the identifiers it mentions
+// (cell_analysis.h). Cells are ordered by when their id was first run,
+// which follows the notebook for the usual top-to-bottom workflow.
+//
+// The dependents of a cell are the later cells that read or rebind a name
+// it binds, and transitively theirs. Rebinding counts because re-running
+// the cell overwrites the later cell's value of that name.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "cell_analysis.h"
+#include "json.hpp"
+
+class CellGraph {
+public:
+    struct Cell {
+        std::string id, code;
+        std::set<std::string> defines, reads;
+        uint64_t order = 0;
+    };
+
+    void Record(const std::string &id, const std::string &code) {
+        auto [it, added] = cells_.try_emplace(id);
+        auto &c = it->second;
+        if (added) {
+            c.id = id;
+            c.order = next_order_++;
+        }
+        c.code = code;
+        c.defines = defined_names(code);
+        c.reads = identifiers(code);
+    }
+
+    const Cell *Find(const std::string &id) const {
+        auto it = cells_.find(id);
+        return it == cells_.end() ? nullptr : &it->second;
+    }
+
+    // Cells to re-run after id, in execution order. new_code is the
+    // edited version, if any: names it binds count as well as the old ones.
+    std::vector<const Cell *> Dependents(const std::string &id, const std::string &new_code = "") const {
+        std::vector<const Cell *> out;
+        auto *root = Find(id);
+        if (!root) return out;
+        std::set<std::string> dirty = root->defines;
+        if (!new_code.empty())
+            for (auto &n : defined_names(new_code)) dirty.insert(n);
+        for (auto *c : Ordered()) {
+            if (c->order <= root->order) continue;
+            auto touches = [&](const std::set<std::string> &names) {
+                return std::any_of(names.begin(), names.end(), [&](auto &n) { return dirty.count(n) > 0; });
+            };
+            if (!touches(c->reads) && !touches(c->defines)) continue;
+            out.push_back(c);
+            dirty.insert(c->defines.begin(), c->defines.end());
+        }
+        return out;
+    }
+
+    void Clear() {
+        cells_.clear();
+        next_order_ = 0;
+    }
+
+    size_t size() const { return cells_.size(); }
+
+    nlohmann::json CellJson(const Cell &c) const {
+        return {{"cell_id", c.id}, {"defines", c.defines}};
+    }
+
+private:
+    std::vector<const Cell *> Ordered() const {
+        std::vector<const Cell *> v;
+        for (auto &[_, c] : cells_) v.push_back(&c);
+        std::sort(v.begin(), v.end(), [](auto *a, auto *b) { return a->order < b->order; });
+        return v;
+    }
+
+    std::map<std::string, Cell> cells_;
+    uint64_t next_order_ = 0;
+};
@@ -0,0 +1,443 @@
+// `checkpoint` and `restore` requests: save a session's REPL state to a file
+// and rebuild it in a fresh inferior, faster than re-running the history.
+//
+// A checkpoint holds the source of every successful cell plus the memory
+// of `var`s whose bytes can be copied as-is: scalars/SIMD ("pod") and
+// List of those ("list", the element buffer is saved). Addresses, sizes and
+// types are probed through hidden REPL cells; memory is moved with
+// SBProcess::ReadMemory/WriteMemory in 1 MiB chunks, so large buffers are
+// streamed rather than held in memory.
+//
+// Restore replays definition cells (coalesced), declares memory-restored
+// vars with a default value (once, where each was last declared), and
+// re-runs cells that declare or touch vars that can't be copied (strings,
+// dicts, user structs, ...) or whose effects aren't known. Only cells made
+// of memory-restored vars and a few side-effect-free builtins are skipped.
+// The saved bytes are written back once every cell has run. A var that a re-run cell
+// reads is replayed instead, along with the cells that assign it, so the
+// re-run cell sees the value the var had at that point in the history, not
+// its final one.
+//
+// File layout: "MOJOCKPT1\n", one JSON header line, then the raw bytes of
+// each memory-restored var in header order.
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cell_analysis.h"
+#include "repl_session.h"
+
+constexpr const char *kCheckpointMagic = "MOJOCKPT1";
+constexpr size_t kCheckpointChunk = 1 << 20;
+
+// get_type_name moved between stdlib releases; the first import that
+// works is used. It is imported inside the probe helper, so the only name
+// probing leaves in the REPL is the helper itself.
+inline const std::vector<std::string> kTypeNameImports = {
+    "from compile.reflection import get_type_name",
+    "from reflection import get_type_name",
+};
+
+inline std::string type_name_helper(const std::string &import) {
+    return "fn __mojo_repl_type_name[T: AnyType](x: T) -> String:\n    " + import +
+           "\n    return get_type_name[T]()\n";
+}
+
+inline std::vector<std::string> split_type_args(const std::string &args) {
+    std::vector<std::string> out;
+    int depth = 0;
+    size_t start = 0;
+    for (size_t i = 0; i <= args.size(); i++) {
+        if (i == args.size() || (args[i] == ',' && depth == 0)) {
+            out.push_back(strip(args.substr(start, i - start)));
+            start = i + 1;
+        } else if (args[i] == '[') depth++;
+        else if (args[i] == ']') depth--;
+    }
+    return out;
+}
+
+// Turn a reflected type name into source: drop module qualifiers and spell
+// SIMD dtypes as DType members ("stdlib.builtin.simd.SIMD[float32, 4]" ->
+// "SIMD[DType.float32, 4]").
+inline std::string normalize_type(const std::string &t) {
+    auto open = t.find('[');
+    auto head = t.substr(0, open);
+    if (auto dot = head.rfind('.'); dot != std::string::npos) head = head.substr(dot + 1);
+    if (open == std::string::npos) return head;
+    auto args = split_type_args(t.substr(open + 1, t.rfind(']') - open - 1));
+    std::string out = head + "[";
+    for (size_t i = 0; i < args.size(); i++) {
+        auto a = normalize_type(args[i]);
+        if (head == "SIMD" && i == 0 && a.rfind("DType.", 0) != 0) a = "DType." + a;
+        out += (i ? ", " : "") + a;
+    }
+    return out + "]";
+}
+
+// Builtins and keywords a skipped cell may use besides memory-restored
+// vars: with only these, its effect is on those vars (whose final bytes
+// are restored) and its output. Anything else, e.g. a call to random.seed
+// or a user function, may change state later cells read, so it re-runs.
+inline const std::set<std::string> kSkippableNames = {
+    "print", "len", "range", "min", "max", "abs", "round", "String", "List", "SIMD", "Scalar", "DType",
+    "True", "False", "None", "for", "in", "if", "elif", "else", "while", "and", "or", "not", "is",
+    "pass", "break", "continue", "sep", "end"};
+
+inline bool is_pod_type(const std::string &type) {
+    static const std::set<std::string> scalars = {
+        "Int", "UInt", "Bool", "Float16", "BFloat16", "Float32", "Float64",
+        "Int8", "Int16", "Int32", "Int64", "UInt8", "UInt16", "UInt32", "UInt64"};
+    return scalars.count(type) || type.rfind("SIMD[", 0) == 0 || type.rfind("Scalar[", 0) == 0;
+}
+
+// Element type of List[T, ...] if T is pod, else "".
+inline std::string pod_list_element(const std::string &type) {
+    if (type.rfind("List[", 0) != 0) return "";
+    auto args = split_type_args(type.substr(5, type.rfind(']') - 5));
+    return !args.empty() && is_pod_type(args[0]) ? args[0] : "";
+}
+
+struct CheckpointVar {
+    std::string name, type, kind;  // kind: pod, list or replay
+    std::string elem;              // list element type
+    uint64_t addr = 0;             // pod: the var; list: element buffer
+    uint64_t bytes = 0, count = 0;
+
+    json ToJson() const {
+        json j = {{"name", name}, {"type", type}, {"kind", kind}, {"bytes", bytes}};
+        if (kind == "list") {
+            j["count"] = count;
+            j["elem"] = elem;
+        }
+        return j;
+    }
+};
+
+// Hidden-cell probes of var addresses and types.
+class VarProber {
+public:
+    // The helper survives until the next launch; define it only if an
+    // earlier checkpoint in this inferior hasn't.
+    explicit VarProber(ReplSession &s) : s_(s) {
+        have_type_name_ = !Line("print(\"__ckpt__\", __mojo_repl_type_name(Int(0)))").empty();
+        for (auto &imp : kTypeNameImports) {
+            if (have_type_name_) break;
+            have_type_name_ = s_.RunHidden(type_name_helper(imp)).second.empty();
+        }
+    }
+
+    // Fill type/kind/addr/bytes for v. Unknown or non-copyable types become
+    // kind "replay".
+    void Probe(CheckpointVar &v) {
+        v.kind = "replay";
+        if (v.type.empty() && have_type_name_) {
+            auto line = Line("print(\"__ckpt__\", __mojo_repl_type_name(" + v.name + "))");
+            if (!line.empty()) v.type = normalize_type(line);
+        }
+        if (v.type.empty()) return;
+        v.elem = pod_list_element(v.type);
+        if (is_pod_type(v.type)) {
+            auto ptr = "UnsafePointer(to=" + v.name + ")";
+            std::istringstream in(Line("print(\"__ckpt__\", Int(" + ptr + "), Int(" + ptr + " + 1) - Int(" + ptr + "))"));
+            if (in >> v.addr >> v.bytes) v.kind = "pod";
+        } else if (!v.elem.empty()) {
+            auto ptr = v.name + ".unsafe_ptr()";
+            std::istringstream in(Line("print(\"__ckpt__\", Int(" + ptr + "), len(" + v.name + "), Int(" + ptr +
+                                       " + 1) - Int(" + ptr + "))"));
+            uint64_t elem_size = 0;
+            if (in >> v.addr >> v.count >> elem_size) {
+                v.kind = "list";
+                v.bytes = v.count * elem_size;
+            }
+        }
+    }
+
+    // Re-read the address of an already-typed var after restore. A list
+    // that a re-run cell left at a different length is resized first, so
+    // the saved elements fit exactly.
+    bool Locate(CheckpointVar &v) {
+        if (v.kind == "pod") {
+            std::istringstream in(Line("print(\"__ckpt__\", Int(UnsafePointer(to=" + v.name + ")))"));
+            return bool(in >> v.addr);
+        }
+        uint64_t count = 0;
+        std::istringstream in(Line("print(\"__ckpt__\", Int(" + v.name + ".unsafe_ptr()), len(" + v.name + "))"));
+        if (!(in >> v.addr >> count)) return false;
+        if (count == v.count) return true;
+        if (!s_.RunHidden(v.name + ".resize(" + std::to_string(v.count) + ", " + v.elem + "())").second.empty())
+            return false;
+        std::istringstream again(Line("print(\"__ckpt__\", Int(" + v.name + ".unsafe_ptr()), len(" + v.name + "))"));
+        return (again >> v.addr >> count) && count == v.count;
+    }
+
+private:
+    // Run a probe and return what follows the "__ckpt__ " marker.
+    std::string Line(const std::string &code) {
+        auto [out, err] = s_.RunHidden(code);
+        if (!err.empty()) return "";
+        auto p = out.find("__ckpt__ ");
+        if (p == std::string::npos) return "";
+        auto end = out.find_first_of("\r\n", p);
+        return strip(out.substr(p + 9, end == std::string::npos ? std::string::npos : end - p - 9));
+    }
+
+    ReplSession &s_;
+    bool have_type_name_ = false;
+};
+
+inline json checkpoint_error(const std::string &msg) {
+    return {{"status", "error"}, {"ename", "CheckpointError"}, {"evalue", msg}, {"traceback", json::array({msg})}};
+}
+
+// Copy between inferior memory and a file in chunks.
+inline bool stream_memory(SBProcess &process, FILE *f, uint64_t addr, uint64_t bytes, bool to_file,
+                          std::string &err) {
+    std::vector<char> buf(std::min<uint64_t>(bytes, kCheckpointChunk));
+    for (uint64_t done = 0; done < bytes;) {
+        size_t n = std::min<uint64_t>(buf.size(), bytes - done);
+        SBError e;
+        if (to_file) {
+            if (process.ReadMemory(addr + done, buf.data(), n, e) != n || e.Fail() || fwrite(buf.data(), 1, n, f) != n) {
+                err = "read failed at " + std::to_string(addr + done);
+                return false;
+            }
+        } else {
+            if (fread(buf.data(), 1, n, f) != n || process.WriteMemory(addr + done, buf.data(), n, e) != n || e.Fail()) {
+                err = "write failed at " + std::to_string(addr + done);
+                return false;
+            }
+        }
+        done += n;
+    }
+    return true;
+}
+
+inline json checkpoint_session(ReplSession &s, const std::string &path) {
+    auto t0 = std::chrono::steady_clock::now();
+    if (!s.dead_reason.empty()) return checkpoint_error("session is dead: " + s.dead_reason);
+    if (path.empty()) return checkpoint_error("checkpoint needs a path");
+
+    // The last declaration of each name is the live one.
+    std::vector<CheckpointVar> vars;
+    std::map<std::string, size_t> index;
+    for (auto &cell : s.history)
+        for (auto &d : declared_vars(cell)) {
+            if (!index.count(d.name)) {
+                index[d.name] = vars.size();
+                vars.emplace_back();
+            }
+            auto &v = vars[index[d.name]];
+            v.name = d.name;
+            v.type = d.type;
+        }
+
+    VarProber prober(s);
+    json var_table = json::array();
+    for (auto &v : vars) {
+        prober.Probe(v);
+        var_table.push_back(v.ToJson());
+    }
+
+    auto tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) return checkpoint_error("cannot write " + tmp);
+    json header = {{"version", 1}, {"toolchain", toolchain_fingerprint(s.root)},
+                   {"cells", s.history}, {"vars", var_table}};
+    auto header_line = std::string(kCheckpointMagic) + "\n" + header.dump(-1, ' ', false, json::error_handler_t::replace) + "\n";
+    fwrite(header_line.data(), 1, header_line.size(), f);
+    uint64_t bytes = 0;
+    json memory = json::array(), replay = json::array();
+    for (auto &v : vars) {
+        if (v.kind == "replay") {
+            replay.push_back(v.name);
+            continue;
+        }
+        std::string err;
+        if (!stream_memory(s.process, f, v.addr, v.bytes, true, err)) {
+            fclose(f);
+            unlink(tmp.c_str());
+            return checkpoint_error("var " + v.name + ": " + err);
+        }
+        bytes += v.bytes;
+        memory.push_back(v.name);
+    }
+    bool ok = fclose(f) == 0 && rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) return checkpoint_error("cannot write " + path);
+    auto wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    return {{"status", "ok"}, {"path", path}, {"cells", s.history.size()}, {"memory_vars", memory},
+            {"replay_vars", replay}, {"memory_bytes", bytes}, {"wall_ms", round_ms(wall)}};
+}
+
+inline json restore_session(ReplSession &s, const std::string &path) {
+    auto t0 = std::chrono::steady_clock::now();
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) return checkpoint_error("cannot open " + path);
+    std::string magic, header_line;
+    {
+        char buf[16] = {};
+        if (!fgets(buf, sizeof(buf), f)) buf[0] = 0;
+        magic = strip(buf);
+        for (int c; (c = fgetc(f)) != EOF && c != '\n';) header_line += char(c);
+    }
+    json header;
+    try { header = json::parse(header_line); } catch (const std::exception &) {}
+    if (magic != kCheckpointMagic || !header.is_object()) {
+        fclose(f);
+        return checkpoint_error(path + " is not a checkpoint");
+    }
+    long blob_base = ftell(f);
+
+    // Memory layouts are only trusted under the same toolchain.
+    bool same_toolchain = header.value("toolchain", "") == toolchain_fingerprint(s.root);
+    std::map<std::string, CheckpointVar> memory_vars;
+    std::map<std::string, long> offsets;
+    long offset = blob_base;
+    std::set<std::string> replay_vars;
+    for (auto &j : header["vars"]) {
+        CheckpointVar v;
+        v.name = j.value("name", "");
+        v.type = j.value("type", "");
+        v.kind = j.value("kind", "replay");
+        v.elem = j.value("elem", "");
+        v.bytes = j.value("bytes", uint64_t(0));
+        v.count = j.value("count", uint64_t(0));
+        if (v.kind != "replay") {
+            offsets[v.name] = offset;
+            offset += v.bytes;
+        }
+        if (v.kind == "replay" || !same_toolchain) replay_vars.insert(v.name);
+        else memory_vars[v.name] = v;
+    }
+
+    auto cells = header.value("cells", json::array());
+    // A var declared in several cells is declared once, at the last.
+    std::map<std::string, size_t> last_decl;
+    for (size_t i = 0; i < cells.size(); i++)
+        for (auto &d : declared_vars(cells[i].get<std::string>())) last_decl[d.name] = i;
+
+    enum class Step { Define, Declare, Rerun, Skip };
+    auto step = [&](const std::string &cell) {
+        if (is_definition_cell(cell)) return Step::Define;
+        auto decls = declared_vars(cell);
+        bool all_memory = is_var_only_cell(cell);
+        for (auto &d : decls) all_memory = all_memory && memory_vars.count(d.name);
+        if (all_memory) return Step::Declare;
+        if (!decls.empty()) return Step::Rerun;
+        for (auto &name : identifiers(cell, false))
+            if (!memory_vars.count(name) && !kSkippableNames.count(name) && !is_pod_type(name)) return Step::Rerun;
+        return Step::Skip;
+    };
+
+    // A memory-restored var that a re-run cell reads would only hold its
+    // final value when that cell runs: replay it instead. That can make
+    // more cells re-run, so repeat until nothing changes.
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto &c : cells) {
+            auto cell = c.get<std::string>();
+            if (step(cell) != Step::Rerun) continue;
+            std::set<std::string> own;
+            for (auto &d : declared_vars(cell)) own.insert(d.name);
+            for (auto it = memory_vars.begin(); it != memory_vars.end();) {
+                if (own.count(it->first) || !mentions(cell, it->first)) {
+                    ++it;
+                    continue;
+                }
+                replay_vars.insert(it->first);
+                it = memory_vars.erase(it);
+                changed = true;
+            }
+        }
+    }
+
+    // Restore cells aren't the user's: keep the session's usage totals.
+    auto usage = s.usage;
+    s.Stop();
+    if (auto err = s.Launch(); !err.empty()) {
+        fclose(f);
+        return checkpoint_error("relaunch failed: " + err);
+    }
+
+    VarProber prober(s);
+    size_t submissions = 0, skipped = 0, rerun = 0;
+    std::string batch, error;
+    auto submit = [&](const std::string &code) {
+        auto resp = s.Execute(code);
+        submissions++;
+        if (resp.value("status", "") != "ok")
+            error = "cell failed during restore: " + resp.value("evalue", std::string("unknown error"));
+    };
+    auto flush = [&] {
+        if (batch.empty()) return;
+        submit(batch);
+        batch.clear();
+    };
+
+    for (size_t i = 0; i < cells.size(); i++) {
+        if (!error.empty()) break;
+        auto cell = cells[i].get<std::string>();
+        switch (step(cell)) {
+        case Step::Define:
+            batch += cell + "\n\n";
+            break;
+        case Step::Declare:
+            // Declare with a default value; the bytes come from the file.
+            for (auto &d : declared_vars(cell)) {
+                if (last_decl[d.name] != i) continue;
+                auto &v = memory_vars[d.name];
+                if (v.kind == "pod") batch += "var " + v.name + ": " + v.type + " = " + v.type + "()\n";
+                else batch += "var " + v.name + " = " + v.type + "(length=" + std::to_string(v.count) +
+                              ", fill=" + v.elem + "())\n";
+            }
+            batch += "\n";
+            break;
+        case Step::Rerun:
+            flush();
+            if (!error.empty()) break;
+            submit(cell);
+            rerun++;
+            break;
+        case Step::Skip:
+            skipped++;
+            break;
+        }
+    }
+    if (error.empty()) flush();
+    // Nothing re-run reads the memory-restored vars, so their final bytes
+    // go in last. Lists a re-run cell resized are resized back first.
+    for (auto &[name, v] : memory_vars) {
+        if (!error.empty()) break;
+        if (!prober.Locate(v)) {
+            error = "cannot locate restored var " + name;
+            break;
+        }
+        fseek(f, offsets[name], SEEK_SET);
+        std::string err;
+        if (!stream_memory(s.process, f, v.addr, v.bytes, false, err)) error = "var " + name + ": " + err;
+    }
+    fclose(f);
+    s.usage = usage;
+    if (!error.empty()) return checkpoint_error(error);
+
+    s.history.clear();
+    for (auto &c : cells) s.history.push_back(c.get<std::string>());
+    json memory = json::array(), replay = json::array();
+    uint64_t bytes = 0;
+    for (auto &[name, v] : memory_vars) {
+        memory.push_back(name);
+        bytes += v.bytes;
+    }
+    for (auto &name : replay_vars) replay.push_back(name);
+    auto wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    return {{"status", "ok"}, {"path", path}, {"cells", cells.size()}, {"submissions", submissions},
+            {"rerun_cells", rerun}, {"skipped_cells", skipped}, {"memory_vars", memory},
+            {"replay_vars", replay}, {"memory_bytes", bytes}, {"same_toolchain", same_toolchain},
+            {"wall_ms", round_ms(wall)}};
+}
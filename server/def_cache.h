@@ -0,0 +1,252 @@
+// On-disk cache of compiled definition cells (MOJO_REPL_DEF_CACHE=<dir>).
+//
+// The REPL's JIT output can't be saved and reloaded, so a definition-only
+// cell is compiled ahead of time with `mojo package` into
+// mojo_cell_<key>.mojopkg instead. On a later run the cell is replaced by
+// an import of that package. Keys chain: key = H(toolchain, chain,
+// source), where the chain folds in the previous definition cell's key and
+// the import-only cells since, and each package imports its predecessor
+// and every earlier import line. So a cached cell only matches after the
+// same definitions and imports in the same order. A hit is only used while every earlier definition cell of
+// the session was a hit too; mixing REPL-compiled and packaged versions of
+// the same types would give two distinct types.
+//
+// The cache directory is added to MODULAR_MOJO_MAX_IMPORT_PATH after the
+// stdlib, comma separated. If the first hit can't find its package at all,
+// that path didn't take: the cache turns itself off for the process
+// instead of deleting packages that are fine.
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cell_analysis.h"
+#include "json.hpp"
+
+inline uint64_t fnv1a64(const std::string &data, uint64_t h = 14695981039346656037ull) {
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// 128-bit content hash as 32 hex digits (two FNV-1a passes, distinct seeds).
+inline std::string content_hash(const std::string &data) {
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)fnv1a64(data),
+             (unsigned long long)fnv1a64(data, 0x84222325cbf29ce4ull));
+    return buf;
+}
+
+// Identifies the Mojo toolchain without running it: size and mtime of the
+// driver, the stdlib package and the LLDB plugin.
+inline std::string toolchain_fingerprint(const std::string &root) {
+    std::string fp;
+    for (auto rel : {"/bin/mojo", "/lib/mojo/stdlib.mojopkg", "/lib/libMojoLLDB.so", "/lib/libMojoLLDB.dylib"}) {
+        struct stat st;
+        if (stat((root + rel).c_str(), &st) == 0)
+            fp += std::string(rel) + ":" + std::to_string(st.st_size) + ":" + std::to_string(st.st_mtime) + ";";
+    }
+    return content_hash(fp);
+}
+
+// Run argv with stdout/stderr discarded; returns true on exit status 0.
+// The server is multithreaded, so the child only makes async-signal-safe
+// calls before exec.
+inline bool run_quiet(const std::vector<std::string> &argv) {
+    std::vector<char *> args;
+    for (auto &a : argv) args.push_back(const_cast<char *>(a.c_str()));
+    args.push_back(nullptr);
+    ::pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv(args[0], args.data());
+        _exit(127);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+class DefinitionCache {
+public:
+    // What to submit for one cell, and how to account for it afterwards.
+    struct Plan {
+        bool definition = false;
+        bool imports_only = false;  // an import-only cell: not cached, but part of the chain
+        bool hit = false;
+        std::string key;
+        std::string imports;  // the cell's own import lines
+        std::string code;     // code to hand to the REPL
+    };
+
+    DefinitionCache(std::string dir, std::string root)
+        : dir_(std::move(dir)), root_(std::move(root)), toolchain_(toolchain_fingerprint(root_)) {
+        std::error_code ec;
+        std::filesystem::create_directories(dir_ + "/tmp", ec);
+        builder_ = std::thread([this] { BuildLoop(); });
+    }
+
+    DefinitionCache(const DefinitionCache &) = delete;
+    DefinitionCache &operator=(const DefinitionCache &) = delete;
+
+    ~DefinitionCache() {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stop_ = true;
+            queue_.clear();
+        }
+        cv_.notify_all();
+        builder_.join();
+    }
+
+    static std::string PackageName(const std::string &key) { return "mojo_cell_" + key; }
+
+    // A fresh inferior has none of the chain's definitions.
+    void Reset() {
+        prev_key_.clear();
+        chain_key_.clear();
+        chain_imports_.clear();
+        chain_intact_ = true;
+    }
+
+    Plan Prepare(const std::string &code) {
+        Plan plan;
+        plan.code = code;
+        if (!is_definition_cell(code)) return plan;
+        plan.imports = import_lines(code);
+        if (!defines_anything(code)) {
+            plan.imports_only = true;
+            return plan;
+        }
+        plan.definition = true;
+        plan.key = content_hash(toolchain_ + "\n" + chain_key_ + "\n" + code);
+        struct stat st;
+        plan.hit = chain_intact_ && importable_ && stat(PackagePath(plan.key).c_str(), &st) == 0;
+        if (plan.hit) plan.code = plan.imports + "from " + PackageName(plan.key) + " import *\n";
+        return plan;
+    }
+
+    // Record the outcome of a cell run as planned. A successful miss is
+    // queued for packaging; a failed cell leaves the chain unchanged.
+    void Commit(const Plan &plan, bool ok) {
+        if (!ok || (!plan.definition && !plan.imports_only)) return;
+        std::lock_guard<std::mutex> lock(mu_);
+        if (plan.imports_only) {
+            // Later packages need these names too, and a different set
+            // of imports must give different keys.
+            chain_key_ = content_hash(toolchain_ + "\n" + chain_key_ + "\n" + plan.imports);
+            chain_imports_ += plan.imports;
+            return;
+        }
+        if (plan.hit) {
+            hits_++;
+        } else {
+            misses_++;
+            chain_intact_ = false;
+            queue_.push_back({plan.key, prev_key_, chain_imports_, plan.code});
+            cv_.notify_one();
+        }
+        prev_key_ = plan.key;
+        chain_key_ = plan.key;
+        chain_imports_ += plan.imports;
+    }
+
+    // The package for a hit failed to import with error; stop using the
+    // cache until the next Reset(). If the REPL couldn't find the package
+    // at all, the cache directory isn't on its import path: stop using it
+    // for good and keep the package. Otherwise the package is stale and
+    // is deleted.
+    void Invalidate(const Plan &plan, const std::string &error) {
+        chain_intact_ = false;
+        if (error.find("unable to locate module") != std::string::npos &&
+            error.find(PackageName(plan.key)) != std::string::npos) {
+            if (importable_) std::cerr << "Definition cache " << dir_ << " is not on the REPL's import path; not using it\n";
+            importable_ = false;
+            return;
+        }
+        unlink(PackagePath(plan.key).c_str());
+    }
+
+    nlohmann::json Stats() {
+        std::lock_guard<std::mutex> lock(mu_);
+        return {{"dir", dir_}, {"hits", hits_}, {"misses", misses_}, {"built", built_},
+                {"build_failures", build_failures_}, {"pending", queue_.size()}, {"importable", importable_}};
+    }
+
+private:
+    struct Job {
+        std::string key, prev_key, imports, code;
+    };
+
+    std::string PackagePath(const std::string &key) const { return dir_ + "/" + PackageName(key) + ".mojopkg"; }
+
+    // Packages are built in session order, so a cell's predecessor is
+    // already in the cache when it compiles.
+    void BuildLoop() {
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mu_);
+                cv_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+                if (stop_) return;
+                job = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            bool ok = Build(job);
+            std::lock_guard<std::mutex> lock(mu_);
+            (ok ? built_ : build_failures_)++;
+        }
+    }
+
+    bool Build(const Job &job) {
+        struct stat st;
+        if (stat(PackagePath(job.key).c_str(), &st) == 0) return true;
+        auto tag = std::to_string(getpid()) + "-" + job.key;
+        auto src = dir_ + "/tmp/src-" + tag + "/" + PackageName(job.key);
+        auto out = dir_ + "/tmp/" + tag + "-" + PackageName(job.key) + ".mojopkg";
+        std::error_code ec;
+        std::filesystem::create_directories(src, ec);
+        {
+            std::ofstream init(src + "/__init__.mojo");
+            init << job.imports;
+            if (!job.prev_key.empty()) init << "from " << PackageName(job.prev_key) << " import *\n";
+            init << job.code << "\n";
+        }
+        bool ok = run_quiet({root_ + "/bin/mojo", "package", src, "-I", dir_, "-o", out}) &&
+                  rename(out.c_str(), PackagePath(job.key).c_str()) == 0;
+        unlink(out.c_str());
+        std::filesystem::remove_all(dir_ + "/tmp/src-" + tag, ec);
+        return ok;
+    }
+
+    std::string dir_, root_, toolchain_;
+    std::string prev_key_, chain_key_, chain_imports_;
+    bool chain_intact_ = true, importable_ = true;
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Job> queue_;
+    bool stop_ = false;
+    int64_t hits_ = 0, misses_ = 0, built_ = 0, build_failures_ = 0;
+    std::thread builder_;
+};
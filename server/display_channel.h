@@ -0,0 +1,226 @@
+// Rich output (display_data) from Mojo code. A file mapped by both the
+// server and the inferior holds a ring of records, each one MIME type and
+// its bytes; the Mojo hook `display(mime, data)` copies a record in with
+// one memcpy and rings a doorbell FIFO. The server's stdio reader wakes on
+// the doorbell and turns records into Jupyter MIME bundles, so a plot never
+// goes through stdout or the debugger as text.
+//
+// Layout: a 64-byte header {magic, region size, write_pos, read_pos}, then
+// the ring. Positions only grow; a record starts at pos % region with
+// {u32 record bytes (8-aligned), u32 mime bytes, u64 data bytes}, then the
+// MIME type and data. A zero record size marks the rest of the ring as
+// unused and the next record starts at offset 0. The writer waits while
+// a record wouldn't fit behind read_pos.
+//
+// The hook writes one doorbell byte after each record, and the reader
+// consumes only as many records as it has read bytes: the FIFO write/read
+// pair orders the record's memory writes before the server reads them.
+// Once the inferior is stopped, everything is read.
+//
+// The hook is defined by a hidden cell the first time a cell mentions
+// `display` or `display_bytes` after a launch. Besides those two it only
+// adds `__mojo_repl_`-prefixed names; its imports are aliased so they
+// can't clash with the user's. MOJO_REPL_DISPLAY_MB turns the channel on
+// and sets the ring size; it is off by default, and then no hook is
+// defined. Needs the FIFO stdio path (inferior_stdio.h).
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "base64.h"
+#include "json.hpp"
+
+// A Jupyter bundle for one record: binary types are base64 encoded as the
+// notebook format expects, JSON types are parsed.
+inline nlohmann::json display_bundle(const std::string &mime, const char *data, size_t n) {
+    nlohmann::json value;
+    bool is_json = mime == "application/json" || (mime.size() > 5 && mime.compare(mime.size() - 5, 5, "+json") == 0);
+    bool is_text = mime.rfind("text/", 0) == 0 || mime == "image/svg+xml" || mime == "application/javascript";
+    if (is_json) {
+        value = nlohmann::json::parse(data, data + n, nullptr, false);
+        if (value.is_discarded()) value = std::string(data, n);
+    } else if (is_text) {
+        value = std::string(data, n);
+    } else {
+        value = base64_encode(data, n);
+    }
+    return {{"data", {{mime, value}}}, {"metadata", nlohmann::json::object()}};
+}
+
+class DisplayChannel {
+public:
+    using DisplayFn = std::function<void(nlohmann::json)>;
+
+    static constexpr size_t kHeader = 64;
+    static constexpr uint64_t kMagic = 0x3179616c70736964;  // "display1"
+
+    DisplayChannel() = default;
+    DisplayChannel(const DisplayChannel &) = delete;
+    DisplayChannel &operator=(const DisplayChannel &) = delete;
+
+    ~DisplayChannel() {
+        if (base_) munmap(base_, size_);
+        for (int fd : {bell_[0], bell_[1]})
+            if (fd >= 0) close(fd);
+        for (auto *p : {&path_, &bell_path_})
+            if (!p->empty()) unlink(p->c_str());
+        if (!dir_.empty()) rmdir(dir_.c_str());
+    }
+
+    // Ring size in bytes from MOJO_REPL_DISPLAY_MB; 0 when disabled.
+    static size_t SizeFromEnv() {
+        auto v = std::getenv("MOJO_REPL_DISPLAY_MB");
+        return (v ? std::strtoull(v, nullptr, 10) : 0) << 20;
+    }
+
+    bool Create(const std::string &tmpdir, size_t region) {
+        auto templ = tmpdir + "/mojo-repl-display-XXXXXX";
+        if (!mkdtemp(templ.data())) return false;
+        dir_ = templ;
+        path_ = dir_ + "/ring";
+        bell_path_ = dir_ + "/bell";
+        region_ = region / 8 * 8;
+        size_ = kHeader + region_;
+        int fd = open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0) return false;
+        // Sparse: pages are only backed once a record touches them.
+        bool sized = ftruncate(fd, off_t(size_)) == 0;
+        void *base = sized ? mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (base == MAP_FAILED) return false;
+        base_ = static_cast<char *>(base);
+        if (mkfifo(bell_path_.c_str(), 0600) != 0) return false;
+        bell_[0] = open(bell_path_.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        bell_[1] = open(bell_path_.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (bell_[0] < 0 || bell_[1] < 0) return false;
+        Reset();
+        return true;
+    }
+
+    // Empty the ring for a new inferior; call while none is running and
+    // nothing drains.
+    void Reset() {
+        header()[0] = kMagic;
+        header()[1] = region_;
+        header()[2] = header()[3] = 0;
+        char buf[256];
+        while (read(bell_[0], buf, sizeof(buf)) > 0) {}
+        rung_ = 0;
+    }
+
+    int bell_fd() const { return bell_[0]; }
+    uint64_t bundles() const { return bundles_; }
+    uint64_t bytes() const { return bytes_; }
+
+    // Pass on the records announced by the doorbell, or with all set (the
+    // inferior is stopped) every record in the ring.
+    void Drain(bool all, const DisplayFn &fn) {
+        char buf[256];
+        ssize_t n;
+        while ((n = read(bell_[0], buf, sizeof(buf))) > 0) rung_ += n;
+        uint64_t pos = __atomic_load_n(&header()[3], __ATOMIC_RELAXED);
+        while (all || rung_ > 0) {
+            uint64_t end = __atomic_load_n(&header()[2], __ATOMIC_ACQUIRE);
+            if (pos >= end) break;
+            const char *rec = base_ + kHeader + pos % region_;
+            uint32_t len, mime_len;
+            uint64_t data_len;
+            memcpy(&len, rec, 4);
+            if (len == 0) {
+                pos += region_ - pos % region_;
+                continue;
+            }
+            memcpy(&mime_len, rec + 4, 4);
+            memcpy(&data_len, rec + 8, 8);
+            if (16 + mime_len + data_len > len || pos % region_ + len > region_) {
+                // Corrupt; drop everything written so far.
+                pos = end;
+                break;
+            }
+            std::string mime(rec + 16, mime_len);
+            auto bundle = display_bundle(mime, rec + 16 + mime_len, data_len);
+            pos += len;
+            // Free the space before the (possibly slow) delivery.
+            __atomic_store_n(&header()[3], pos, __ATOMIC_RELEASE);
+            if (rung_ > 0) rung_--;
+            bundles_++;
+            bytes_ += data_len;
+            if (fn) fn(std::move(bundle));
+        }
+        __atomic_store_n(&header()[3], pos, __ATOMIC_RELEASE);
+        if (all) rung_ = 0;
+    }
+
+    // Mojo source of the hook, for a hidden cell.
+    std::string Prelude() const {
+        auto size = std::to_string(size_), region = std::to_string(region_);
+        return R"(from sys.ffi import external_call as __mojo_repl_external_call
+from memory import UnsafePointer as __mojo_repl_UnsafePointer, memcpy as __mojo_repl_memcpy
+from time import sleep as __mojo_repl_sleep
+
+fn __mojo_repl_display(mime: String, data: List[UInt8]) raises:
+    alias region = )" + region + R"(
+    var mime_len = mime.byte_length()
+    var need = (16 + mime_len + len(data) + 7) // 8 * 8
+    if need > region:
+        raise Error("display payload of " + String(len(data)) + " bytes exceeds the " + String(region) + "-byte display channel")
+    var path = String(")" + path_ + R"(")
+    var fd = __mojo_repl_external_call["open", Int32](path.unsafe_cstr_ptr(), Int32(2))
+    if fd < 0:
+        raise Error("display channel unavailable")
+    var base = __mojo_repl_external_call["mmap", __mojo_repl_UnsafePointer[UInt8]](__mojo_repl_UnsafePointer[UInt8](), Int()" + size + R"(), Int32(3), Int32(1), fd, Int(0))
+    _ = __mojo_repl_external_call["close", Int32](fd)
+    if Int(base) == -1:
+        raise Error("cannot map the display channel")
+    var hdr = base.bitcast[UInt64]()
+    var pos = Int(hdr[2])
+    var off = pos % region
+    if off + need > region:
+        while pos + region - off - Int(hdr[3]) > region:
+            __mojo_repl_sleep(0.001)
+        (base + )" + std::to_string(kHeader) + R"( + off).bitcast[UInt32]()[0] = 0
+        pos += region - off
+        off = 0
+    while pos + need - Int(hdr[3]) > region:
+        __mojo_repl_sleep(0.001)
+    var rec = base + )" + std::to_string(kHeader) + R"( + off
+    rec.bitcast[UInt32]()[0] = UInt32(need)
+    rec.bitcast[UInt32]()[1] = UInt32(mime_len)
+    (rec + 8).bitcast[UInt64]()[0] = UInt64(len(data))
+    __mojo_repl_memcpy(dest=rec + 16, src=mime.unsafe_ptr(), count=mime_len)
+    __mojo_repl_memcpy(dest=rec + 16 + mime_len, src=data.unsafe_ptr(), count=len(data))
+    hdr[2] = UInt64(pos + need)
+    _ = __mojo_repl_external_call["munmap", Int32](base, Int()" + size + R"())
+    var bell = String(")" + bell_path_ + R"(")
+    var bfd = __mojo_repl_external_call["open", Int32](bell.unsafe_cstr_ptr(), Int32(1))
+    if bfd >= 0:
+        var one = UInt8(1)
+        _ = __mojo_repl_external_call["write", Int](bfd, __mojo_repl_UnsafePointer(to=one), Int(1))
+        _ = __mojo_repl_external_call["close", Int32](bfd)
+
+fn display(mime: String, data: String) raises:
+    __mojo_repl_display(mime, List[UInt8](data.as_bytes()))
+
+fn display_bytes(mime: String, data: List[UInt8]) raises:
+    __mojo_repl_display(mime, data)
+)";
+    }
+
+private:
+    uint64_t *header() { return reinterpret_cast<uint64_t *>(base_); }
+
+    std::string dir_, path_, bell_path_;
+    char *base_ = nullptr;
+    size_t size_ = 0, region_ = 0;
+    int bell_[2] = {-1, -1};
+    uint64_t rung_ = 0, bundles_ = 0, bytes_ = 0;
+};
@@ -0,0 +1,230 @@
+// The inferior's stdout/stderr, read by the server from FIFOs instead of
+// LLDB's STDIO buffer (SBProcess::GetSTDOUT). The inferior is launched
+// with fd 1/2 opened on the FIFOs, and a reader thread moves the bytes
+// straight into the running cell's BoundedOutput sinks, and optionally to
+// a stream callback, as they arrive. Nothing is buffered inside LLDB, the
+// inferior never blocks on a full pipe, and output can be shown live.
+//
+// FIFOs rather than pipe fds: LLDB launches the inferior through
+// lldb-server/debugserver, which doesn't inherit the server's fds, but can
+// open a path. The server also holds a write end of each FIFO, so the
+// read end never sees EOF across inferior restarts.
+//
+// Opt-in with MOJO_REPL_FIFO_STDIO=1 until it has been validated against
+// more toolchains; by default output goes through LLDB's buffer.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <lldb/API/SBLaunchInfo.h>
+
+#include "bounded_output.h"
+#include "display_channel.h"
+#include "terminal_output.h"
+
+class InferiorStdio {
+public:
+    // Called with a stream name ("stdout"/"stderr") and the next chunk.
+    using StreamFn = std::function<void(const char *, const std::string &)>;
+
+    // Chunks are sent once this large or this old.
+    static constexpr size_t kStreamChunk = 64 << 10;
+    static constexpr int kStreamFlushMs = 50;
+
+    InferiorStdio() = default;
+    InferiorStdio(const InferiorStdio &) = delete;
+    InferiorStdio &operator=(const InferiorStdio &) = delete;
+
+    ~InferiorStdio() {
+        if (thread_.joinable()) {
+            stop_ = true;
+            char c = 0;
+            (void)!write(wake_[1], &c, 1);
+            thread_.join();
+        }
+        for (int fd : {read_[0], read_[1], hold_[0], hold_[1], wake_[0], wake_[1]})
+            if (fd >= 0) close(fd);
+        for (auto &p : paths_)
+            if (!p.empty()) unlink(p.c_str());
+        if (!dir_.empty()) rmdir(dir_.c_str());
+    }
+
+    static bool Enabled() { return std::getenv("MOJO_REPL_FIFO_STDIO") != nullptr; }
+
+    // Make the FIFOs under a fresh directory in tmpdir and start reading.
+    // display's records are read by the same thread, so they keep their
+    // place among the streamed output.
+    bool Create(const std::string &tmpdir, DisplayChannel *display = nullptr) {
+        display_ = display;
+        auto templ = tmpdir + "/mojo-repl-stdio-XXXXXX";
+        if (!mkdtemp(templ.data())) return false;
+        dir_ = templ;
+        const char *names[2] = {"stdout", "stderr"};
+        for (int i = 0; i < 2; i++) {
+            paths_[i] = dir_ + "/" + names[i];
+            if (mkfifo(paths_[i].c_str(), 0600) != 0) return false;
+            // Opening the read end non-blocking first lets the write ends
+            // open without waiting for a peer.
+            read_[i] = open(paths_[i].c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            hold_[i] = open(paths_[i].c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+            if (read_[i] < 0 || hold_[i] < 0) return false;
+        }
+        if (pipe(wake_) != 0) return false;
+        for (int fd : wake_) fcntl(fd, F_SETFD, FD_CLOEXEC);
+        thread_ = std::thread([this] { Loop(); });
+        return true;
+    }
+
+    void AddTo(lldb::SBLaunchInfo &info) const {
+        info.AddOpenFileAction(STDIN_FILENO, "/dev/null", true, false);
+        info.AddOpenFileAction(STDOUT_FILENO, paths_[0].c_str(), false, true);
+        info.AddOpenFileAction(STDERR_FILENO, paths_[1].c_str(), false, true);
+    }
+
+    // Route output to these sinks until Finish(). With fn set, output is
+    // also passed to it in chunks. With compact, `\r` redraws are applied
+    // first (terminal_output.h); a streamed partial line is shown at each
+    // flush. Display bundles go to display_fn.
+    void Attach(BoundedOutput *out, BoundedOutput *err, StreamFn fn = nullptr, bool compact = false,
+                DisplayChannel::DisplayFn display_fn = nullptr) {
+        std::lock_guard<std::mutex> lock(mu_);
+        sinks_[0] = out;
+        sinks_[1] = err;
+        stream_ = std::move(fn);
+        compact_ = compact;
+        display_fn_ = std::move(display_fn);
+        last_flush_ = std::chrono::steady_clock::now();
+    }
+
+    // Read whatever the (stopped) inferior has written, pass on pending
+    // stream chunks and detach the sinks.
+    void Finish() {
+        std::lock_guard<std::mutex> lock(mu_);
+        ReadAvailable(0, SIZE_MAX);
+        ReadAvailable(1, SIZE_MAX);
+        for (int i = 0; i < 2; i++)
+            compactors_[i].Finish([&](const char *p, size_t n) { Deliver(i, p, n); });
+        FlushStream(true);
+        if (display_) display_->Drain(true, display_fn_);
+        sinks_[0] = sinks_[1] = nullptr;
+        stream_ = nullptr;
+        display_fn_ = nullptr;
+    }
+
+    // Empty the display ring for a new inferior.
+    void ResetDisplay() {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (display_) display_->Reset();
+    }
+
+    // Drop anything written while no cell was running.
+    void Discard() {
+        Attach(nullptr, nullptr);
+        Finish();
+    }
+
+    uint64_t bytes_read() {
+        std::lock_guard<std::mutex> lock(mu_);
+        return bytes_read_;
+    }
+
+    // Bytes dropped by compaction so far.
+    uint64_t bytes_compacted() {
+        std::lock_guard<std::mutex> lock(mu_);
+        uint64_t n = 0;
+        for (auto &c : compactors_) n += c.bytes_in() - c.bytes_out();
+        return n;
+    }
+
+private:
+    void Loop() {
+        pollfd fds[4] = {{read_[0], POLLIN, 0}, {read_[1], POLLIN, 0}, {wake_[0], POLLIN, 0},
+                         {display_ ? display_->bell_fd() : -1, POLLIN, 0}};
+        while (!stop_) {
+            bool pending;
+            {
+                std::lock_guard<std::mutex> lock(mu_);
+                pending = !chunks_[0].empty() || !chunks_[1].empty();
+            }
+            int n = poll(fds, 4, pending ? kStreamFlushMs : -1);
+            if (n < 0 && errno != EINTR) break;
+            std::lock_guard<std::mutex> lock(mu_);
+            // Bounded reads per wake-up keep Finish() from waiting long.
+            for (int i = 0; i < 2; i++)
+                if (fds[i].revents & POLLIN) ReadAvailable(i, 1 << 20);
+            auto age = std::chrono::steady_clock::now() - last_flush_;
+            bool bell = fds[3].revents & POLLIN;
+            // Text printed before a display goes out before it.
+            if (age >= std::chrono::milliseconds(kStreamFlushMs) || bell) {
+                if (stream_ && compact_)
+                    for (int i = 0; i < 2; i++)
+                        compactors_[i].Flush([&](const char *p, size_t n) { Deliver(i, p, n); });
+                FlushStream();
+            }
+            if (bell) display_->Drain(false, display_fn_);
+        }
+    }
+
+    // Caller holds mu_.
+    void ReadAvailable(int i, size_t budget) {
+        char buf[65536];
+        while (budget > 0) {
+            ssize_t n = read(read_[i], buf, std::min(sizeof(buf), budget));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            budget -= std::min(budget, size_t(n));
+            bytes_read_ += n;
+            if (compact_) compactors_[i].Feed(buf, n, [&](const char *p, size_t k) { Deliver(i, p, k); });
+            else Deliver(i, buf, n);
+            if (stream_ && chunks_[i].size() >= kStreamChunk) FlushStream();
+        }
+    }
+
+    void Deliver(int i, const char *data, size_t n) {
+        if (sinks_[i]) sinks_[i]->Append(data, n);
+        if (stream_) chunks_[i].append(data, n);
+    }
+
+    // Caller holds mu_, so chunks go out in the order they were read. A
+    // UTF-8 sequence split by a read waits for the next chunk unless this
+    // is the final flush.
+    void FlushStream(bool final = false) {
+        last_flush_ = std::chrono::steady_clock::now();
+        const char *names[2] = {"stdout", "stderr"};
+        for (int i = 0; i < 2; i++) {
+            auto n = final ? chunks_[i].size() : utf8_prefix_len(chunks_[i], chunks_[i].size());
+            if (n == 0) continue;
+            if (stream_) stream_(names[i], chunks_[i].substr(0, n));
+            chunks_[i].erase(0, n);
+        }
+    }
+
+    std::string dir_, paths_[2];
+    int read_[2] = {-1, -1}, hold_[2] = {-1, -1}, wake_[2] = {-1, -1};
+    std::thread thread_;
+    std::atomic<bool> stop_{false};
+
+    std::mutex mu_;
+    BoundedOutput *sinks_[2] = {nullptr, nullptr};
+    StreamFn stream_;
+    bool compact_ = false;
+    DisplayChannel *display_ = nullptr;
+    DisplayChannel::DisplayFn display_fn_;
+    TerminalCompactor compactors_[2];
+    std::string chunks_[2];
+    std::chrono::steady_clock::time_point last_flush_ = std::chrono::steady_clock::now();
+    uint64_t bytes_read_ = 0;
+};
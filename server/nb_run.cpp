@@ -0,0 +1,241 @@
+// Headless notebook executor. Runs .ipynb files through the same REPL
+// bootstrap as mojo-repl-server and writes outputs back, without Jupyter.
+// A pool of forked workers (default: one per core) each own a debugger and
+// launch a fresh inferior per notebook, so notebooks never share REPL state.
+//
+// Usage: mojo-nb-run <modular-root> [-j N] [--allow-errors] [-o DIR]
+//                    [--memory-limit-mb N] [--cpu-limit-s S] [--cell-timeout-s S] nb.ipynb...
+// Prints one JSON line per notebook and exits non-zero if any notebook failed.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "repl_session.h"
+
+struct Options {
+    std::string root;
+    std::string output_dir;
+    bool allow_errors = false;
+    int jobs = 0;
+    int64_t cell_timeout_ms = 0;
+    ResourceLimits limits;
+    std::vector<std::string> notebooks;
+};
+
+[[noreturn]] static void usage() {
+    std::cerr << "Usage: mojo-nb-run <modular-root> [-j N] [--allow-errors] [-o DIR]\n"
+                 "                   [--memory-limit-mb N] [--cpu-limit-s S] [--cell-timeout-s S] nb.ipynb...\n";
+    std::exit(2);
+}
+
+static Options parse_args(int argc, char *argv[]) {
+    Options opts;
+    std::vector<std::string> args(argv + 1, argv + argc);
+    for (size_t i = 0; i < args.size(); i++) {
+        auto &a = args[i];
+        if (a == "-j" || a == "--jobs") {
+            if (++i >= args.size()) usage();
+            opts.jobs = std::atoi(args[i].c_str());
+        } else if (a == "-o" || a == "--output-dir") {
+            if (++i >= args.size()) usage();
+            opts.output_dir = args[i];
+        } else if (a == "--memory-limit-mb") {
+            if (++i >= args.size()) usage();
+            opts.limits.memory_kb = std::atoll(args[i].c_str()) * 1024;
+        } else if (a == "--cpu-limit-s") {
+            if (++i >= args.size()) usage();
+            opts.limits.cpu_ms = std::atof(args[i].c_str()) * 1000;
+        } else if (a == "--cell-timeout-s") {
+            if (++i >= args.size()) usage();
+            opts.cell_timeout_ms = int64_t(std::atof(args[i].c_str()) * 1000);
+        } else if (a == "--allow-errors") {
+            opts.allow_errors = true;
+        } else if (opts.root.empty()) {
+            opts.root = a;
+        } else {
+            opts.notebooks.push_back(a);
+        }
+    }
+    if (opts.root.empty() || opts.notebooks.empty()) usage();
+    if (opts.jobs <= 0) opts.jobs = std::max(1u, std::thread::hardware_concurrency());
+    opts.jobs = std::min<int>(opts.jobs, opts.notebooks.size());
+    return opts;
+}
+
+// nbformat stores multiline text either as one string or as a list of lines.
+static std::string join_source(const json &src) {
+    if (src.is_string()) return src.get<std::string>();
+    std::string out;
+    if (src.is_array())
+        for (auto &s : src) if (s.is_string()) out += s.get<std::string>();
+    return out;
+}
+
+static json split_source(const std::string &text) {
+    json lines = json::array();
+    size_t start = 0;
+    while (start < text.size()) {
+        auto nl = text.find('\n', start);
+        auto end = nl == std::string::npos ? text.size() : nl + 1;
+        lines.push_back(text.substr(start, end - start));
+        start = end;
+    }
+    return lines;
+}
+
+static std::string output_path(const Options &opts, const std::string &path) {
+    if (opts.output_dir.empty()) return path;
+    auto slash = path.rfind('/');
+    return opts.output_dir + "/" + (slash == std::string::npos ? path : path.substr(slash + 1));
+}
+
+static json cell_outputs(const json &resp) {
+    json outputs = json::array();
+    for (auto name : {"stdout", "stderr"}) {
+        auto text = resp.value(name, "");
+        if (!text.empty())
+            outputs.push_back({{"output_type", "stream"}, {"name", name}, {"text", split_source(text)}});
+    }
+    for (auto &bundle : resp.value("display_data", json::array()))
+        outputs.push_back({{"output_type", "display_data"}, {"data", bundle.value("data", json::object())},
+                           {"metadata", bundle.value("metadata", json::object())}});
+    if (resp.value("status", "") == "error")
+        outputs.push_back({{"output_type", "error"}, {"ename", resp.value("ename", "MojoError")},
+                           {"evalue", resp.value("evalue", "")},
+                           {"traceback", resp.value("traceback", json::array())}});
+    return outputs;
+}
+
+// Execute every code cell of one notebook in a freshly launched inferior.
+static json run_notebook(ReplSession &session, const Options &opts, const std::string &path) {
+    auto t0 = std::chrono::steady_clock::now();
+    json result = {{"notebook", path}, {"status", "ok"}, {"cells", 0}, {"errors", 0}};
+    auto finish = [&](json r) {
+        r["elapsed_ms"] = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - t0).count();
+        return r;
+    };
+
+    json nb;
+    try {
+        std::ifstream in(path);
+        if (!in) throw std::runtime_error("cannot open");
+        nb = json::parse(in);
+    } catch (const std::exception &e) {
+        result["status"] = "error";
+        result["message"] = "Failed to read notebook: " + std::string(e.what());
+        return finish(result);
+    }
+
+    if (auto err = session.Launch(); !err.empty()) {
+        session.Stop();
+        result["status"] = "error";
+        result["message"] = err;
+        return finish(result);
+    }
+
+    int count = 0, errors = 0;
+    bool stopped = false;
+    for (auto &cell : nb["cells"]) {
+        if (cell.value("cell_type", "") != "code") continue;
+        if (stopped) {
+            cell["outputs"] = json::array();
+            cell["execution_count"] = nullptr;
+            continue;
+        }
+        auto code = join_source(cell.value("source", json("")));
+        auto resp = session.Execute(code, opts.cell_timeout_ms);
+        cell["outputs"] = cell_outputs(resp);
+        cell["execution_count"] = ++count;
+        if (resp.value("status", "") == "error") {
+            errors++;
+            if (!opts.allow_errors || resp.value("needs_reset", false)) stopped = true;
+        }
+    }
+    session.Stop();
+
+    result["cells"] = count;
+    result["errors"] = errors;
+    if (errors) result["status"] = "error";
+
+    std::ofstream out(output_path(opts, path));
+    if (!out) {
+        result["status"] = "error";
+        result["message"] = "Failed to write " + output_path(opts, path);
+        return finish(result);
+    }
+    out << nb.dump(1, ' ', false, json::error_handler_t::replace) << "\n";
+    return finish(result);
+}
+
+// Worker loop: claim notebooks from the shared counter until none are left.
+// Returns the number of failed notebooks.
+static int run_worker(const Options &opts, std::atomic<size_t> *next) {
+    init_mojo_environment(opts.root);
+    ReplSession session(opts.root);
+    session.limits = opts.limits;
+    // Notebooks keep the head and tail of huge outputs; nothing reads spills.
+    session.output_limits.spill_dir.clear();
+    int failed = 0;
+    auto err = session.CreateDebugger();
+    for (size_t i; (i = next->fetch_add(1)) < opts.notebooks.size();) {
+        json result;
+        if (!err.empty()) result = {{"notebook", opts.notebooks[i]}, {"status", "error"}, {"message", err}};
+        else result = run_notebook(session, opts, opts.notebooks[i]);
+        if (result.value("status", "") != "ok") failed++;
+        // One write() per line keeps lines from different workers intact.
+        auto line = result.dump() + "\n";
+        write(STDOUT_FILENO, line.data(), line.size());
+    }
+    session.Destroy();
+    SBDebugger::Terminate();
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    auto opts = parse_args(argc, argv);
+
+    // Workers are forked before LLDB is initialized anywhere, so each one
+    // gets a clean debugger and never inherits another's threads.
+    auto *next = static_cast<std::atomic<size_t> *>(mmap(nullptr, sizeof(std::atomic<size_t>),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    if (next == MAP_FAILED) {
+        std::cerr << "mmap failed: " << strerror(errno) << "\n";
+        return 1;
+    }
+    new (next) std::atomic<size_t>(0);
+
+    std::vector<::pid_t> workers;
+    for (int w = 0; w < opts.jobs; w++) {
+        ::pid_t pid = fork();
+        if (pid < 0) {
+            std::cerr << "fork failed: " << strerror(errno) << "\n";
+            break;
+        }
+        if (pid == 0) _exit(std::min(run_worker(opts, next), 125));
+        workers.push_back(pid);
+    }
+    if (workers.empty()) return 1;
+    std::cerr << "Running " << opts.notebooks.size() << " notebook(s) on "
+              << workers.size() << " worker(s)\n";
+
+    int failed = 0;
+    for (auto pid : workers) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,185 @@
+// CPU, memory and page-fault sampling for the Mojo inferior (by pid) and for
+// the server itself, so execute replies can attribute cost to single cells.
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <libproc.h>
+#include <sys/proc.h>
+#include <mach/mach_time.h>
+#endif
+
+#include "json.hpp"
+
+struct ResourceSample {
+    bool valid = false, has_rss = false;
+    double user_ms = 0, sys_ms = 0;
+    int64_t rss_kb = 0, peak_rss_kb = 0;
+    int64_t minor_faults = 0, major_faults = 0;
+
+    double cpu_ms() const { return user_ms + sys_ms; }
+};
+
+#ifdef __APPLE__
+inline ResourceSample sample_process(int pid) {
+    ResourceSample s;
+    rusage_info_v4 ri;
+    if (proc_pid_rusage(pid, RUSAGE_INFO_V4, reinterpret_cast<rusage_info_t *>(&ri)) != 0) return s;
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    auto to_ms = [&](uint64_t t) { return double(t) * tb.numer / tb.denom / 1e6; };
+    s.valid = s.has_rss = true;
+    s.user_ms = to_ms(ri.ri_user_time);
+    s.sys_ms = to_ms(ri.ri_system_time);
+    s.rss_kb = ri.ri_resident_size / 1024;
+    s.peak_rss_kb = ri.ri_lifetime_max_phys_footprint / 1024;
+    s.major_faults = ri.ri_pageins;
+    return s;
+}
+#else
+// Reads /proc/<pid>/stat for CPU time and faults, /proc/<pid>/status for
+// current and peak RSS.
+inline ResourceSample sample_process(int pid) {
+    ResourceSample s;
+    auto dir = "/proc/" + std::to_string(pid);
+    std::ifstream stat_file(dir + "/stat");
+    std::string stat;
+    if (!std::getline(stat_file, stat)) return s;
+    // comm (field 2) may contain spaces; fields after it are space separated.
+    auto close = stat.rfind(')');
+    if (close == std::string::npos) return s;
+    std::istringstream fields(stat.substr(close + 2));
+    std::string f;
+    long ticks = sysconf(_SC_CLK_TCK);
+    for (int i = 3; fields >> f && i <= 15; i++) {
+        if (i == 10) s.minor_faults = std::stoll(f);
+        else if (i == 12) s.major_faults = std::stoll(f);
+        else if (i == 14) s.user_ms = std::stod(f) * 1000.0 / ticks;
+        else if (i == 15) s.sys_ms = std::stod(f) * 1000.0 / ticks;
+    }
+    std::ifstream status(dir + "/status");
+    for (std::string line; std::getline(status, line);) {
+        if (line.rfind("VmRSS:", 0) == 0) s.rss_kb = std::stoll(line.substr(6));
+        else if (line.rfind("VmHWM:", 0) == 0) s.peak_rss_kb = std::stoll(line.substr(6));
+    }
+    s.valid = s.has_rss = true;
+    return s;
+}
+#endif
+
+// Scheduler state of a process as the OS sees it: "running" (also
+// sleeping in a syscall), "stopped" (stopped or held by the debugger),
+// "zombie", or "" if there is no such process. Unlike SBProcess::GetState()
+// this takes no LLDB locks, so it can be polled while a cell runs.
+#ifdef __APPLE__
+inline std::string process_run_state(int pid) {
+    proc_bsdinfo info;
+    if (pid <= 0 || proc_pidinfo(pid, PROC_PIDTBSDINFO, 0, &info, sizeof(info)) != sizeof(info)) return "";
+    if (info.pbi_status == SSTOP) return "stopped";
+    if (info.pbi_status == SZOMB) return "zombie";
+    return "running";
+}
+#else
+inline std::string process_run_state(int pid) {
+    if (pid <= 0) return "";
+    std::ifstream stat_file("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    if (!std::getline(stat_file, stat)) return "";
+    auto close = stat.rfind(')');
+    if (close == std::string::npos || close + 2 >= stat.size()) return "";
+    switch (stat[close + 2]) {
+    case 't': case 'T': return "stopped";
+    case 'Z': case 'X': return "zombie";
+    default: return "running";
+    }
+}
+#endif
+
+// The server's own usage via getrusage. Current RSS is not available there,
+// so only the peak is reported.
+inline ResourceSample sample_self() {
+    ResourceSample s;
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return s;
+    s.valid = true;
+    s.user_ms = ru.ru_utime.tv_sec * 1000.0 + ru.ru_utime.tv_usec / 1000.0;
+    s.sys_ms = ru.ru_stime.tv_sec * 1000.0 + ru.ru_stime.tv_usec / 1000.0;
+#ifdef __APPLE__
+    s.peak_rss_kb = ru.ru_maxrss / 1024;
+#else
+    s.peak_rss_kb = ru.ru_maxrss;
+#endif
+    s.minor_faults = ru.ru_minflt;
+    s.major_faults = ru.ru_majflt;
+    return s;
+}
+
+inline double round_ms(double ms) { return std::round(ms * 10) / 10; }
+
+// Per-cell cost: differences for counters, after-values for gauges.
+inline nlohmann::json resource_delta(const ResourceSample &before, const ResourceSample &after) {
+    if (!before.valid || !after.valid) return nullptr;
+    nlohmann::json d = {{"cpu_ms", round_ms(after.cpu_ms() - before.cpu_ms())},
+                        {"user_ms", round_ms(after.user_ms - before.user_ms)},
+                        {"sys_ms", round_ms(after.sys_ms - before.sys_ms)},
+                        {"peak_rss_kb", after.peak_rss_kb},
+                        {"minor_faults", after.minor_faults - before.minor_faults},
+                        {"major_faults", after.major_faults - before.major_faults}};
+    if (after.has_rss) {
+        d["rss_kb"] = after.rss_kb;
+        d["rss_delta_kb"] = after.rss_kb - before.rss_kb;
+    }
+    return d;
+}
+
+// Session-wide aggregates of per-cell costs, returned by the `stats` request.
+struct ResourceTotals {
+    int64_t cells = 0;
+    double wall_ms = 0, inferior_cpu_ms = 0, server_cpu_ms = 0;
+    int64_t inferior_minor_faults = 0, inferior_major_faults = 0;
+    int64_t inferior_peak_rss_kb = 0;
+    double max_cell_cpu_ms = 0, max_cell_wall_ms = 0;
+    int64_t max_cpu_cell = 0, max_wall_cell = 0, max_rss_growth_cell = 0;
+    int64_t max_rss_growth_kb = 0;
+
+    void Add(double wall, const ResourceSample &inf0, const ResourceSample &inf1,
+             const ResourceSample &srv0, const ResourceSample &srv1) {
+        cells++;
+        wall_ms += wall;
+        if (wall > max_cell_wall_ms) { max_cell_wall_ms = wall; max_wall_cell = cells; }
+        if (srv0.valid && srv1.valid) server_cpu_ms += srv1.cpu_ms() - srv0.cpu_ms();
+        if (!inf0.valid || !inf1.valid) return;
+        double cpu = inf1.cpu_ms() - inf0.cpu_ms();
+        inferior_cpu_ms += cpu;
+        if (cpu > max_cell_cpu_ms) { max_cell_cpu_ms = cpu; max_cpu_cell = cells; }
+        inferior_minor_faults += inf1.minor_faults - inf0.minor_faults;
+        inferior_major_faults += inf1.major_faults - inf0.major_faults;
+        inferior_peak_rss_kb = std::max(inferior_peak_rss_kb, inf1.peak_rss_kb);
+        if (inf1.rss_kb - inf0.rss_kb > max_rss_growth_kb) {
+            max_rss_growth_kb = inf1.rss_kb - inf0.rss_kb;
+            max_rss_growth_cell = cells;
+        }
+    }
+
+    nlohmann::json ToJson() const {
+        return {{"cells", cells},
+                {"wall_ms", round_ms(wall_ms)},
+                {"inferior_cpu_ms", round_ms(inferior_cpu_ms)},
+                {"server_cpu_ms", round_ms(server_cpu_ms)},
+                {"inferior_minor_faults", inferior_minor_faults},
+                {"inferior_major_faults", inferior_major_faults},
+                {"inferior_peak_rss_kb", inferior_peak_rss_kb},
+                {"max_cell_cpu_ms", round_ms(max_cell_cpu_ms)}, {"max_cpu_cell", max_cpu_cell},
+                {"max_cell_wall_ms", round_ms(max_cell_wall_ms)}, {"max_wall_cell", max_wall_cell},
+                {"max_rss_growth_kb", max_rss_growth_kb}, {"max_rss_growth_cell", max_rss_growth_cell}};
+    }
+};
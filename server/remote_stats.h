@@ -0,0 +1,112 @@
+// gdb-remote traffic between LLDB and lldb-server/debugserver, counted
+// per cell. Every execute uploads JIT code, allocates memory, reads
+// registers and sets breakpoints through the remote stub, one round trip
+// per packet. With MOJO_REPL_PACKET_STATS=1 the session enables LLDB's
+// "gdb-remote packets" log into a callback that only counts (nothing is
+// written anywhere), and the execute reply reports the cell's traffic in
+// `timing.gdb_remote`.
+#pragma once
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <lldb/API/SBDebugger.h>
+
+#include "json.hpp"
+
+class RemotePacketStats {
+public:
+    static bool Enabled() { return std::getenv("MOJO_REPL_PACKET_STATS") != nullptr; }
+
+    bool Attach(lldb::SBDebugger &debugger) {
+        debugger.SetLoggingCallback(&RemotePacketStats::OnLog, this);
+        const char *categories[] = {"packets", nullptr};
+        return debugger.EnableLog("gdb-remote", categories);
+    }
+
+    void Begin() {
+        std::lock_guard<std::mutex> lock(mu_);
+        cell_ = Counts{};
+    }
+
+    nlohmann::json Cell() {
+        std::lock_guard<std::mutex> lock(mu_);
+        return cell_.ToJson();
+    }
+
+    nlohmann::json Totals() {
+        std::lock_guard<std::mutex> lock(mu_);
+        return total_.ToJson();
+    }
+
+    // "m", "M", "x", "Z", "vCont", "qMemoryRegionInfo", "_M", ...
+    static std::string PacketType(const char *p, size_t n) {
+        if (n > 0 && p[0] == '$') p++, n--;
+        if (n == 0) return "";
+        size_t len = 1;
+        if (std::strchr("qQvj_", p[0]))
+            while (len < n && std::isalpha(static_cast<unsigned char>(p[len]))) len++;
+        return std::string(p, len);
+    }
+
+private:
+    struct Counts {
+        uint64_t sent = 0, received = 0, bytes_sent = 0, bytes_received = 0, round_trips = 0;
+        std::map<std::string, uint64_t> by_type;
+
+        nlohmann::json ToJson() const {
+            return {{"round_trips", round_trips}, {"packets_sent", sent}, {"packets_received", received},
+                    {"bytes_sent", bytes_sent}, {"bytes_received", bytes_received}, {"by_type", by_type}};
+        }
+    };
+
+    static void OnLog(const char *msg, void *baton) {
+        static_cast<RemotePacketStats *>(baton)->Parse(msg);
+    }
+
+    // Log lines look like "<  18> send packet: $qProcessInfo#dc"; the
+    // number is the packet's size on the wire. A callback may carry
+    // several lines.
+    void Parse(const char *msg) {
+        std::lock_guard<std::mutex> lock(mu_);
+        while (msg && *msg) {
+            const char *eol = std::strchr(msg, '\n');
+            size_t len = eol ? size_t(eol - msg) : std::strlen(msg);
+            ParseLine(std::string(msg, len));
+            msg = eol ? eol + 1 : nullptr;
+        }
+    }
+
+    void ParseLine(const std::string &line) {
+        // Packet history dumped after an error repeats earlier packets.
+        if (line.find("history[") != std::string::npos) return;
+        bool send = true;
+        auto at = line.find("send packet: ");
+        if (at == std::string::npos) {
+            at = line.find("read packet: ");
+            send = false;
+        }
+        if (at == std::string::npos) return;
+        const char *payload = line.c_str() + at + 13;
+        size_t payload_len = line.size() - at - 13;
+        uint64_t bytes = payload_len;
+        auto open = line.rfind('<', at);
+        if (open != std::string::npos) bytes = std::strtoull(line.c_str() + open + 1, nullptr, 10);
+        bool ack = payload_len == 1 && (payload[0] == '+' || payload[0] == '-');
+        for (auto *c : {&cell_, &total_}) {
+            (send ? c->sent : c->received)++;
+            (send ? c->bytes_sent : c->bytes_received) += bytes;
+            if (send && !ack) {
+                c->round_trips++;
+                c->by_type[PacketType(payload, payload_len)]++;
+            }
+        }
+    }
+
+    std::mutex mu_;
+    Counts cell_, total_;
+};
@@ -3,33 +3,29 @@
 // JSON protocol on stdin/stdout.
 
 #include <cstdlib>
-#include <cstring>
 #include <iostream>
-#include <sstream>
+#include <mutex>
 #include <string>
-#include <unistd.h>
-#include <utility>
-#include <vector>
 
-#include <lldb/API/SBDebugger.h>
-#include <lldb/API/SBTarget.h>
-#include <lldb/API/SBProcess.h>
-#include <lldb/API/SBBreakpoint.h>
-#include <lldb/API/SBLanguageRuntime.h>
-#include <lldb/API/SBCommandInterpreter.h>
-#include <lldb/API/SBCommandReturnObject.h>
-#include <lldb/API/SBError.h>
-#include <lldb/Expression/REPL.h>
-#include <lldb/Utility/Status.h>
+#include "bootstrap_tasks.h"
+#include "checkpoint.h"
+#include "repl_session.h"
+#include "replay.h"
+#include "sessions.h"
 
-// Internal header for Target::GetREPL.
-#include <lldb/Target/Target.h>
+// Session workers reply from their own threads.
+static std::mutex send_mu;
 
-#include "json.hpp"
-#include "platform.h"
+// Cell output is arbitrary bytes; invalid UTF-8 is replaced rather than
+// aborting the dump.
+static void send(const json &msg) {
+    std::lock_guard<std::mutex> lock(send_mu);
+    std::cout << msg.dump(-1, ' ', false, json::error_handler_t::replace) << "\n" << std::flush;
+}
 
-using namespace lldb;
-using json = nlohmann::json;
+static json protocol_error(const std::string &msg) {
+    return {{"status", "error"}, {"ename", "ProtocolError"}, {"evalue", msg}, {"traceback", json::array()}};
+}
 
 [[noreturn]] static void die(const std::string &msg) {
     std::cerr << msg << "\n";
@@ -37,106 +33,67 @@ using json = nlohmann::json;
     std::exit(1);
 }
 
-static std::string drain(SBProcess &proc, size_t (SBProcess::*fn)(char*, size_t) const) {
-    std::string out;
-    char buf[65536];
-    size_t n;
-    while ((n = (proc.*fn)(buf, sizeof(buf))) > 0) out.append(buf, n);
-    return out;
-}
-
-// Drain LLDB debugger output captured in a temp file. The file is truncated
-// after each read so later responses only include new REPL output.
-static std::string drain_file(FILE *file) {
-    if (!file) return "";
-
-    fflush(file);
-    clearerr(file);
-    fseek(file, 0, SEEK_SET);
-
-    std::string out;
-    char buf[65536];
-    size_t n;
-    while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
-        out.append(buf, n);
-
-    ftruncate(fileno(file), 0);
-    fseek(file, 0, SEEK_SET);
-    clearerr(file);
-    return out;
-}
-
-// Collect output from both LLDB's REPL stream and the launched Mojo process.
-struct OutputCapture {
-    FILE *debugger_stdout = nullptr;
-    FILE *debugger_stderr = nullptr;
-
-    static OutputCapture Create() {
-        OutputCapture capture{std::tmpfile(), std::tmpfile()};
-        if (!capture.debugger_stdout || !capture.debugger_stderr)
-            die("Failed to create debugger output temp files");
-        return capture;
-    }
-
-    void AttachTo(SBDebugger &debugger) {
-        debugger.SetOutputFileHandle(debugger_stdout, false);
-        debugger.SetErrorFileHandle(debugger_stderr, false);
-    }
-
-    void Clear(SBProcess &process) {
-        drain(process, &SBProcess::GetSTDOUT);
-        drain(process, &SBProcess::GetSTDERR);
-        drain_file(debugger_stdout);
-        drain_file(debugger_stderr);
-    }
-
-    std::pair<std::string, std::string> Collect(SBProcess &process) {
-        auto out = drain_file(debugger_stdout);
-        out += drain(process, &SBProcess::GetSTDOUT);
-        auto err = drain_file(debugger_stderr);
-        err += drain(process, &SBProcess::GetSTDERR);
-        return {out, err};
-    }
-};
-
-static std::vector<std::string> split_lines(const std::string &s) {
-    std::vector<std::string> lines;
-    std::istringstream ss(s);
-    for (std::string line; std::getline(ss, line);)
-        if (!line.empty()) lines.push_back(line);
-    return lines;
-}
-
-// Access internal TargetSP from SBTarget.
-// SBTarget has a single member: TargetSP m_opaque_sp.
-static TargetSP get_target_sp(SBTarget &target) {
-    return *reinterpret_cast<TargetSP *>(&target);
-}
-
-static json handle_execute(const std::string &code,
-                            SBProcess &process,
-                            IOHandlerSP &io_handler,
-                            REPLSP &repl,
-                            OutputCapture &capture) {
-    if (code.empty())
-        return {{"status", "ok"}, {"stdout", ""}, {"stderr", ""}, {"value", ""}};
-
-    capture.Clear(process);
-
-    std::string mutable_code = code;
-    repl->IOHandlerInputComplete(*io_handler, mutable_code);
-
-    auto [out, serr] = capture.Collect(process);
-
-    if (!serr.empty()) {
-        auto tb = split_lines(serr);
-        return {{"status", "error"}, {"stdout", out}, {"stderr", serr},
-                {"ename", "MojoError"},
-                {"evalue", tb.empty() ? serr : tb[0]},
-                {"traceback", tb}};
+// A request that runs on the session's worker thread.
+static json handle(ReplSession &s, const json &req, const WarmupConfig &warmup) {
+    auto type = req.value("type", "");
+    json resp;
+    if (type == "execute") {
+        InferiorStdio::StreamFn stream;
+        DisplayChannel::DisplayFn display;
+        if (req.value("stream", false)) {
+            auto id = req.value("id", json(0));
+            stream = [id](const char *name, const std::string &text) {
+                send({{"id", id}, {"status", "stream"}, {"name", name}, {"text", text}});
+            };
+            display = [id](json bundle) {
+                bundle["id"] = id;
+                bundle["status"] = "display_data";
+                send(bundle);
+            };
+        }
+        std::optional<bool> compact;
+        if (req.contains("compact")) compact = req.value("compact", false);
+        resp = s.Execute(req.value("code", ""), req.value("timeout_ms", int64_t(0)), stream, compact, display);
+        track_cell(s, req, resp);
+    } else if (type == "dependents") {
+        resp = cell_dependents(s, req);
+    } else if (type == "replay") {
+        resp = replay_cells(s, req);
+    } else if (type == "checkpoint") {
+        resp = checkpoint_session(s, req.value("path", ""));
+    } else if (type == "restore") {
+        resp = restore_session(s, req.value("path", ""));
+        s.graph.Clear();
+        if (resp.value("status", "") == "ok" && warmup.mode != WarmupConfig::Off)
+            resp["warmup"] = s.Warmup(warmup.code);
+    } else if (type == "reset") {
+        s.profile.Begin();
+        s.Stop();
+        s.graph.Clear();
+        s.profile.Mark("stop");
+        if (auto err = s.Launch(); !err.empty())
+            resp = {{"status", "error"}, {"ename", "REPLError"}, {"evalue", err},
+                    {"traceback", json::array({err})}};
+        else {
+            resp = {{"status", "ok"}};
+            if (warmup.mode != WarmupConfig::Off) resp["warmup"] = s.Warmup(warmup.code);
+        }
+        if (s.profile.enabled()) resp["startup"] = s.profile.ToJson();
+    } else if (type == "limits") {
+        s.limits.Update(req);
+        if (s.process.IsValid()) s.ApplyLimits();
+        resp = {{"status", "ok"}, {"limits", s.limits.ToJson()}};
+    } else if (type == "read_output") {
+        resp = s.ReadOutput(req.value("path", ""), req.value("offset", size_t(0)),
+                            req.value("length", size_t(1 << 20)), req.value("encoding", "") == "base64");
+    } else if (type == "stats") {
+        resp = s.Stats();
+    } else if (type == "complete") {
+        resp = {{"status", "ok"}, {"completions", json::array()}};
+    } else {
+        resp = protocol_error("unknown request type: " + type);
     }
-
-    return {{"status", "ok"}, {"stdout", out}, {"stderr", serr}, {"value", ""}};
+    return resp;
 }
 
 int main(int argc, char *argv[]) {
@@ -145,114 +102,118 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     std::string root = argv[1];
-    auto entry_point = root + "/lib/mojo-repl-entry-point";
-    auto plugin_path = mojo_lldb_plugin(root);
-
-    setenv("MODULAR_MAX_PACKAGE_ROOT", root.c_str(), 1);
-    setenv("MODULAR_MOJO_MAX_PACKAGE_ROOT", root.c_str(), 1);
-    setenv("MODULAR_MOJO_MAX_DRIVER_PATH", (root + "/bin/mojo").c_str(), 1);
-    setenv("MODULAR_MOJO_MAX_IMPORT_PATH", (root + "/lib/mojo").c_str(), 1);
-
-    SBDebugger::Initialize();
-    auto debugger = SBDebugger::Create(false);
-    if (!debugger.IsValid()) die("Failed to create SBDebugger");
-
-    debugger.SetScriptLanguage(eScriptLanguageNone);
-    debugger.SetAsync(false);
-
-    auto output_capture = OutputCapture::Create();
-    output_capture.AttachTo(debugger);
-
-    auto ci = debugger.GetCommandInterpreter();
-    SBCommandReturnObject cmd_result;
-    ci.HandleCommand(("plugin load " + plugin_path).c_str(), cmd_result);
-    if (!cmd_result.Succeeded()) {
-        std::string msg = "Failed to load MojoLLDB plugin";
-        if (cmd_result.GetError()) msg += std::string(": ") + cmd_result.GetError();
-        die(msg);
+    ReplSession session(root);
+    session.profile.Begin();
+
+    // Overlap independent work with the serial bootstrap: readahead of the
+    // plugin and entry point, parsing the entry point while the plugin
+    // loads, and pulling in the stdlib packages and Mojo libraries while
+    // the inferior launches. Ready doesn't wait for the readahead tasks.
+    BootstrapTasks tasks(session.profile);
+    tasks.Run("readahead", [&] {
+        readahead_file(mojo_lldb_plugin(root));
+        readahead_file(session.EntryPoint());
+        for_each_file(root + "/lib", {".so", ".dylib"}, readahead_file);
+    });
+    init_mojo_environment(root);
+    session.profile.Mark("initialize");
+    tasks.Run("parse_entry_point", [&] { session.PreloadEntryPoint(); });
+
+    session.limits = ResourceLimits::FromEnv();
+    if (auto err = session.CreateDebugger(); !err.empty()) die(err);
+    tasks.Wait("parse_entry_point");
+    session.profile.Mark("wait_entry_point");
+    tasks.Run("warm_stdlib", [&] { for_each_file(root + "/lib/mojo", {".mojopkg"}, touch_file); });
+    if (auto err = session.Launch(); !err.empty()) die(err);
+
+    auto warmup = WarmupConfig::FromEnv();
+    json ready = {{"status", "ready"}};
+    if (warmup.mode == WarmupConfig::Before) {
+        ready["warmup"] = session.Warmup(warmup.code);
+        session.profile.Mark("warmup");
     }
-    std::cerr << "Loaded MojoLLDB plugin\n";
-
-    auto mojo_lang = SBLanguageRuntime::GetLanguageTypeFromString("mojo");
-    if (mojo_lang == eLanguageTypeUnknown)
-        die("Mojo language not recognized - is libMojoLLDB loaded correctly?");
-    debugger.SetREPLLanguage(mojo_lang);
-    std::cerr << "Mojo language type: " << static_cast<int>(mojo_lang) << "\n";
-
-    SBError target_err;
-    auto target = debugger.CreateTarget(entry_point.c_str(), "", "", true, target_err);
-    if (!target.IsValid()) {
-        std::string msg = "Failed to create target: " + entry_point;
-        if (target_err.Fail()) msg += std::string(": ") + target_err.GetCString();
-        die(msg);
+    if (session.profile.enabled()) {
+        session.profile.Print();
+        ready["startup"] = session.profile.ToJson();
+        ready["startup"]["fast"] = session.fast_startup;
+        ready["startup"]["parallel"] = tasks.enabled();
     }
+    send(ready);
+    // Overlaps with the client's own startup; a request sent meanwhile is
+    // read once the warm-up cell finishes.
+    if (warmup.mode == WarmupConfig::After) session.Warmup(warmup.code);
 
-    auto bp = target.BreakpointCreateByName("mojo_repl_main");
-    if (!bp.IsValid()) die("Failed to create breakpoint at mojo_repl_main");
-    std::cerr << "Breakpoint set, " << bp.GetNumLocations() << " location(s)\n";
-
-    auto process = target.LaunchSimple(nullptr, nullptr, nullptr);
-    if (!process.IsValid()) die("Failed to launch target process");
-    if (process.GetState() != eStateStopped)
-        die("Process not stopped after launch (state=" + std::to_string(process.GetState()) + ")");
-    std::cerr << "Process launched and stopped at breakpoint\n";
-
-    drain(process, &SBProcess::GetSTDOUT);
-    drain(process, &SBProcess::GetSTDERR);
-
-    lldb_private::Status repl_err;
-    TargetSP target_sp = get_target_sp(target);
-    REPLSP repl = target_sp->GetREPL(repl_err, mojo_lang, nullptr, true);
-    if (!repl) die("Failed to get REPL: " + std::string(repl_err.AsCString()));
-    IOHandlerSP io_handler = repl->GetIOHandler();
-    std::cerr << "REPL mode enabled\n";
-    output_capture.Clear(process);
-
-    std::cout << json{{"status", "ready"}} << "\n" << std::flush;
-
+    SessionRegistry sessions(session);
     std::string line;
     while (std::getline(std::cin, line)) {
         if (line.empty()) continue;
 
         json req;
-        try { req = json::parse(line); }
-        catch (const json::parse_error &e) {
-            std::cout << json{{"id", 0}, {"status", "error"},
-                {"ename", "ProtocolError"}, {"evalue", e.what()}, {"traceback", json::array()}}
-                << "\n" << std::flush;
+        std::string type, sid, new_session;
+        json id = 0;
+        try {
+            req = json::parse(line);
+            type = req.value("type", "");
+            id = req.value("id", json(0));
+            sid = req.value("session", "");
+            new_session = req.value("new_session", "");
+        } catch (const json::exception &e) {
+            json resp = protocol_error(e.what());
+            resp["id"] = id;
+            send(resp);
             continue;
         }
 
-        auto type = req.value("type", "");
-        auto id = req.value("id", 0);
-
-        json resp;
-        if (type == "execute") {
-            resp = handle_execute(req.value("code", ""), process, io_handler, repl,
-                                  output_capture);
-        } else if (type == "complete") {
-            resp = {{"status", "ok"}, {"completions", json::array()}};
+        auto reply = [id](json resp) {
+            resp["id"] = id;
+            send(resp);
+        };
+        // Run on a new session's worker before it takes requests.
+        auto with_warmup = [&warmup](ReplSession &s) {
+            json extra = json::object();
+            if (warmup.mode != WarmupConfig::Off) extra["warmup"] = s.Warmup(warmup.code);
+            return extra;
+        };
+
+        // Session management, status, interrupts and shutdown are served
+        // here, so they answer even while a cell hangs; the rest goes to
+        // the session's worker.
+        if (type == "open_session") {
+            sessions.Open(session, new_session, reply, [with_warmup](ReplSession &s) {
+                json resp = {{"status", "ok"}};
+                if (auto err = s.CreateDebugger(); !err.empty()) resp = session_error(err);
+                else if (auto err = s.Launch(); !err.empty()) resp = session_error(err);
+                else resp.update(with_warmup(s));
+                return resp;
+            });
+        } else if (type == "fork_session") {
+            sessions.Fork(sid, new_session, reply, with_warmup);
+        } else if (type == "close_session") {
+            sessions.Close(sid, reply);
+        } else if (type == "list_sessions") {
+            reply(sessions.List());
+        } else if (type == "status") {
+            reply(sessions.Status(sid));
         } else if (type == "interrupt") {
-            process.SendAsyncInterrupt();
-            resp = {{"status", "ok"}};
+            reply(sessions.Interrupt(sid) ? json{{"status", "ok"}} : session_error("unknown session: " + sid));
         } else if (type == "shutdown") {
-            std::cout << json{{"id", id}, {"status", "ok"}} << "\n" << std::flush;
+            sessions.Shutdown();
+            reply({{"status", "ok"}});
             break;
-        } else {
-            resp = {{"status", "error"}, {"ename", "ProtocolError"},
-                    {"evalue", "unknown request type: " + type}, {"traceback", json::array()}};
+        } else if (!sessions.Post(sid,
+                                  [req, reply, &warmup](ReplSession &s) {
+                                      // A field of the wrong type throws json::type_error.
+                                      json resp;
+                                      try { resp = handle(s, req, warmup); }
+                                      catch (const std::exception &e) { resp = protocol_error(e.what()); }
+                                      reply(resp);
+                                  },
+                                  req, reply)) {
+            reply(session_error("unknown session: " + sid));
         }
-
-        resp["id"] = id;
-        std::cout << resp << "\n" << std::flush;
     }
 
-    io_handler.reset();
-    repl.reset();
-    target_sp.reset();
-
-    process.Destroy();
-    SBDebugger::Destroy(debugger);
+    sessions.Shutdown();
     SBDebugger::Terminate();
     return 0;
 }
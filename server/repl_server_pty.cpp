@@ -1,16 +1,26 @@
 // PTY-based Mojo REPL server. Runs RunREPL() in a background thread with
 // I/O redirected through a PTY pair. Provides JSON protocol on stdin/stdout.
 // This gives full var/let persistence (unlike HandleCommand approach).
-
+//
+// The main thread is one poll() loop over stdin, the PTY master and a pipe
+// the REPL thread writes when RunREPL returns; its timeout is the nearest
+// deadline (cell timeout, output settle, line pacing, stream flush). So
+// requests are read while a cell runs (interrupt takes effect at once,
+// further executes queue), output can stream, and an idle server sleeps.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <iostream>
+#include <optional>
+#include <regex>
 #include <sstream>
 #include <string>
 #include <thread>
-#include <atomic>
-#include <regex>
-#include <chrono>
+#include <vector>
 
 #include <unistd.h>
 #include <poll.h>
@@ -38,7 +48,7 @@ using json = nlohmann::json;
 // --- ANSI/prompt patterns ---
 
 static const std::regex ANSI_RE(R"(\x1b\[[0-9;]*[A-Za-z]|\x1b\[\?[0-9;]*[A-Za-z])");
-static const std::regex PROMPT_PAT(R"(\n\s*\d+>\s)");
+static const std::regex PROMPT_PAT(R"(^\s*\d+>\s)");
 static const std::regex PROMPT_LINE_RE(R"(^\s*\d+[>.]\s)");
 static const std::regex ECHO_RE(R"(\s+\d+[>]\s)");
 static const std::regex ERROR_RE(R"(error:)", std::regex::icase);
@@ -54,66 +64,6 @@ static std::string replace_cr(const std::string &s) {
     return r;
 }
 
-// --- PTY helpers ---
-
-static std::string read_pty(int fd, int timeout_ms) {
-    std::string buf;
-    char chunk[65536];
-    struct pollfd pfd = {fd, POLLIN, 0};
-    while (true) {
-        int ret = poll(&pfd, 1, timeout_ms);
-        if (ret <= 0) break;
-        if (pfd.revents & POLLIN) {
-            ssize_t n = read(fd, chunk, sizeof(chunk));
-            if (n <= 0) break;
-            buf.append(chunk, n);
-        }
-        if (pfd.revents & (POLLERR | POLLHUP)) break;
-        timeout_ms = 100; // after first chunk, short timeout for more data
-    }
-    return buf;
-}
-
-static std::string read_until_prompt(int fd, int timeout_s = 30) {
-    std::string buf;
-    char chunk[65536];
-    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout_s);
-    auto prompt_time = std::chrono::steady_clock::time_point{};
-    struct pollfd pfd = {fd, POLLIN, 0};
-
-    while (std::chrono::steady_clock::now() < deadline) {
-        int remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-            deadline - std::chrono::steady_clock::now()).count();
-        if (remaining_ms <= 0) break;
-
-        pfd.revents = 0;
-        int ret = poll(&pfd, 1, std::min(remaining_ms, 1000));
-        if (ret > 0 && (pfd.revents & POLLIN)) {
-            ssize_t n = read(fd, chunk, sizeof(chunk));
-            if (n > 0) {
-                buf.append(chunk, n);
-                auto clean = strip_ansi(buf);
-                if (prompt_time == std::chrono::steady_clock::time_point{} &&
-                    std::regex_search(clean, PROMPT_PAT)) {
-                    prompt_time = std::chrono::steady_clock::now();
-                }
-            }
-            if (n <= 0 && (pfd.revents & POLLHUP)) break;
-        } else if (ret == 0) {
-            // timeout on poll
-            if (prompt_time != std::chrono::steady_clock::time_point{}) {
-                auto elapsed = std::chrono::steady_clock::now() - prompt_time;
-                if (elapsed > std::chrono::milliseconds(300)) return strip_ansi(buf);
-            }
-        }
-        if (pfd.revents & (POLLERR | POLLHUP)) break;
-    }
-
-    if (prompt_time != std::chrono::steady_clock::time_point{})
-        return strip_ansi(buf);
-    return ""; // timeout
-}
-
 // --- Output parser (mirrors pexpect_engine.py logic) ---
 
 static bool is_prompt_line(const std::string &line) {
@@ -122,15 +72,44 @@ static bool is_prompt_line(const std::string &line) {
     return false;
 }
 
-static json parse_output(const std::string &raw) {
-    auto clean = replace_cr(raw);
-    std::istringstream ss(clean);
-    std::string line;
-    std::vector<std::string> output, errors;
+// Splits the REPL's terminal output into program output and error lines as
+// it arrives. Only complete lines are classified; the unterminated tail is
+// where the next prompt shows up.
+struct OutputParser {
+    std::string pending;   // text after the last newline
+    std::string stdout_str;
+    std::vector<std::string> errors;
     bool in_error = false;
 
-    while (std::getline(ss, line)) {
-        if (line.empty()) continue;
+    void Feed(const char *data, size_t n) {
+        pending.append(data, n);
+        size_t start = 0, nl;
+        while ((nl = pending.find('\n', start)) != std::string::npos) {
+            Line(replace_cr(strip_ansi(pending.substr(start, nl - start))));
+            start = nl + 1;
+        }
+        pending.erase(0, start);
+    }
+
+    // The REPL is waiting at its main prompt.
+    bool AtPrompt() const { return std::regex_search(replace_cr(strip_ansi(pending)), PROMPT_PAT); }
+
+    json Result() {
+        if (!pending.empty()) Line(replace_cr(strip_ansi(pending)));
+        pending.clear();
+        if (!errors.empty()) {
+            std::string evalue = errors[0];
+            if (evalue.substr(0, 7) == "[User] ") evalue = evalue.substr(7);
+            return {{"status", "error"}, {"stdout", stdout_str},
+                    {"stderr", ""}, {"ename", "MojoError"},
+                    {"evalue", evalue}, {"traceback", errors}};
+        }
+        return {{"status", "ok"}, {"stdout", stdout_str}, {"stderr", ""}, {"value", ""}};
+    }
+
+private:
+    void Line(const std::string &line) {
+        if (line.empty()) return;
         // Strip prompt prefix if present
         std::string stripped = line;
         if (std::regex_search(line, PROMPT_LINE_RE))
@@ -142,25 +121,357 @@ static json parse_output(const std::string &raw) {
             s.erase(0, s.find_first_not_of(" \t"));
             s.erase(s.find_last_not_of(" \t") + 1);
             if (!s.empty() && s != "(null)") errors.push_back(s);
-            continue;
+            return;
         }
-        if (is_prompt_line(line)) continue;
-        output.push_back(line);
+        if (is_prompt_line(line)) return;
+        stdout_str += line + "\n";
     }
+};
+
+// --- Event loop ---
+
+using Clock = std::chrono::steady_clock;
+using ms = std::chrono::milliseconds;
+
+// Silence after the prompt before a cell counts as finished (same settle
+// as the pexpect engine); any output restarts it.
+static constexpr int kSettleMs = 300;
+// Longest wait for editline to take a line before the next is sent.
+static constexpr int kLinePaceMs = 5;
+static constexpr int kStreamMs = 50;
+// Most PTY output read per poll round, so a cell printing in a tight loop
+// can't keep requests (interrupt) and timers (timeout) from running.
+static constexpr size_t kReadBudget = 256 << 10;
+// After a timed-out cell is interrupted, how long to wait for the prompt.
+static constexpr int kInterruptGraceMs = 2000;
+// After an interrupt while idle, how long to wait for the prompt to settle.
+static constexpr int kIdleInterruptMs = 500;
+static constexpr int kQuitMs = 2000;
+static constexpr int kStartupMs = 30000;
+
+static void send(const json &msg) { std::cout << msg << "\n" << std::flush; }
+
+static json error_reply(const json &id, const std::string &ename, const std::string &evalue,
+                        json traceback = json::array()) {
+    return {{"id", id}, {"status", "error"}, {"ename", ename}, {"evalue", evalue}, {"traceback", traceback}};
+}
 
-    std::string stdout_str;
-    for (auto &l : output) stdout_str += l + "\n";
-
-    if (!errors.empty()) {
-        std::string evalue = errors[0];
-        if (evalue.substr(0, 7) == "[User] ") evalue = evalue.substr(7);
-        return {{"status", "error"}, {"stdout", stdout_str},
-                {"stderr", ""}, {"ename", "MojoError"},
-                {"evalue", evalue}, {"traceback", errors}};
+static void write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w > 0) {
+            p += w;
+            n -= size_t(w);
+        } else if (w < 0 && (errno == EAGAIN || errno == EINTR)) {
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            poll(&pfd, 1, 100);
+        } else {
+            return;
+        }
     }
-    return {{"status", "ok"}, {"stdout", stdout_str}, {"stderr", ""}, {"value", ""}};
 }
 
+// One execute, from its first line to the reply.
+struct Cell {
+    json id;
+    std::vector<std::string> lines;   // code lines, then the blank line that submits
+    size_t next_line = 0;
+    bool acked = false;               // output arrived since the last line was written
+    Clock::time_point line_at;        // when the last line was written
+    int64_t timeout_ms = 30000;
+    Clock::time_point deadline;
+    bool timed_out = false;
+    bool stream = false;
+    size_t streamed = 0;              // bytes of parser.stdout_str already streamed
+    Clock::time_point stream_at;
+    OutputParser parser;
+};
+
+class PtyServer {
+public:
+    PtyServer(int master, int wake, SBProcess process) : master_(master), wake_(wake), process_(process) {}
+
+    // Runs until shutdown, stdin EOF or the REPL's exit.
+    void Run() {
+        starting_ = true;
+        phase_deadline_ = Clock::now() + ms(kStartupMs);
+        char chunk[65536];
+        while (!done_) {
+            struct pollfd fds[3] = {{master_, POLLIN, 0}, {wake_, POLLIN, 0}, {stdin_eof_ ? -1 : 0, POLLIN, 0}};
+            int ret = poll(fds, 3, Timeout());
+            if (ret < 0 && errno != EINTR) break;
+            if (fds[0].revents & POLLIN) {
+                size_t left = kReadBudget;
+                ssize_t n;
+                while (left > 0 && (n = read(master_, chunk, std::min(sizeof(chunk), left))) > 0) {
+                    OnOutput(chunk, size_t(n));
+                    left -= size_t(n);
+                }
+            }
+            if (fds[1].revents & (POLLIN | POLLHUP)) {
+                OnReplExit();
+                break;
+            }
+            if (fds[2].revents & (POLLIN | POLLHUP)) ReadRequests();
+            OnTimers(Clock::now());
+            StartNext();
+        }
+    }
+
+    bool repl_exited() const { return repl_exited_; }
+    bool started() const { return !starting_; }
+
+private:
+    // --- Timing ---
+
+    int Timeout() const {
+        std::optional<Clock::time_point> next;
+        auto at = [&](Clock::time_point t) { if (!next || t < *next) next = t; };
+        if (starting_ || settling_ || quitting_) at(phase_deadline_);
+        if (starting_ && startup_parser_.AtPrompt()) at(last_output_ + ms(kSettleMs));
+        if (settling_ && idle_parser_.AtPrompt()) at(last_output_ + ms(50));
+        if (cell_) {
+            auto &c = *cell_;
+            if (c.next_line < c.lines.size()) at(c.acked ? Clock::now() : c.line_at + ms(kLinePaceMs));
+            else if (c.parser.AtPrompt()) at(last_output_ + ms(kSettleMs));
+            if (c.timed_out) at(phase_deadline_);
+            else if (c.timeout_ms > 0) at(c.deadline);
+            if (c.stream && c.parser.stdout_str.size() > c.streamed) at(c.stream_at + ms(kStreamMs));
+        }
+        if (!next) return -1;
+        auto left = std::chrono::duration_cast<ms>(*next - Clock::now()).count();
+        return int(std::clamp<int64_t>(left + 1, 0, 60000));
+    }
+
+    void OnTimers(Clock::time_point now) {
+        bool settled_output = now - last_output_ >= ms(kSettleMs);
+        if (starting_) {
+            if (startup_parser_.AtPrompt() && settled_output) {
+                starting_ = false;
+                std::cerr << "REPL ready\n";
+                send({{"status", "ready"}});
+            } else if (now >= phase_deadline_) {
+                std::cerr << "Timed out waiting for REPL prompt\n";
+                send({{"status", "error"}, {"message", "Timed out waiting for REPL prompt"}});
+                done_ = true;
+            }
+            return;
+        }
+        if (settling_) {
+            if ((idle_parser_.AtPrompt() && now - last_output_ >= ms(50)) || now >= phase_deadline_) settling_ = false;
+            return;
+        }
+        if (quitting_) {
+            if (now < phase_deadline_) return;
+            if (killed_) {
+                done_ = true;  // the REPL thread is stuck; leave it behind
+                return;
+            }
+            // RunREPL ignored :quit; killing the inferior makes it return.
+            process_.Kill();
+            killed_ = true;
+            phase_deadline_ = now + ms(kQuitMs);
+            return;
+        }
+        if (!cell_) return;
+        auto &c = *cell_;
+        if (c.stream && now - c.stream_at >= ms(kStreamMs)) Stream(c);
+        if (c.next_line < c.lines.size()) {
+            if (c.acked || now - c.line_at >= ms(kLinePaceMs)) WriteLine(c);
+            return;
+        }
+        if (c.parser.AtPrompt() && settled_output) return Finish();
+        if (!c.timed_out && c.timeout_ms > 0 && now >= c.deadline) {
+            // Interrupt the cell and return what it printed so far.
+            c.timed_out = true;
+            Interrupt();
+            phase_deadline_ = now + ms(kInterruptGraceMs);
+        } else if (c.timed_out && now >= phase_deadline_) {
+            Finish();
+        }
+    }
+
+    // --- PTY ---
+
+    void OnOutput(const char *p, size_t n) {
+        last_output_ = Clock::now();
+        if (starting_) startup_parser_.Feed(p, n);
+        else if (cell_) {
+            cell_->acked = true;
+            cell_->parser.Feed(p, n);
+        } else {
+            // Stale output between cells (e.g. after an interrupt); only the
+            // tail matters, to see the prompt come back.
+            idle_parser_.Feed(p, n);
+            idle_parser_.stdout_str.clear();
+            idle_parser_.errors.clear();
+            idle_parser_.in_error = false;
+        }
+    }
+
+    void WriteLine(Cell &c) {
+        auto &line = c.lines[c.next_line++];
+        write_all(master_, line.data(), line.size());
+        c.acked = false;
+        c.line_at = Clock::now();
+    }
+
+    void Interrupt() {
+        char ctrl_c = 3;
+        write_all(master_, &ctrl_c, 1);
+    }
+
+    // --- Requests ---
+
+    void ReadRequests() {
+        char buf[65536];
+        ssize_t n = read(0, buf, sizeof(buf));
+        if (n <= 0) {
+            if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+            stdin_eof_ = true;
+            queue_.push_back({{"type", "shutdown"}, {"id", nullptr}, {"silent", true}});
+            if (cell_) Interrupt();
+            return;
+        }
+        in_buf_.append(buf, size_t(n));
+        size_t start = 0, nl;
+        while ((nl = in_buf_.find('\n', start)) != std::string::npos) {
+            auto line = in_buf_.substr(start, nl - start);
+            start = nl + 1;
+            if (!line.empty()) OnRequest(line);
+        }
+        in_buf_.erase(0, start);
+    }
+
+    void OnRequest(const std::string &line) {
+        json req;
+        try { req = json::parse(line); }
+        catch (const json::parse_error &e) {
+            send(error_reply(0, "ProtocolError", e.what()));
+            return;
+        }
+        auto type = req.value("type", "");
+        auto id = req.value("id", json(0));
+        if (type == "execute") {
+            queue_.push_back(req);
+        } else if (type == "complete") {
+            send({{"id", id}, {"status", "ok"}, {"completions", json::array()}});
+        } else if (type == "interrupt") {
+            // Takes effect at once; a running cell replies when the prompt
+            // returns. While idle, wait for the prompt before the next cell.
+            Interrupt();
+            if (!cell_) {
+                settling_ = true;
+                phase_deadline_ = Clock::now() + ms(kIdleInterruptMs);
+            }
+            send({{"id", id}, {"status", "ok"}});
+        } else if (type == "shutdown") {
+            // Ahead of queued cells; a running one is interrupted.
+            queue_.push_front(req);
+            if (cell_) Interrupt();
+        } else {
+            send(error_reply(id, "ProtocolError", "unknown request type: " + type));
+        }
+    }
+
+    void StartNext() {
+        if (starting_ || settling_ || quitting_ || cell_ || queue_.empty()) return;
+        auto req = queue_.front();
+        queue_.pop_front();
+        auto id = req.value("id", json(0));
+        if (req.value("type", "") == "shutdown") {
+            write_all(master_, ":quit\n", 6);
+            if (!req.value("silent", false)) send({{"id", id}, {"status", "ok"}});
+            quitting_ = true;
+            phase_deadline_ = Clock::now() + ms(kQuitMs);
+            for (auto &r : queue_)
+                if (r.value("type", "") == "execute")
+                    send(error_reply(r.value("id", json(0)), "REPLError", "server shutting down"));
+            queue_.clear();
+            return;
+        }
+        auto code = req.value("code", "");
+        if (code.empty()) {
+            send({{"id", id}, {"status", "ok"}, {"stdout", ""}, {"stderr", ""}, {"value", ""}});
+            return;
+        }
+        cell_.emplace();
+        auto &c = *cell_;
+        c.id = id;
+        // Each line to the REPL, then a blank line to submit.
+        std::istringstream code_ss(code);
+        std::string code_line;
+        while (std::getline(code_ss, code_line)) c.lines.push_back(code_line + "\n");
+        c.lines.push_back("\n");
+        c.timeout_ms = req.value("timeout_ms", int64_t(30000));
+        c.stream = req.value("stream", false);
+        c.stream_at = Clock::now();
+        c.deadline = Clock::now() + ms(c.timeout_ms);
+        WriteLine(c);
+    }
+
+    // --- Replies ---
+
+    void Stream(Cell &c) {
+        c.stream_at = Clock::now();
+        auto &out = c.parser.stdout_str;
+        if (out.size() <= c.streamed) return;
+        send({{"id", c.id}, {"status", "stream"}, {"name", "stdout"}, {"text", out.substr(c.streamed)}});
+        c.streamed = out.size();
+    }
+
+    void Finish() {
+        auto &c = *cell_;
+        if (c.stream) Stream(c);
+        auto resp = c.parser.Result();
+        if (c.timed_out) {
+            auto msg = "Cell exceeded its timeout of " + std::to_string(c.timeout_ms) + " ms";
+            resp = {{"status", "error"}, {"stdout", resp["stdout"]}, {"stderr", ""},
+                    {"ename", "TimeoutError"}, {"evalue", msg},
+                    {"traceback", json::array({msg})}, {"timeout_ms", c.timeout_ms}};
+        }
+        if (c.stream) {
+            // Already sent as stream messages.
+            resp["stdout"] = "";
+            resp["streamed"] = true;
+        }
+        resp["id"] = c.id;
+        bool at_prompt = c.parser.AtPrompt();
+        send(resp);
+        cell_.reset();
+        idle_parser_ = OutputParser{};
+        if (!at_prompt) {
+            // Interrupted without the prompt coming back yet: let the rest
+            // of its output arrive before the next cell starts.
+            settling_ = true;
+            phase_deadline_ = Clock::now() + ms(kIdleInterruptMs);
+        }
+    }
+
+    void OnReplExit() {
+        repl_exited_ = true;
+        if (quitting_) return;
+        std::cerr << "REPL exited\n";
+        if (starting_) send({{"status", "error"}, {"message", "REPL exited during startup"}});
+        auto died = [](const json &id) {
+            return error_reply(id, "REPLError", "REPL process died", json::array({"REPL process terminated unexpectedly"}));
+        };
+        if (cell_) send(died(cell_->id));
+        for (auto &r : queue_)
+            if (r.value("type", "") == "execute") send(died(r.value("id", json(0))));
+    }
+
+    int master_, wake_;
+    SBProcess process_;
+    bool starting_ = false, settling_ = false, quitting_ = false, killed_ = false;
+    bool done_ = false, stdin_eof_ = false, repl_exited_ = false;
+    Clock::time_point phase_deadline_, last_output_ = Clock::now();
+    std::string in_buf_;
+    std::deque<json> queue_;
+    std::optional<Cell> cell_;
+    OutputParser startup_parser_, idle_parser_;
+};
+
 // --- Main ---
 
 [[noreturn]] static void die(const std::string &msg) {
@@ -251,107 +562,27 @@ int main(int argc, char *argv[]) {
     if (process.GetState() != eStateStopped) die("Process not stopped at breakpoint");
     std::cerr << "Process launched and stopped at breakpoint\n";
 
-    // Drain any startup output from PTY
-    read_pty(master_fd, 500);
-
-    // Run REPL in background thread
-    std::atomic<bool> repl_running{true};
-    std::thread repl_thread([&]() {
+    // Run REPL in background thread; it writes to the wake pipe when
+    // RunREPL returns, which ends the event loop.
+    int wake[2];
+    if (pipe(wake) != 0) die("pipe() failed");
+    fcntl(master_fd, F_SETFL, fcntl(master_fd, F_GETFL) | O_NONBLOCK);
+    std::thread repl_thread([&debugger, mojo_lang, wake]() {
         auto err = debugger.RunREPL(mojo_lang, nullptr);
         if (err.Fail())
             std::cerr << "RunREPL error: " << (err.GetCString() ? err.GetCString() : "unknown") << "\n";
-        repl_running = false;
+        char one = 1;
+        (void)!write(wake[1], &one, 1);
     });
-    repl_thread.detach();
 
-    // Wait for initial REPL prompt
     std::cerr << "Waiting for REPL prompt...\n";
-    auto initial = read_until_prompt(master_fd, 30);
-    if (initial.empty()) die("Timed out waiting for REPL prompt");
-    std::cerr << "REPL ready\n";
-
-    // Signal readiness
-    std::cout << json{{"status", "ready"}} << "\n" << std::flush;
-
-    // Main JSON protocol loop
-    std::string line;
-    while (std::getline(std::cin, line)) {
-        if (line.empty()) continue;
-        if (!repl_running) {
-            std::cout << json{{"id", 0}, {"status", "error"},
-                {"ename", "REPLError"}, {"evalue", "REPL process died"},
-                {"traceback", json::array({"REPL process terminated unexpectedly"})}}
-                << "\n" << std::flush;
-            break;
-        }
-
-        json req;
-        try { req = json::parse(line); }
-        catch (const json::parse_error &e) {
-            std::cout << json{{"id", 0}, {"status", "error"},
-                {"ename", "ProtocolError"}, {"evalue", e.what()},
-                {"traceback", json::array()}} << "\n" << std::flush;
-            continue;
-        }
-
-        auto type = req.value("type", "");
-        auto id = req.value("id", 0);
-        json resp;
-
-        if (type == "execute") {
-            auto code = req.value("code", "");
-            if (code.empty()) {
-                resp = {{"status", "ok"}, {"stdout", ""}, {"stderr", ""}, {"value", ""}};
-            } else {
-                // Drain any stale PTY data
-                read_pty(master_fd, 50);
-
-                // Send each line to REPL, then blank line to submit
-                std::istringstream code_ss(code);
-                std::string code_line;
-                while (std::getline(code_ss, code_line)) {
-                    code_line += "\n";
-                    write(master_fd, code_line.c_str(), code_line.size());
-                    usleep(5000); // 5ms between lines for editline
-                }
-                // Blank line to submit
-                write(master_fd, "\n", 1);
-
-                // Read until next prompt
-                auto raw = read_until_prompt(master_fd, 30);
-                if (raw.empty()) {
-                    resp = {{"status", "error"}, {"stdout", ""}, {"stderr", ""},
-                            {"ename", "TimeoutError"}, {"evalue", "Expression timed out"},
-                            {"traceback", json::array({"Expression evaluation timed out"})}};
-                } else {
-                    resp = parse_output(raw);
-                }
-            }
-        } else if (type == "complete") {
-            resp = {{"status", "ok"}, {"completions", json::array()}};
-        } else if (type == "interrupt") {
-            // Send Ctrl-C through PTY
-            char ctrl_c = 3;
-            write(master_fd, &ctrl_c, 1);
-            read_pty(master_fd, 500);
-            resp = {{"status", "ok"}};
-        } else if (type == "shutdown") {
-            // Send :quit to REPL
-            write(master_fd, ":quit\n", 6);
-            std::cout << json{{"id", id}, {"status", "ok"}} << "\n" << std::flush;
-            break;
-        } else {
-            resp = {{"status", "error"}, {"ename", "ProtocolError"},
-                    {"evalue", "unknown request type: " + type},
-                    {"traceback", json::array()}};
-        }
-
-        resp["id"] = id;
-        std::cout << resp << "\n" << std::flush;
-    }
+    PtyServer server(master_fd, wake[0], process);
+    server.Run();
 
+    if (server.repl_exited()) repl_thread.join();
+    else repl_thread.detach();
     close(master_fd);
     close(slave_fd);
-    SBDebugger::Terminate();
-    return 0;
+    if (server.repl_exited()) SBDebugger::Terminate();
+    return server.started() ? 0 : 1;
 }
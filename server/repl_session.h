@@ -0,0 +1,737 @@
+// Shared Mojo REPL bootstrap: one SBDebugger with libMojoLLDB loaded, one
+// launched mojo-repl-entry-point inferior, and the LLDB REPL object that
+// executes code against it. Used by mojo-repl-server and mojo-nb-run.
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include <lldb/API/SBDebugger.h>
+#include <lldb/API/SBTarget.h>
+#include <lldb/API/SBProcess.h>
+#include <lldb/API/SBBreakpoint.h>
+#include <lldb/API/SBLanguageRuntime.h>
+#include <lldb/API/SBCommandInterpreter.h>
+#include <lldb/API/SBCommandReturnObject.h>
+#include <lldb/API/SBError.h>
+#include <lldb/API/SBFileSpec.h>
+#include <lldb/API/SBLaunchInfo.h>
+#include <lldb/API/SBModule.h>
+#include <lldb/API/SBModuleSpec.h>
+#include <lldb/Expression/REPL.h>
+#include <lldb/Utility/Status.h>
+
+// Internal header for Target::GetREPL.
+#include <lldb/Target/Target.h>
+
+#include "json.hpp"
+#include "bounded_output.h"
+#include "cell_graph.h"
+#include "def_cache.h"
+#include "inferior_stdio.h"
+#include "resource_limits.h"
+#include "platform.h"
+#include "proc_stats.h"
+#include "remote_stats.h"
+#include "startup_profile.h"
+
+using namespace lldb;
+using json = nlohmann::json;
+
+inline void drain(SBProcess &proc, size_t (SBProcess::*fn)(char*, size_t) const, BoundedOutput &sink,
+                  bool compact = false) {
+    char buf[65536];
+    size_t n;
+    TerminalCompactor compactor;
+    auto append = [&sink](const char *p, size_t k) { sink.Append(p, k); };
+    while ((n = (proc.*fn)(buf, sizeof(buf))) > 0) {
+        if (compact) compactor.Feed(buf, n, append);
+        else sink.Append(buf, n);
+    }
+    compactor.Finish(append);
+}
+
+// Drain LLDB debugger output captured in a temp file. The file is truncated
+// after each read so later responses only include new REPL output.
+inline void drain_file(FILE *file, BoundedOutput &sink) {
+    if (!file) return;
+
+    fflush(file);
+    clearerr(file);
+    fseek(file, 0, SEEK_SET);
+
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+        sink.Append(buf, n);
+
+    ftruncate(fileno(file), 0);
+    fseek(file, 0, SEEK_SET);
+    clearerr(file);
+}
+
+// Collect output from both LLDB's REPL stream and the launched Mojo process.
+struct OutputCapture {
+    FILE *debugger_stdout = nullptr;
+    FILE *debugger_stderr = nullptr;
+
+    static OutputCapture Create() {
+        return OutputCapture{std::tmpfile(), std::tmpfile()};
+    }
+
+    bool IsValid() const { return debugger_stdout && debugger_stderr; }
+
+    void AttachTo(SBDebugger &debugger) {
+        debugger.SetOutputFileHandle(debugger_stdout, false);
+        debugger.SetErrorFileHandle(debugger_stderr, false);
+    }
+
+    void Clear(SBProcess &process) {
+        BoundedOutput discard(OutputLimits::Discard(), "");
+        drain(process, &SBProcess::GetSTDOUT, discard);
+        drain(process, &SBProcess::GetSTDERR, discard);
+        drain_file(debugger_stdout, discard);
+        drain_file(debugger_stderr, discard);
+    }
+
+    void Collect(SBProcess &process, BoundedOutput &out, BoundedOutput &err, bool compact = false) {
+        drain_file(debugger_stdout, out);
+        drain(process, &SBProcess::GetSTDOUT, out, compact);
+        drain_file(debugger_stderr, err);
+        drain(process, &SBProcess::GetSTDERR, err, compact);
+    }
+
+    void Close() {
+        if (debugger_stdout) fclose(debugger_stdout);
+        if (debugger_stderr) fclose(debugger_stderr);
+        debugger_stdout = debugger_stderr = nullptr;
+    }
+};
+
+inline std::vector<std::string> split_lines(const std::string &s) {
+    std::vector<std::string> lines;
+    std::istringstream ss(s);
+    for (std::string line; std::getline(ss, line);)
+        if (!line.empty()) lines.push_back(line);
+    return lines;
+}
+
+// Access internal TargetSP from SBTarget.
+// SBTarget has a single member: TargetSP m_opaque_sp.
+inline TargetSP get_target_sp(SBTarget &target) {
+    return *reinterpret_cast<TargetSP *>(&target);
+}
+
+// LLDB settings for a REPL-only debugger (MOJO_REPL_FAST_STARTUP): load
+// debug info lazily and never go looking for dSYMs or debuginfod symbols.
+// Settings this LLDB doesn't know are skipped.
+inline const std::vector<std::string> kFastStartupSettings = {
+    "settings set symbols.load-on-demand true",
+    "settings set symbols.enable-external-lookup false",
+    "settings set target.preload-symbols false",
+    "settings set target.auto-import-clang-modules false",
+};
+
+// gdb-remote settings that cut round trips per cell (MOJO_REPL_REMOTE_TUNING):
+// read all registers with one `g` packet instead of a `p` each, read memory
+// in page-sized cache lines instead of 512 bytes, and get the library list
+// in one qXfer packet instead of walking the link map.
+inline const std::vector<std::string> kRemoteTuningSettings = {
+    "settings set plugin.process.gdb-remote.use-g-packet-for-reading true",
+    "settings set target.process.memory-cache-line-size 4096",
+    "settings set plugin.process.gdb-remote.use-libraries-svr4 true",
+};
+
+// Default warm-up cell: touches common stdlib types so their modules are
+// loaded and codegen'd before the first user cell. Everything lives inside
+// one function, so the only name it leaves in the REPL is that function.
+inline const char *kDefaultWarmupCode = R"(def __mojo_repl_warmup():
+    var xs = List[Int]()
+    for i in range(16):
+        xs.append(i * i)
+    var d = Dict[String, Int]()
+    d["n"] = len(xs)
+    var s = String("warm-up ") + String(d["n"])
+    var v = SIMD[DType.float32, 4](1.5)
+    var f = Float64(xs[3]) / 2.0
+    print(s, f, v.reduce_add(), end="")
+__mojo_repl_warmup())";
+
+// MOJO_REPL_WARMUP=before runs the warm-up cell before ready is reported,
+// =after right after it (before the first request is read). The cell is
+// MOJO_REPL_WARMUP_FILE's contents, or MOJO_REPL_WARMUP_CODE, or the default.
+struct WarmupConfig {
+    enum Mode { Off, Before, After } mode = Off;
+    std::string code = kDefaultWarmupCode;
+
+    static WarmupConfig FromEnv() {
+        WarmupConfig w;
+        std::string mode = std::getenv("MOJO_REPL_WARMUP") ? std::getenv("MOJO_REPL_WARMUP") : "";
+        if (mode == "before" || mode == "1") w.mode = Before;
+        else if (mode == "after") w.mode = After;
+        if (auto code = std::getenv("MOJO_REPL_WARMUP_CODE")) w.code = code;
+        if (auto path = std::getenv("MOJO_REPL_WARMUP_FILE")) {
+            std::ifstream in(path);
+            std::stringstream ss;
+            ss << in.rdbuf();
+            if (in) w.code = ss.str();
+            else std::cerr << "Cannot read MOJO_REPL_WARMUP_FILE " << path << ", using default warm-up\n";
+        }
+        return w;
+    }
+};
+
+// Point the Mojo toolchain at the SDK and initialize LLDB. Call once per
+// process, before creating any session.
+inline void init_mojo_environment(const std::string &root) {
+    setenv("MODULAR_MAX_PACKAGE_ROOT", root.c_str(), 1);
+    setenv("MODULAR_MOJO_MAX_PACKAGE_ROOT", root.c_str(), 1);
+    setenv("MODULAR_MOJO_MAX_DRIVER_PATH", (root + "/bin/mojo").c_str(), 1);
+    auto import_path = root + "/lib/mojo";
+    // Packages of the definition cache are imported by name; def_cache.h
+    // stops using the cache if this list doesn't take.
+    if (auto dir = std::getenv("MOJO_REPL_DEF_CACHE"); dir && *dir) import_path += std::string(",") + dir;
+    setenv("MODULAR_MOJO_MAX_IMPORT_PATH", import_path.c_str(), 1);
+    SBDebugger::Initialize();
+}
+
+// A debugger plus (once launched) an inferior and its REPL. Bootstrap steps
+// return an empty string on success and an error message otherwise, so each
+// binary decides whether a failure is fatal.
+struct ReplSession {
+    std::string root;
+    // Session id in requests; see sessions.h.
+    std::string name = "main";
+    SBDebugger debugger;
+    LanguageType mojo_lang = eLanguageTypeUnknown;
+    SBTarget target;
+    SBProcess process;
+    // Held while `process` is reassigned, so InterruptAsync() can copy it
+    // from another thread.
+    std::mutex process_mu;
+    TargetSP target_sp;
+    REPLSP repl;
+    IOHandlerSP io_handler;
+    OutputCapture capture;
+    // Rich output from `display()` (display_channel.h); read by stdio's
+    // thread, so declared first to outlive it. Null when disabled.
+    std::unique_ptr<DisplayChannel> display;
+    // Whether this inferior has the display hook defined yet.
+    bool display_ready = false;
+    // The inferior's stdout/stderr; null when LLDB's STDIO buffer is used.
+    std::unique_ptr<InferiorStdio> stdio;
+    ResourceTotals usage;
+    ResourceLimits limits;
+    CgroupLimit cgroup;
+    // Whether this inferior has an RLIMIT_AS soft limit from us.
+    bool address_space_limited = false;
+    std::unique_ptr<ExecMonitor> monitor;
+    // Why the inferior is gone (limit breach or crash); cleared by Launch().
+    std::string dead_reason;
+    OutputLimits output_limits = OutputLimits::FromEnv();
+    // Spill files of recent cells, oldest first; only these can be read back.
+    std::vector<std::string> spill_files;
+    int64_t spill_seq = 0;
+    static constexpr size_t kMaxSpillFiles = 16;
+    StartupProfile profile;
+    // Entry point parsed ahead of CreateTarget; holding it keeps it in
+    // LLDB's shared module list so the target reuses it.
+    SBModule entry_module;
+    bool fast_startup = std::getenv("MOJO_REPL_FAST_STARTUP") != nullptr;
+    bool remote_tuning = std::getenv("MOJO_REPL_REMOTE_TUNING") != nullptr;
+    // gdb-remote packet counts (MOJO_REPL_PACKET_STATS); null when off.
+    std::unique_ptr<RemotePacketStats> packets;
+    // Apply `\r`/erase-line redraws to cell output (terminal_output.h) unless
+    // the request says otherwise; MOJO_REPL_COMPACT_OUTPUT=1 turns it on.
+    bool compact_output = [] {
+        auto v = std::getenv("MOJO_REPL_COMPACT_OUTPUT");
+        return v && *v && std::string(v) != "0";
+    }();
+
+    std::unique_ptr<DefinitionCache> def_cache;
+    // Source of every cell that ran successfully since Launch(), for
+    // checkpoints.
+    std::vector<std::string> history;
+    // Cells executed with a cell_id, for `dependents`. Kept across an idle
+    // eviction's restore; cleared by reset and restore requests.
+    CellGraph graph;
+
+    explicit ReplSession(std::string modular_root) : root(std::move(modular_root)) {
+        if (auto dir = std::getenv("MOJO_REPL_DEF_CACHE"); dir && *dir)
+            def_cache = std::make_unique<DefinitionCache>(dir, root);
+    }
+
+    // Create the debugger and load libMojoLLDB into it.
+    std::string CreateDebugger() {
+        debugger = SBDebugger::Create(false);
+        if (!debugger.IsValid()) return "Failed to create SBDebugger";
+
+        debugger.SetScriptLanguage(eScriptLanguageNone);
+        debugger.SetAsync(false);
+        profile.Mark("create_debugger");
+
+        capture = OutputCapture::Create();
+        if (!capture.IsValid()) return "Failed to create debugger output temp files";
+        capture.AttachTo(debugger);
+        if (InferiorStdio::Enabled()) {
+            const char *tmpdir = std::getenv("TMPDIR");
+            std::string dir = tmpdir && *tmpdir ? tmpdir : "/tmp";
+            if (auto size = DisplayChannel::SizeFromEnv()) {
+                display = std::make_unique<DisplayChannel>();
+                if (!display->Create(dir, size)) {
+                    std::cerr << "Cannot create the display channel, display() is unavailable\n";
+                    display.reset();
+                }
+            }
+            stdio = std::make_unique<InferiorStdio>();
+            if (!stdio->Create(dir, display.get())) {
+                std::cerr << "Cannot create stdio FIFOs, reading output through LLDB\n";
+                stdio.reset();
+                display.reset();
+            }
+        }
+
+        if (RemotePacketStats::Enabled()) {
+            packets = std::make_unique<RemotePacketStats>();
+            if (!packets->Attach(debugger)) {
+                std::cerr << "Cannot enable the gdb-remote packet log\n";
+                packets.reset();
+            }
+        }
+
+        auto ci = debugger.GetCommandInterpreter();
+        auto apply = [&ci](const std::vector<std::string> &settings) {
+            for (auto &cmd : settings) {
+                SBCommandReturnObject r;
+                ci.HandleCommand(cmd.c_str(), r);
+                if (!r.Succeeded()) std::cerr << "Skipped unsupported setting: " << cmd << "\n";
+            }
+        };
+        if (fast_startup) {
+            apply(kFastStartupSettings);
+            profile.Mark("fast_settings");
+        }
+        if (remote_tuning) apply(kRemoteTuningSettings);
+
+        SBCommandReturnObject cmd_result;
+        ci.HandleCommand(("plugin load " + mojo_lldb_plugin(root)).c_str(), cmd_result);
+        if (!cmd_result.Succeeded()) {
+            std::string msg = "Failed to load MojoLLDB plugin";
+            if (cmd_result.GetError()) msg += std::string(": ") + cmd_result.GetError();
+            return msg;
+        }
+        std::cerr << "Loaded MojoLLDB plugin\n";
+        profile.Mark("plugin_load");
+
+        mojo_lang = SBLanguageRuntime::GetLanguageTypeFromString("mojo");
+        if (mojo_lang == eLanguageTypeUnknown)
+            return "Mojo language not recognized - is libMojoLLDB loaded correctly?";
+        debugger.SetREPLLanguage(mojo_lang);
+        std::cerr << "Mojo language type: " << static_cast<int>(mojo_lang) << "\n";
+        profile.Mark("language");
+        return "";
+    }
+
+    std::string EntryPoint() const { return root + "/lib/mojo-repl-entry-point"; }
+
+    // Parse the entry point's object file and symbol table. Safe to run on
+    // another thread after SBDebugger::Initialize(), while the plugin loads.
+    void PreloadEntryPoint() {
+        SBModuleSpec spec;
+        spec.SetFileSpec(SBFileSpec(EntryPoint().c_str()));
+        SBModule module(spec);
+        if (module.IsValid()) module.GetNumSymbols();
+        entry_module = module;
+    }
+
+    // Launch mojo-repl-entry-point, stop at mojo_repl_main, and create the
+    // REPL object. Can be called again after Stop() for a fresh session.
+    std::string Launch() {
+        auto entry_point = EntryPoint();
+        SBError target_err;
+        // Dependent libraries are loaded by the dynamic loader at launch anyway.
+        target = debugger.CreateTarget(entry_point.c_str(), "", "", !fast_startup, target_err);
+        if (!target.IsValid()) {
+            std::string msg = "Failed to create target: " + entry_point;
+            if (target_err.Fail()) msg += std::string(": ") + target_err.GetCString();
+            return msg;
+        }
+        profile.Mark("create_target");
+
+        auto bp = target.BreakpointCreateByName("mojo_repl_main");
+        if (!bp.IsValid()) return "Failed to create breakpoint at mojo_repl_main";
+        std::cerr << "Breakpoint set, " << bp.GetNumLocations() << " location(s)\n";
+        profile.Mark("breakpoint");
+
+        SBLaunchInfo launch_info(nullptr);
+        if (stdio) {
+            stdio->AddTo(launch_info);
+            stdio->ResetDisplay();
+        }
+        display_ready = false;
+        SBError launch_err;
+        auto launched = target.Launch(launch_info, launch_err);
+        {
+            std::lock_guard<std::mutex> lock(process_mu);
+            process = launched;
+        }
+        if (!process.IsValid()) {
+            std::string msg = "Failed to launch target process";
+            if (launch_err.Fail()) msg += std::string(": ") + launch_err.GetCString();
+            return msg;
+        }
+        if (process.GetState() != eStateStopped)
+            return "Process not stopped after launch (state=" + std::to_string(process.GetState()) + ")";
+        std::cerr << "Process launched and stopped at breakpoint\n";
+        profile.Mark("launch");
+        ApplyLimits();
+        profile.Mark("limits");
+
+        ClearOutput();
+
+        lldb_private::Status repl_err;
+        target_sp = get_target_sp(target);
+        repl = target_sp->GetREPL(repl_err, mojo_lang, nullptr, true);
+        if (!repl) return "Failed to get REPL: " + std::string(repl_err.AsCString());
+        io_handler = repl->GetIOHandler();
+        std::cerr << "REPL mode enabled\n";
+        profile.Mark("get_repl");
+        ClearOutput();
+        usage = ResourceTotals{};
+        dead_reason.clear();
+        if (def_cache) def_cache->Reset();
+        history.clear();
+        return "";
+    }
+
+    // (Re)apply memory limits to the running inferior. The cgroup is created
+    // once per inferior; the address-space rlimit is set with prlimit.
+    void ApplyLimits() {
+        int pid = static_cast<int>(process.GetProcessID());
+        if (limits.memory_kb > 0 && cgroup.path.empty() && cgroup.Create(pid, limits.memory_kb))
+            std::cerr << "Memory limit enforced by cgroup " << cgroup.path << "\n";
+        else if (!cgroup.path.empty())
+            cgroup.SetMemory(limits.memory_kb);
+        // Set back to 0, a previous limit is lifted.
+        if (limits.address_space_kb > 0 || address_space_limited) {
+            if (set_address_space_limit(pid, limits.address_space_kb)) address_space_limited = limits.address_space_kb > 0;
+            else std::cerr << "Failed to set address space limit\n";
+        }
+        if (limits.Any() && !monitor) monitor = std::make_unique<ExecMonitor>();
+    }
+
+    // Tear down the REPL and inferior but keep the debugger for Launch().
+    void Stop() {
+        io_handler.reset();
+        repl.reset();
+        target_sp.reset();
+        if (process.IsValid()) process.Destroy();
+        {
+            std::lock_guard<std::mutex> lock(process_mu);
+            process = SBProcess();
+        }
+        cgroup.Remove();
+        address_space_limited = false;
+        if (target.IsValid()) debugger.DeleteTarget(target);
+        target = SBTarget();
+    }
+
+    void Destroy() {
+        Stop();
+        entry_module = SBModule();
+        if (debugger.IsValid()) SBDebugger::Destroy(debugger);
+        packets.reset();
+        capture.Close();
+        stdio.reset();
+        display.reset();
+        for (auto &path : spill_files) unlink(path.c_str());
+        spill_files.clear();
+    }
+
+    // Prefix of a cell's spill file; BoundedOutput adds a unique suffix.
+    std::string SpillPrefix(const char *stream) {
+        return output_limits.spill_dir + "/mojo-repl-" + std::to_string(getpid()) + "-" + name + "-" +
+               std::to_string(spill_seq) + "-" + stream;
+    }
+
+    // Reply fields for captured output, including spill references for
+    // streams that overflowed. Old spill files are deleted past the cap.
+    json OutputFields(BoundedOutput &out, BoundedOutput &err) {
+        json fields = {{"stdout", out.Text()}, {"stderr", err.Text()}};
+        json spill = json::object();
+        auto add = [&](const char *name, BoundedOutput &sink) {
+            auto info = sink.SpillInfo();
+            if (info.is_null()) return;
+            spill_files.push_back(info["path"]);
+            spill[name] = info;
+        };
+        add("stdout", out);
+        add("stderr", err);
+        while (spill_files.size() > kMaxSpillFiles) {
+            unlink(spill_files.front().c_str());
+            spill_files.erase(spill_files.begin());
+        }
+        if (!spill.empty()) fields["spill"] = spill;
+        return fields;
+    }
+
+    json ReadOutput(const std::string &path, size_t offset, size_t length, bool base64 = false) {
+        if (std::find(spill_files.begin(), spill_files.end(), path) == spill_files.end())
+            return {{"status", "error"}, {"ename", "ProtocolError"},
+                    {"evalue", "not a spill file of this session: " + path}, {"traceback", json::array()}};
+        return read_spill(path, offset, std::min<size_t>(length, 4 << 20), base64);
+    }
+
+    // Interrupt the running cell; safe to call from any thread.
+    void InterruptAsync() {
+        SBProcess p;
+        {
+            std::lock_guard<std::mutex> lock(process_mu);
+            p = process;
+        }
+        if (p.IsValid()) p.SendAsyncInterrupt();
+    }
+
+    // Drop output produced outside a cell.
+    void ClearOutput() {
+        capture.Clear(process);
+        if (stdio) stdio->Discard();
+    }
+
+    // Run code through the REPL with the inferior's output going to out/err
+    // (and to stream, if set) as it is produced; REPL messages are added
+    // once the code finishes. compact applies to the inferior's output.
+    // `display()` bundles go to display_fn, or are dropped.
+    void RunCapturing(const std::string &code, BoundedOutput &out, BoundedOutput &err,
+                      const InferiorStdio::StreamFn &stream = nullptr, bool compact = false,
+                      const DisplayChannel::DisplayFn &display_fn = nullptr) {
+        if (stdio) stdio->Attach(&out, &err, stream, compact, display_fn);
+        std::string mutable_code = code;
+        repl->IOHandlerInputComplete(*io_handler, mutable_code);
+        if (stdio) stdio->Finish();
+        if (!stream) {
+            capture.Collect(process, out, err, compact);
+            return;
+        }
+        BoundedOutput repl_out(output_limits, ""), repl_err(output_limits, "");
+        capture.Collect(process, repl_out, repl_err);
+        auto add = [&](const char *name, BoundedOutput &from, BoundedOutput &to) {
+            if (from.empty()) return;
+            auto text = from.Text();
+            to.Append(text);
+            stream(name, text);
+        };
+        add("stdout", repl_out, out);
+        add("stderr", repl_err, err);
+    }
+
+    // Run code outside the user's session: nothing is recorded in history,
+    // cell numbers or resource totals. Returns {stdout, stderr}.
+    std::pair<std::string, std::string> RunHidden(const std::string &code) {
+        ClearOutput();
+        BoundedOutput out(output_limits, ""), err(output_limits, "");
+        RunCapturing(code, out, err);
+        return {out.Text(), err.Text()};
+    }
+
+    // Warm-up cell; its output is dropped.
+    json Warmup(const std::string &code) {
+        auto t0 = std::chrono::steady_clock::now();
+        auto err = RunHidden(code).second;
+        auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        json result = {{"ms", round_ms(ms)}, {"ok", err.empty()}};
+        if (!err.empty()) {
+            std::cerr << "Warm-up cell failed:\n" << err << "\n";
+            result["error"] = err;
+        }
+        return result;
+    }
+
+    // Define the display hook in this inferior, once.
+    void DefineDisplay() {
+        display_ready = true;
+        auto err = RunHidden(display->Prelude()).second;
+        if (!err.empty()) std::cerr << "Defining display() failed:\n" << err << "\n";
+    }
+
+    // timeout_ms > 0 interrupts the cell once the deadline passes. With
+    // stream set, output is passed to it while the cell runs and the reply
+    // carries "streamed": true instead of the output text. compact
+    // overrides compact_output for this cell. `display()` bundles go to
+    // on_display as they are published, or else into the reply's
+    // display_data.
+    json Execute(const std::string &code, int64_t timeout_ms = 0, const InferiorStdio::StreamFn &stream = nullptr,
+                 std::optional<bool> compact = std::nullopt, const DisplayChannel::DisplayFn &on_display = nullptr) {
+        if (code.empty())
+            return {{"status", "ok"}, {"stdout", ""}, {"stderr", ""}, {"value", ""}};
+        if (!dead_reason.empty())
+            return {{"status", "error"}, {"stdout", ""}, {"stderr", ""}, {"ename", "REPLError"},
+                    {"evalue", dead_reason + "; send a reset request to start a new session"},
+                    {"traceback", json::array({dead_reason})}, {"needs_reset", true}};
+        if (display && !display_ready) {
+            // Identifiers outside comments and strings, so `display_width`
+            // or a "display" in a string doesn't define the hook. A cell
+            // that defines its own display() keeps it.
+            auto ids = identifiers(code);
+            if (ids.count("display") || ids.count("display_bytes")) {
+                auto names = defined_names(code);
+                if (names.count("display") || names.count("display_bytes")) display_ready = true;
+                else DefineDisplay();
+            }
+        }
+        if (packets) packets->Begin();
+
+        ClearOutput();
+
+        int pid = static_cast<int>(process.GetProcessID());
+        auto inf0 = sample_process(pid);
+        auto srv0 = sample_self();
+        auto ooms0 = cgroup.OomKills();
+        auto t0 = std::chrono::steady_clock::now();
+        if (timeout_ms > 0 && !monitor) monitor = std::make_unique<ExecMonitor>();
+        if (monitor) {
+            auto watched = limits;
+            if (!cgroup.path.empty()) watched.memory_kb = 0;
+            auto proc = process;
+            monitor->Arm(pid, watched, inf0, timeout_ms, [proc]() mutable { proc.SendAsyncInterrupt(); });
+        }
+
+        DefinitionCache::Plan plan;
+        plan.code = code;
+        if (def_cache) plan = def_cache->Prepare(code);
+
+        spill_seq++;
+        auto out = std::make_unique<BoundedOutput>(output_limits, SpillPrefix("stdout"));
+        auto serr = std::make_unique<BoundedOutput>(output_limits, SpillPrefix("stderr"));
+        // A cached definition cell prints nothing unless its import fails,
+        // which is retried below; don't stream that error.
+        bool compacting = compact.value_or(compact_output);
+        // Collected bundles are capped like output; later ones are counted.
+        json displays = json::array();
+        size_t display_bytes = 0, displays_dropped = 0;
+        DisplayChannel::DisplayFn display_fn = on_display;
+        if (!display_fn)
+            display_fn = [&](json bundle) {
+                size_t n = 0;
+                for (auto &v : bundle["data"]) n += v.is_string() ? v.get_ref<const std::string &>().size() : 0;
+                if (display_bytes + n > output_limits.head_bytes) {
+                    displays_dropped++;
+                    return;
+                }
+                display_bytes += n;
+                displays.push_back(std::move(bundle));
+            };
+        RunCapturing(plan.code, *out, *serr, plan.hit ? InferiorStdio::StreamFn() : stream, compacting, display_fn);
+        if (plan.hit && !serr->empty()) {
+            // Stale or unloadable package: compile the cell itself instead.
+            def_cache->Invalidate(plan, serr->Text());
+            plan.hit = false;
+            plan.code = code;
+            // The failed attempt's output isn't reported, so neither are its spill files.
+            out->RemoveSpill();
+            serr->RemoveSpill();
+            out = std::make_unique<BoundedOutput>(output_limits, SpillPrefix("stdout"));
+            serr = std::make_unique<BoundedOutput>(output_limits, SpillPrefix("stderr"));
+            RunCapturing(code, *out, *serr, stream, compacting, display_fn);
+        }
+
+        MonitorResult watched;
+        if (monitor) watched = monitor->Disarm();
+        auto violation = watched.violation;
+        if (!violation && cgroup.OomKills() > ooms0)
+            violation = {"memory", double(limits.memory_kb), double(limits.memory_kb)};
+
+        auto wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        auto inf1 = sample_process(pid);
+        auto srv1 = sample_self();
+        usage.Add(wall, inf0, inf1, srv0, srv1);
+        json resources = {{"cell", usage.cells}, {"wall_ms", round_ms(wall)},
+                          {"inferior", resource_delta(inf0, inf1)},
+                          {"server", resource_delta(srv0, srv1)}};
+
+        if (def_cache) def_cache->Commit(plan, serr->empty() && !violation && !watched.timed_out);
+        auto reply = [&](json resp) {
+            resp.update(OutputFields(*out, *serr));
+            if (stream) {
+                resp["stdout"] = resp["stderr"] = "";
+                resp["streamed"] = true;
+            }
+            resp["resources"] = resources;
+            if (packets) resp["timing"] = {{"wall_ms", round_ms(wall)}, {"gdb_remote", packets->Cell()}};
+            if (!displays.empty()) resp["display_data"] = displays;
+            if (displays_dropped) resp["display_dropped"] = displays_dropped;
+            if (plan.definition) resp["def_cache"] = plan.hit ? "hit" : "miss";
+            return resp;
+        };
+
+        auto state = process.GetState();
+        if (violation) {
+            // The inferior is killed on a breach; the debugger stays up.
+            dead_reason = violation.Message();
+            if (state != eStateExited && state != eStateDetached) process.Kill();
+            return reply({{"status", "error"}, {"ename", "ResourceLimitExceeded"}, {"evalue", dead_reason},
+                          {"traceback", json::array({dead_reason})}, {"limit", violation.ToJson()},
+                          {"needs_reset", true}});
+        }
+        if (state == eStateExited || state == eStateCrashed || state == eStateDetached)
+            dead_reason = "Mojo process terminated (state=" + std::to_string(state) + ")";
+        if (watched.timed_out) {
+            auto msg = "Cell exceeded its timeout of " + std::to_string(timeout_ms) + " ms";
+            if (watched.killed) {
+                msg += " and was killed after ignoring the interrupt";
+                if (dead_reason.empty()) dead_reason = msg;
+            }
+            json resp = {{"status", "error"}, {"ename", "TimeoutError"}, {"evalue", msg},
+                         {"traceback", json::array({msg})}, {"timeout_ms", timeout_ms}};
+            if (!dead_reason.empty()) resp["needs_reset"] = true;
+            return reply(resp);
+        }
+
+        if (!serr->empty()) {
+            auto text = serr->Text();
+            auto tb = split_lines(text);
+            return reply({{"status", "error"}, {"ename", "MojoError"},
+                          {"evalue", tb.empty() ? text : tb[0]}, {"traceback", tb}});
+        }
+
+        history.push_back(code);
+        return reply({{"status", "ok"}, {"value", ""}});
+    }
+
+    // Session aggregates plus a current sample of both processes.
+    json Stats() {
+        auto inf = sample_process(static_cast<int>(process.GetProcessID()));
+        auto srv = sample_self();
+        auto gauge = [](const ResourceSample &s) -> json {
+            if (!s.valid) return nullptr;
+            json g = {{"cpu_ms", round_ms(s.cpu_ms())}, {"peak_rss_kb", s.peak_rss_kb},
+                      {"major_faults", s.major_faults}};
+            if (s.has_rss) g["rss_kb"] = s.rss_kb;
+            return g;
+        };
+        return {{"status", "ok"}, {"totals", usage.ToJson()},
+                {"inferior", gauge(inf)}, {"server", gauge(srv)},
+                {"limits", limits.ToJson()}, {"cgroup", cgroup.path.empty() ? json(nullptr) : json(cgroup.path)},
+                {"def_cache", def_cache ? def_cache->Stats() : json(nullptr)},
+                {"stdio", stdio ? json{{"mode", "fifo"}, {"bytes", stdio->bytes_read()},
+                                   {"compacted_bytes", stdio->bytes_compacted()}}
+                              : json{{"mode", "lldb"}}},
+                {"compact_output", compact_output},
+                {"gdb_remote", packets ? packets->Totals() : json(nullptr)},
+                {"display", display ? json{{"bundles", display->bundles()}, {"bytes", display->bytes()},
+                                           {"defined", display_ready}}
+                                    : json(nullptr)}};
+    }
+};
@@ -0,0 +1,165 @@
+// `replay` request: rebuild session state from a list of earlier cells in
+// as few REPL submissions as possible. Runs of consecutive definition
+// cells are submitted as one cell; cells marked side_effect_free are
+// skipped. If a coalesced batch fails, its cells are re-run one by one so
+// errors are reported against the cell that caused them (a failed REPL
+// submission defines nothing, so the retry starts from the same state).
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "cell_analysis.h"
+#include "repl_session.h"
+
+struct ReplayCell {
+    size_t index;
+    std::string code;
+};
+
+// Status, error and (with_output) output fields of resp, skipping empty ones.
+inline void add_result_fields(json &e, const json &resp, bool with_output = true) {
+    e["status"] = resp.value("status", "error");
+    for (auto key : {"ename", "evalue", "stdout", "stderr", "needs_reset"}) {
+        if (!with_output && (key == std::string("stdout") || key == std::string("stderr"))) continue;
+        if (resp.contains(key) && !(resp[key].is_string() && resp[key].get<std::string>().empty()))
+            e[key] = resp[key];
+    }
+}
+
+// Per-cell result entry for the reply. Output of a coalesced submission
+// is attached to its last cell only.
+inline json replay_entry(size_t index, size_t submission, const json &resp, bool with_output = true) {
+    json e = {{"index", index}, {"submission", submission}};
+    add_result_fields(e, resp, with_output);
+    return e;
+}
+
+inline json replay_cells(ReplSession &session, const json &req) {
+    auto t0 = std::chrono::steady_clock::now();
+    bool stop_on_error = req.value("stop_on_error", false);
+    int64_t timeout_ms = req.value("timeout_ms", int64_t(0));
+
+    // Cells are strings or {"code": ..., "side_effect_free": bool}.
+    json results = json::array();
+    std::vector<std::vector<ReplayCell>> batches;
+    size_t skipped = 0, index = 0;
+    bool last_was_definition = false;
+    for (auto &c : req.value("cells", json::array())) {
+        size_t i = index++;
+        std::string code = c.is_string() ? c.get<std::string>() : c.value("code", "");
+        if (strip(code).empty() || (c.is_object() && c.value("side_effect_free", false))) {
+            results.push_back({{"index", i}, {"status", "skipped"}});
+            skipped++;
+            continue;
+        }
+        bool definition = is_definition_cell(code);
+        if (!(definition && last_was_definition) || batches.empty()) batches.emplace_back();
+        batches.back().push_back({i, code});
+        last_was_definition = definition;
+    }
+
+    size_t submissions = 0, errors = 0;
+    bool stopped = false;
+    auto run = [&](const ReplayCell &cell) {
+        auto resp = session.Execute(cell.code, timeout_ms);
+        submissions++;
+        results.push_back(replay_entry(cell.index, submissions, resp));
+        if (resp.value("status", "") != "ok") {
+            errors++;
+            if (stop_on_error || resp.value("needs_reset", false)) stopped = true;
+        }
+    };
+
+    for (auto &batch : batches) {
+        if (stopped) {
+            for (auto &cell : batch) results.push_back({{"index", cell.index}, {"status", "not_run"}});
+            continue;
+        }
+        if (batch.size() == 1) {
+            run(batch[0]);
+            continue;
+        }
+        std::string joined;
+        for (auto &cell : batch) joined += cell.code + "\n\n";
+        auto resp = session.Execute(joined, timeout_ms);
+        submissions++;
+        auto add_batch = [&] {
+            for (auto &cell : batch)
+                results.push_back(replay_entry(cell.index, submissions, resp, &cell == &batch.back()));
+        };
+        if (resp.value("status", "") == "ok") {
+            add_batch();
+            continue;
+        }
+        if (resp.value("needs_reset", false)) {
+            add_batch();
+            errors += batch.size();
+            stopped = true;
+            continue;
+        }
+        // Attribute the batch failure to individual cells.
+        for (auto &cell : batch) {
+            if (stopped) results.push_back({{"index", cell.index}, {"status", "not_run"}});
+            else run(cell);
+        }
+    }
+
+    std::sort(results.begin(), results.end(),
+              [](const json &a, const json &b) { return a["index"] < b["index"]; });
+    auto wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    // Cell errors are reported per cell; the request itself succeeded.
+    return {{"status", "ok"}, {"cells", results},
+            {"summary", {{"cells", index}, {"submissions", submissions}, {"skipped", skipped},
+                         {"errors", errors}, {"wall_ms", round_ms(wall)}}}};
+}
+
+// After an execute tagged with cell_id: record the cell in the session's
+// graph and, with execute_dependents, re-run the later cells that depend
+// on it in order. Their results go in resp["dependents"]; after a failure
+// the rest are reported as not_run.
+inline void track_cell(ReplSession &session, const json &req, json &resp) {
+    auto id = req.value("cell_id", "");
+    if (id.empty()) return;
+    auto code = req.value("code", "");
+    bool ok = resp.value("status", "") == "ok";
+    bool rerun = req.value("execute_dependents", false);
+    std::vector<std::pair<std::string, std::string>> deps;
+    if (rerun && ok)
+        for (auto *c : session.graph.Dependents(id, code)) deps.emplace_back(c->id, c->code);
+    if (ok) session.graph.Record(id, code);
+    if (!rerun) return;
+
+    auto t0 = std::chrono::steady_clock::now();
+    json results = json::array();
+    bool stopped = false;
+    for (auto &[dep_id, dep_code] : deps) {
+        json e = {{"cell_id", dep_id}};
+        if (stopped) {
+            e["status"] = "not_run";
+        } else {
+            auto r = session.Execute(dep_code, req.value("timeout_ms", int64_t(0)));
+            add_result_fields(e, r);
+            if (r.contains("display_data")) e["display_data"] = r["display_data"];
+            if (r.value("status", "") == "ok") session.graph.Record(dep_id, dep_code);
+            else stopped = true;
+        }
+        results.push_back(e);
+    }
+    resp["dependents"] = results;
+    auto wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    resp["dependents_ms"] = round_ms(wall);
+}
+
+// `dependents` request: which cells an edit of cell_id (to code, if given)
+// would re-run, without running anything.
+inline json cell_dependents(ReplSession &session, const json &req) {
+    auto id = req.value("cell_id", "");
+    json deps = json::array();
+    for (auto *c : session.graph.Dependents(id, req.value("code", "")))
+        deps.push_back(session.graph.CellJson(*c));
+    return {{"status", "ok"}, {"known", session.graph.Find(id) != nullptr}, {"dependents", deps},
+            {"cells", session.graph.size()}};
+}
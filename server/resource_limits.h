@@ -0,0 +1,313 @@
+// Per-session resource limits and per-cell deadlines for the Mojo inferior. Memory is enforced by a
+// cgroup v2 sub-group when the server's own cgroup allows it, otherwise by
+// sampling RSS while a cell runs; an optional address-space rlimit acts as a
+// hard backstop on Linux. CPU time is budgeted per cell. A breached limit
+// kills the inferior only, so the debugger survives and `reset` relaunches.
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "json.hpp"
+#include "proc_stats.h"
+
+struct ResourceLimits {
+    int64_t memory_kb = 0;         // RSS limit, 0 = unlimited
+    int64_t address_space_kb = 0;  // RLIMIT_AS backstop, 0 = unlimited
+    double cpu_ms = 0;             // CPU budget per cell, 0 = unlimited
+
+    static int64_t env_int(const char *name) {
+        auto v = std::getenv(name);
+        return v ? std::atoll(v) : 0;
+    }
+
+    // MOJO_REPL_MEMORY_LIMIT_MB, MOJO_REPL_ADDRESS_SPACE_LIMIT_MB, MOJO_REPL_CPU_LIMIT_S.
+    static ResourceLimits FromEnv() {
+        ResourceLimits l;
+        l.memory_kb = env_int("MOJO_REPL_MEMORY_LIMIT_MB") * 1024;
+        l.address_space_kb = env_int("MOJO_REPL_ADDRESS_SPACE_LIMIT_MB") * 1024;
+        if (auto v = std::getenv("MOJO_REPL_CPU_LIMIT_S")) l.cpu_ms = std::atof(v) * 1000;
+        return l;
+    }
+
+    void Update(const nlohmann::json &req) {
+        if (req.contains("memory_mb")) memory_kb = req["memory_mb"].get<int64_t>() * 1024;
+        if (req.contains("address_space_mb")) address_space_kb = req["address_space_mb"].get<int64_t>() * 1024;
+        if (req.contains("cpu_s")) cpu_ms = req["cpu_s"].get<double>() * 1000;
+    }
+
+    bool Any() const { return memory_kb > 0 || cpu_ms > 0; }
+
+    nlohmann::json ToJson() const {
+        return {{"memory_mb", memory_kb / 1024}, {"address_space_mb", address_space_kb / 1024},
+                {"cpu_s", cpu_ms / 1000}};
+    }
+};
+
+// A cgroup v2 group holding just the inferior, with memory.max set. The
+// group goes under a subtree already delegated for it: MOJO_REPL_CGROUP if
+// set, else the cgroup the server runs in. The server never moves itself
+// or changes controllers of a cgroup it lives in; cgroup v2 only lets a
+// group without processes of its own enable controllers for its children.
+// So the server's own cgroup works only if the memory controller is already
+// enabled there (e.g. the root cgroup of a container). Creation fails
+// quietly (and the RSS monitor takes over) otherwise, or when cgroup v2 is
+// not mounted or the group is not writable.
+struct CgroupLimit {
+    std::string path;
+
+    static bool write_file(const std::string &file, const std::string &value) {
+        std::ofstream f(file);
+        f << value;
+        f.flush();
+        return bool(f);
+    }
+
+    static std::string own_cgroup_dir() {
+        std::ifstream f("/proc/self/cgroup");
+        for (std::string line; std::getline(f, line);)
+            if (line.rfind("0::", 0) == 0) {
+                auto rel = line.substr(3);
+                return "/sys/fs/cgroup" + (rel == "/" ? "" : rel);
+            }
+        return "";
+    }
+
+    static bool has_word(const std::string &file, const std::string &word) {
+        std::ifstream f(file);
+        for (std::string w; f >> w;)
+            if (w == word) return true;
+        return false;
+    }
+
+    // The group the inferiors' groups go under, with the memory controller
+    // enabled for its children; "" if there is none. Worked out once per
+    // process.
+    static std::string limit_parent() {
+        static std::mutex mu;
+        static bool tried = false;
+        static std::string parent;
+        std::lock_guard<std::mutex> lock(mu);
+        if (tried) return parent;
+        tried = true;
+        auto own = own_cgroup_dir();
+        const char *delegated = std::getenv("MOJO_REPL_CGROUP");
+        auto dir = delegated && *delegated ? std::string(delegated) : own;
+        if (dir.empty()) return "";
+        if (!has_word(dir + "/cgroup.subtree_control", "memory")) {
+            // A group handed to us that holds no processes, the server
+            // included, may have the controller enabled for its children.
+            if (dir == own || !has_word(dir + "/cgroup.controllers", "memory") ||
+                !write_file(dir + "/cgroup.subtree_control", "+memory"))
+                return "";
+        }
+        parent = dir;
+        return parent;
+    }
+
+    bool Create(int pid, int64_t memory_kb) {
+#ifdef __linux__
+        auto parent = limit_parent();
+        if (parent.empty()) return false;
+        auto dir = parent + "/mojo-repl-" + std::to_string(getpid()) + "-" + std::to_string(pid);
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) return false;
+        if (!write_file(dir + "/memory.max", std::to_string(memory_kb * 1024)) ||
+            !write_file(dir + "/memory.swap.max", "0") ||
+            !write_file(dir + "/cgroup.procs", std::to_string(pid))) {
+            rmdir(dir.c_str());
+            return false;
+        }
+        path = dir;
+        return true;
+#else
+        (void)pid;
+        (void)memory_kb;
+        return false;
+#endif
+    }
+
+    bool SetMemory(int64_t memory_kb) {
+        return !path.empty() && write_file(path + "/memory.max", memory_kb > 0 ? std::to_string(memory_kb * 1024) : "max");
+    }
+
+    int64_t OomKills() const {
+        if (path.empty()) return 0;
+        std::ifstream f(path + "/memory.events");
+        for (std::string key; f >> key;) {
+            int64_t v = 0;
+            f >> v;
+            if (key == "oom_kill") return v;
+        }
+        return 0;
+    }
+
+    // The inferior must be gone; the kernel refuses to remove populated groups.
+    void Remove() {
+        if (path.empty()) return;
+        for (int i = 0; i < 50 && rmdir(path.c_str()) != 0 && errno == EBUSY; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        path.clear();
+    }
+};
+
+// Sets only the soft limit, so a later call can raise it again; kb 0
+// lifts it to the hard limit (normally RLIM_INFINITY).
+inline bool set_address_space_limit(int pid, int64_t kb) {
+#ifdef __linux__
+    struct rlimit lim;
+    if (prlimit(pid, RLIMIT_AS, nullptr, &lim) != 0) return false;
+    lim.rlim_cur = lim.rlim_max;
+    if (kb > 0 && (lim.rlim_max == RLIM_INFINITY || rlim_t(kb) * 1024 < lim.rlim_max)) lim.rlim_cur = rlim_t(kb) * 1024;
+    return prlimit(pid, RLIMIT_AS, &lim, nullptr) == 0;
+#else
+    (void)pid;
+    (void)kb;
+    return false;
+#endif
+}
+
+struct LimitViolation {
+    std::string kind;  // "memory" or "cpu"; empty when no limit was hit
+    double limit = 0, observed = 0;
+
+    explicit operator bool() const { return !kind.empty(); }
+
+    nlohmann::json ToJson() const {
+        if (kind == "memory") return {{"kind", kind}, {"limit_kb", int64_t(limit)}, {"observed_kb", int64_t(observed)}};
+        return {{"kind", kind}, {"limit_ms", limit}, {"observed_ms", round_ms(observed)}};
+    }
+
+    std::string Message() const {
+        if (kind == "memory")
+            return "Cell exceeded the memory limit (" + std::to_string(int64_t(observed) / 1024) +
+                   " MB used, limit " + std::to_string(int64_t(limit) / 1024) + " MB)";
+        return "Cell exceeded the CPU time limit (" + std::to_string(int64_t(observed)) +
+               " ms used, limit " + std::to_string(int64_t(limit)) + " ms)";
+    }
+};
+
+struct MonitorResult {
+    LimitViolation violation;
+    bool timed_out = false;  // the deadline passed and the cell was interrupted
+    bool killed = false;     // the interrupt did not end the cell within the grace period
+};
+
+// Background thread that watches a running cell: samples the inferior and
+// kills it when a limit is breached, and calls the deadline callback (an
+// async interrupt) when the cell's deadline passes. If the cell is still
+// running a grace period after the interrupt, the inferior is killed.
+class ExecMonitor {
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr std::chrono::milliseconds kSampleInterval{20};
+    static constexpr std::chrono::milliseconds kInterruptGrace{2000};
+
+    ExecMonitor() : thread_([this] { Loop(); }) {}
+
+    ~ExecMonitor() {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            quit_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    // timeout_ms <= 0 means no deadline.
+    void Arm(int pid, const ResourceLimits &limits, const ResourceSample &baseline,
+             int64_t timeout_ms = 0, std::function<void()> on_deadline = nullptr) {
+        std::lock_guard<std::mutex> lock(mu_);
+        pid_ = pid;
+        limits_ = limits;
+        baseline_ = baseline;
+        result_ = MonitorResult{};
+        has_deadline_ = timeout_ms > 0;
+        if (has_deadline_) deadline_ = Clock::now() + std::chrono::milliseconds(timeout_ms);
+        on_deadline_ = std::move(on_deadline);
+        armed_ = limits.Any() || has_deadline_;
+        cv_.notify_all();
+    }
+
+    // Also waits for an on_deadline call in progress, so it can't reach
+    // the next cell once this one is disarmed.
+    MonitorResult Disarm() {
+        std::unique_lock<std::mutex> lock(mu_);
+        armed_ = false;
+        cv_.wait(lock, [&] { return !in_callback_; });
+        return result_;
+    }
+
+private:
+    void Loop() {
+        std::unique_lock<std::mutex> lock(mu_);
+        while (!quit_) {
+            if (!armed_) {
+                cv_.wait(lock);
+                continue;
+            }
+            if (limits_.Any()) {
+                auto wake = Clock::now() + kSampleInterval;
+                cv_.wait_until(lock, has_deadline_ ? std::min(wake, deadline_) : wake);
+            } else {
+                cv_.wait_until(lock, deadline_);
+            }
+            if (!armed_ || quit_) continue;
+
+            if (has_deadline_ && Clock::now() >= deadline_) {
+                if (!result_.timed_out) {
+                    result_.timed_out = true;
+                    deadline_ = Clock::now() + kInterruptGrace;
+                    auto cb = on_deadline_;
+                    in_callback_ = true;
+                    lock.unlock();
+                    if (cb) cb();
+                    lock.lock();
+                    in_callback_ = false;
+                    cv_.notify_all();
+                } else {
+                    result_.killed = true;
+                    armed_ = false;
+                    kill(pid_, SIGKILL);
+                }
+                continue;
+            }
+
+            if (!limits_.Any()) continue;
+            auto s = sample_process(pid_);
+            if (!s.valid) continue;
+            auto &v = result_.violation;
+            if (limits_.memory_kb > 0 && s.rss_kb > limits_.memory_kb)
+                v = {"memory", double(limits_.memory_kb), double(s.rss_kb)};
+            else if (limits_.cpu_ms > 0 && s.cpu_ms() - baseline_.cpu_ms() > limits_.cpu_ms)
+                v = {"cpu", limits_.cpu_ms, s.cpu_ms() - baseline_.cpu_ms()};
+            if (v) {
+                armed_ = false;
+                kill(pid_, SIGKILL);
+            }
+        }
+    }
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool quit_ = false, armed_ = false, has_deadline_ = false, in_callback_ = false;
+    int pid_ = 0;
+    ResourceLimits limits_;
+    ResourceSample baseline_;
+    Clock::time_point deadline_;
+    std::function<void()> on_deadline_;
+    MonitorResult result_;
+    std::thread thread_;
+};
@@ -0,0 +1,559 @@
+// Named sessions hosted by one server. "main" is the session the server
+// bootstraps; `open_session` adds a fresh one and `fork_session` a branch
+// of an existing one. Requests pick their session with a "session" field.
+//
+// Each session has its own debugger, target, inferior and REPL, and its
+// own worker thread, so a long cell in one session doesn't hold up the
+// others. Replies of different sessions can therefore arrive out of
+// order; clients match them by id. Sessions of one process share what
+// LLDB shares process-wide: libMojoLLDB and the Mojo compiler libraries
+// are loaded once, and parsed modules (the entry point, libc, the Mojo
+// runtime) come from LLDB's global module list instead of being parsed
+// per debugger.
+//
+// With MOJO_REPL_IDLE_MINUTES=N, a session that has had no requests for N
+// minutes is checkpointed and its inferior and REPL are torn
+// down; the debugger stays. The next request for it restores the
+// checkpoint first.
+//
+// A fork is a checkpoint of the parent restored into a new session (see
+// checkpoint.h). Forking the stopped inferior itself would share pages
+// copy-on-write, but the REPL's compiler state and JIT'd code live in the
+// parent's debugger, and a second REPL can't be attached to a forked
+// process. Restore re-runs only definitions and cells that build
+// non-copyable vars, so a fork costs roughly the definitions' compile time
+// plus a memcpy of the copyable state.
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "checkpoint.h"
+#include "repl_session.h"
+
+inline json session_error(const std::string &msg, const std::string &ename = "SessionError") {
+    return {{"status", "error"}, {"ename", ename}, {"evalue", msg}, {"traceback", json::array({msg})}};
+}
+
+// Reply to a request that was queued when its session closed or the
+// server shut down.
+inline json session_closed(const std::string &id) {
+    return session_error("session " + id + " closed before the request ran", "SessionClosed");
+}
+
+// A private (0700) directory under $TMPDIR for fork and idle checkpoints,
+// so their predictable names can't be planted by other users; "" if it
+// can't be created.
+inline std::string make_checkpoint_dir() {
+    const char *tmpdir = std::getenv("TMPDIR");
+    std::string templ = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/mojo-repl-ckpt-XXXXXX";
+    return mkdtemp(templ.data()) ? templ : "";
+}
+
+// Where a session's fork or idle checkpoint goes; removed once restored.
+inline std::string session_checkpoint_path(const std::string &dir, const std::string &id, const char *kind) {
+    return dir.empty() ? "" : dir + "/" + id + "." + kind + ".ckpt";
+}
+
+// What a session is doing, for the idle monitor and `status`. Written by
+// the session's worker, read from the reader thread.
+struct SessionActivity {
+    using Clock = std::chrono::steady_clock;
+
+    std::mutex mu;
+    Clock::time_point last_used = Clock::now();
+    bool evicting = false;
+    std::string checkpoint;  // set while evicted
+    int64_t evictions = 0, resumes = 0;
+    double last_resume_ms = 0;
+
+    // The request on the worker, if any, and the inferior's pid, so the
+    // reader thread never has to touch the session or take LLDB locks.
+    bool busy = false;
+    json request_id;
+    std::string request_type;
+    Clock::time_point started;
+    int pid = 0;
+
+    void Touch() {
+        std::lock_guard<std::mutex> lock(mu);
+        last_used = Clock::now();
+    }
+
+    void Begin(const json &req, int inferior_pid) {
+        std::lock_guard<std::mutex> lock(mu);
+        busy = true;
+        request_id = req.is_object() ? req.value("id", json(nullptr)) : json(nullptr);
+        request_type = req.is_object() ? req.value("type", "") : "";
+        started = Clock::now();
+        pid = inferior_pid;
+    }
+
+    void SetPid(int inferior_pid) {
+        std::lock_guard<std::mutex> lock(mu);
+        pid = inferior_pid;
+    }
+
+    void End(int inferior_pid) {
+        std::lock_guard<std::mutex> lock(mu);
+        busy = false;
+        last_used = Clock::now();
+        pid = inferior_pid;
+    }
+
+    json ToJson() {
+        std::lock_guard<std::mutex> lock(mu);
+        json j = {{"evicted", !checkpoint.empty()}, {"evictions", evictions}, {"resumes", resumes},
+                  {"idle_s", round_ms(std::chrono::duration<double>(Clock::now() - last_used).count())}};
+        if (resumes) j["last_resume_ms"] = round_ms(last_resume_ms);
+        return j;
+    }
+};
+
+// Runs jobs for one session in order on its own thread.
+class SessionWorker {
+public:
+    SessionWorker() : thread_([this] { Loop(); }) {}
+
+    SessionWorker(const SessionWorker &) = delete;
+    SessionWorker &operator=(const SessionWorker &) = delete;
+
+    // Finishes the job in progress, drops queued ones.
+    ~SessionWorker() {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        DropQueued();
+        thread_.join();
+    }
+
+    // dropped runs instead of job if the worker goes away first, so the
+    // client waiting on it still gets a reply.
+    void Post(std::function<void()> job, std::function<void()> dropped = nullptr) {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            queue_.push_back({std::move(job), std::move(dropped)});
+        }
+        cv_.notify_one();
+    }
+
+    // Take the queued jobs off without running them and call their
+    // dropped callbacks. Safe from any thread, including the worker's.
+    void DropQueued() {
+        std::deque<Job> queued;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            queued.swap(queue_);
+        }
+        for (auto &j : queued)
+            if (j.dropped) j.dropped();
+    }
+
+    // Jobs queued or running.
+    size_t Pending() {
+        std::lock_guard<std::mutex> lock(mu_);
+        return queue_.size() + (busy_ ? 1 : 0);
+    }
+
+private:
+    struct Job {
+        std::function<void()> run, dropped;
+    };
+
+    void Loop() {
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mu_);
+                busy_ = false;
+                cv_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+                if (stop_) return;
+                job = std::move(queue_.front());
+                queue_.pop_front();
+                busy_ = true;
+            }
+            job.run();
+        }
+    }
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Job> queue_;
+    bool busy_ = false, stop_ = false;
+    std::thread thread_;
+};
+
+class SessionRegistry {
+public:
+    using Reply = std::function<void(json)>;
+    using Job = std::function<void(ReplSession &)>;
+
+    explicit SessionRegistry(ReplSession &main) : checkpoint_dir_(make_checkpoint_dir()) {
+        main.name = "main";
+        auto &e = entries_["main"];
+        e.session = &main;
+        e.worker = std::make_unique<SessionWorker>();
+        e.activity = std::make_shared<SessionActivity>();
+        e.activity->pid = InferiorPid(main);
+        if (auto v = std::getenv("MOJO_REPL_IDLE_MINUTES"); v && std::atof(v) > 0) {
+            idle_after_ = std::chrono::duration<double>(std::atof(v) * 60);
+            idle_thread_ = std::thread([this] { IdleLoop(); });
+        }
+    }
+
+    SessionRegistry(const SessionRegistry &) = delete;
+    SessionRegistry &operator=(const SessionRegistry &) = delete;
+
+    ~SessionRegistry() { Shutdown(); }
+
+    // Queue a job on the session's worker; false if there is no such
+    // session. req identifies the job in `status`. If the session closes
+    // or the server shuts down before the job runs, reply (if set) gets a
+    // SessionClosed error instead.
+    bool Post(const std::string &id, Job job, const json &req = nullptr, Reply reply = nullptr) {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = entries_.find(id.empty() ? "main" : id);
+        if (it == entries_.end()) return false;
+        auto *s = it->second.session;
+        auto activity = it->second.activity;
+        activity->Touch();
+        std::function<void()> dropped;
+        if (reply) dropped = [reply, name = it->first] { reply(session_closed(name)); };
+        it->second.worker->Post([s, activity, req, job = std::move(job)] {
+            activity->Begin(req, InferiorPid(*s));
+            if (Resume(*s, *activity)) activity->SetPid(InferiorPid(*s));
+            // Jobs reply with their own errors; this only keeps the worker alive.
+            try { job(*s); }
+            catch (const std::exception &e) { std::cerr << "Session " << s->name << ": job failed: " << e.what() << "\n"; }
+            activity->End(InferiorPid(*s));
+        }, std::move(dropped));
+        return true;
+    }
+
+    // Interrupt the session's running cell from the calling thread.
+    bool Interrupt(const std::string &id) {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = entries_.find(id.empty() ? "main" : id);
+        if (it == entries_.end()) return false;
+        it->second.session->InterruptAsync();
+        return true;
+    }
+
+    // A fresh session configured like `like`. setup runs on its worker;
+    // requests sent to the new id meanwhile queue behind it.
+    void Open(const ReplSession &like, std::string id, Reply reply, std::function<json(ReplSession &)> setup) {
+        if (!Add(like, id, reply)) return;
+        Post(id, [this, id, reply, setup](ReplSession &s) {
+            json resp = setup(s);
+            if (resp.value("status", "") != "ok") Drop(id);
+            else resp["session"] = id;
+            reply(resp);
+        }, {{"type", "open_session"}}, reply);
+    }
+
+    // Branch `from` into a new session: the parent's worker writes a
+    // checkpoint, then the child's worker restores it.
+    void Fork(const std::string &from, std::string id, Reply reply, std::function<json(ReplSession &)> after) {
+        auto t0 = std::chrono::steady_clock::now();
+        // The parent may be closed and reaped before the child's job runs:
+        // the job only uses its name.
+        std::string parent_name = from.empty() ? "main" : from;
+        ReplSession *parent = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            auto it = entries_.find(parent_name);
+            if (it != entries_.end()) parent = it->second.session;
+        }
+        if (!parent) return reply(session_error("unknown session: " + from));
+        if (!Add(*parent, id, reply)) return;
+
+        auto path = session_checkpoint_path(checkpoint_dir_, id, "fork");
+        auto saved = std::make_shared<std::promise<json>>();
+        std::shared_future<json> checkpoint = saved->get_future().share();
+        Post(parent_name, [saved, path](ReplSession &s) { saved->set_value(checkpoint_session(s, path)); },
+             {{"type", "checkpoint"}});
+        Post(id, [=](ReplSession &s) {
+            json ckpt, resp;
+            try { ckpt = checkpoint.get(); }
+            catch (const std::future_error &) { ckpt = session_error("session " + from + " closed before the fork"); }
+            if (ckpt.value("status", "") != "ok") resp = ckpt;
+            else if (auto err = s.CreateDebugger(); !err.empty()) resp = session_error(err);
+            else resp = restore_session(s, path);
+            unlink(path.c_str());
+            if (resp.value("status", "") != "ok") {
+                Drop(id);
+                return reply(resp);
+            }
+            json extra = after(s);
+            auto wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            resp = {{"status", "ok"}, {"session", id}, {"from", parent_name},
+                    {"checkpoint", ckpt}, {"restore", resp}, {"wall_ms", round_ms(wall)}};
+            resp.update(extra);
+            reply(resp);
+        }, {{"type", "fork_session"}}, reply);
+    }
+
+    // Tear the session down after its queued requests.
+    void Close(const std::string &id, Reply reply) {
+        if (id.empty() || id == "main") return reply(session_error("the main session can't be closed"));
+        if (!Post(id, [this, id, reply](ReplSession &) {
+                Drop(id);
+                reply({{"status", "ok"}, {"session", id}});
+            }, {{"type", "close_session"}}, reply))
+            reply(session_error("unknown session: " + id));
+    }
+
+    json List() {
+        Reap();
+        std::lock_guard<std::mutex> lock(mu_);
+        json sessions = json::array();
+        for (auto &[id, e] : entries_) {
+            json j = {{"session", id}, {"pending", e.worker->Pending()}};
+            j.update(e.activity->ToJson());
+            int pid;
+            {
+                std::lock_guard<std::mutex> state(e.activity->mu);
+                pid = e.activity->pid;
+            }
+            if (auto inf = sample_process(pid); pid > 0 && inf.valid && inf.has_rss) j["inferior_rss_kb"] = inf.rss_kb;
+            sessions.push_back(j);
+        }
+        auto srv = sample_process(getpid());
+        json server = {{"modules", SBModule::GetNumberAllocatedModules()}};
+        if (srv.valid && srv.has_rss) server["rss_kb"] = srv.rss_kb;
+        return {{"status", "ok"}, {"sessions", sessions}, {"server", server}};
+    }
+
+    // Health of one session without waiting for its worker: what it is
+    // doing and for how long, the inferior's state and RSS, queue depth.
+    // A request in progress is "running" while the inferior runs and
+    // "compiling" while it is stopped, i.e. the REPL is compiling or
+    // evaluating in the debugger.
+    json Status(const std::string &id) {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = entries_.find(id.empty() ? "main" : id);
+        if (it == entries_.end()) return session_error("unknown session: " + id);
+        auto &e = it->second;
+        auto &a = *e.activity;
+        std::lock_guard<std::mutex> state(a.mu);
+        auto now = SessionActivity::Clock::now();
+        auto process_state = process_run_state(a.pid);
+        json resp = {{"status", "ok"}, {"session", it->first}, {"state", "idle"},
+                     {"process_state", process_state.empty() ? json(nullptr) : json(process_state)},
+                     {"idle_s", round_ms(std::chrono::duration<double>(now - a.last_used).count())}};
+        size_t pending = e.worker->Pending();
+        if (a.busy) {
+            if (process_state.empty()) resp["state"] = "starting";
+            else resp["state"] = process_state == "running" ? "running" : "compiling";
+            auto elapsed = std::chrono::duration<double, std::milli>(now - a.started).count();
+            resp["request"] = {{"id", a.request_id}, {"type", a.request_type}, {"elapsed_ms", round_ms(elapsed)}};
+            if (pending) pending--;
+        } else if (!a.checkpoint.empty()) {
+            resp["state"] = "evicted";
+        }
+        resp["queue_depth"] = pending;
+        if (!process_state.empty()) {
+            resp["pid"] = a.pid;
+            auto inf = sample_process(a.pid);
+            if (inf.valid && inf.has_rss) resp["inferior_rss_kb"] = inf.rss_kb;
+        }
+        auto srv = sample_process(getpid());
+        if (srv.valid && srv.has_rss) resp["server_rss_kb"] = srv.rss_kb;
+        return resp;
+    }
+
+    // Stop every worker (after its current job) and destroy the sessions.
+    void Shutdown() {
+        if (idle_thread_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(idle_mu_);
+                idle_stop_ = true;
+            }
+            idle_cv_.notify_all();
+            idle_thread_.join();
+        }
+        std::map<std::string, Entry> entries;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            entries.swap(entries_);
+        }
+        for (auto &[id, e] : entries) {
+            e.session->InterruptAsync();
+            e.worker.reset();
+            e.session->Destroy();
+            if (!e.activity->checkpoint.empty()) unlink(e.activity->checkpoint.c_str());
+        }
+        Reap();
+        if (!checkpoint_dir_.empty()) rmdir(checkpoint_dir_.c_str());
+    }
+
+private:
+    struct Entry {
+        ReplSession *session = nullptr;
+        std::unique_ptr<ReplSession> owned;
+        std::shared_ptr<SessionActivity> activity;
+        std::unique_ptr<SessionWorker> worker;
+    };
+
+    // Register a not-yet-bootstrapped session; replies with an error and
+    // returns null if the id is taken.
+    ReplSession *Add(const ReplSession &like, std::string &id, const Reply &reply) {
+        Reap();
+        std::lock_guard<std::mutex> lock(mu_);
+        if (id.empty()) id = "session-" + std::to_string(++seq_);
+        // Ids name checkpoint files.
+        if (id.find('/') != std::string::npos) {
+            reply(session_error("invalid session id: " + id));
+            return nullptr;
+        }
+        if (entries_.count(id)) {
+            reply(session_error("session already exists: " + id));
+            return nullptr;
+        }
+        auto s = std::make_unique<ReplSession>(like.root);
+        s->name = id;
+        s->limits = like.limits;
+        s->output_limits = like.output_limits;
+        s->fast_startup = like.fast_startup;
+        // Keeps the parsed entry point in the shared module list.
+        s->entry_module = like.entry_module;
+        auto &e = entries_[id];
+        e.session = s.get();
+        e.owned = std::move(s);
+        e.activity = std::make_shared<SessionActivity>();
+        e.worker = std::make_unique<SessionWorker>();
+        return e.session;
+    }
+
+    // Called on the session's own worker: the entry moves to a graveyard
+    // and is joined from another thread by Reap(). Requests queued behind
+    // this job are answered with SessionClosed now; no more can be posted.
+    void Drop(const std::string &id) {
+        ReplSession *s = nullptr;
+        SessionWorker *worker = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            auto it = entries_.find(id);
+            if (it == entries_.end()) return;
+            s = it->second.session;
+            worker = it->second.worker.get();
+            dropped_.push_back(std::move(it->second));
+            entries_.erase(it);
+        }
+        worker->DropQueued();
+        // The entry, now in dropped_, is only freed by Reap() after this
+        // worker's job returns.
+        s->Destroy();
+    }
+
+    void Reap() {
+        std::vector<Entry> dropped;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            dropped.swap(dropped_);
+        }
+        for (auto &e : dropped) e.worker.reset();
+    }
+
+    static int InferiorPid(ReplSession &s) {
+        return s.process.IsValid() ? static_cast<int>(s.process.GetProcessID()) : 0;
+    }
+
+    // Runs on the session's worker before each request; true if the
+    // session was evicted.
+    static bool Resume(ReplSession &s, SessionActivity &idle) {
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lock(idle.mu);
+            path.swap(idle.checkpoint);
+        }
+        if (path.empty()) return false;
+        auto t0 = std::chrono::steady_clock::now();
+        auto resp = restore_session(s, path);
+        unlink(path.c_str());
+        auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        if (resp.value("status", "") != "ok") {
+            s.dead_reason = "could not resume idle session: " + resp.value("evalue", std::string("unknown error"));
+            std::cerr << "Session " << s.name << ": " << s.dead_reason << "\n";
+        }
+        std::lock_guard<std::mutex> lock(idle.mu);
+        idle.resumes++;
+        idle.last_resume_ms = ms;
+        return true;
+    }
+
+    // Runs on the session's worker once the idle monitor picked it.
+    static void Evict(ReplSession &s, SessionActivity &idle, std::chrono::duration<double> after,
+                      const std::string &dir) {
+        {
+            std::lock_guard<std::mutex> lock(idle.mu);
+            idle.evicting = false;
+            // A request may have come in since the monitor looked.
+            if (!idle.checkpoint.empty() || SessionActivity::Clock::now() - idle.last_used < after) return;
+        }
+        if (!s.process.IsValid() || !s.dead_reason.empty()) return;
+        auto path = session_checkpoint_path(dir, s.name, "idle");
+        auto resp = checkpoint_session(s, path);
+        if (resp.value("status", "") != "ok") {
+            std::cerr << "Session " << s.name << " stays resident: " << resp.value("evalue", std::string()) << "\n";
+            idle.Touch();
+            return;
+        }
+        s.Stop();
+        // Let LLDB drop modules only the torn-down target used.
+        SBDebugger::MemoryPressureDetected();
+        std::lock_guard<std::mutex> lock(idle.mu);
+        idle.checkpoint = path;
+        idle.evictions++;
+        idle.pid = 0;
+    }
+
+    void IdleLoop() {
+        auto poll = std::min<std::chrono::duration<double>>(idle_after_ / 4, std::chrono::seconds(10));
+        std::unique_lock<std::mutex> idle_lock(idle_mu_);
+        while (!idle_cv_.wait_for(idle_lock, poll, [&] { return idle_stop_; })) {
+            auto now = SessionActivity::Clock::now();
+            std::lock_guard<std::mutex> lock(mu_);
+            for (auto &[id, e] : entries_) {
+                {
+                    std::lock_guard<std::mutex> state(e.activity->mu);
+                    if (e.activity->evicting || !e.activity->checkpoint.empty() || now - e.activity->last_used < idle_after_)
+                        continue;
+                    if (e.worker->Pending()) continue;
+                    e.activity->evicting = true;
+                }
+                auto *s = e.session;
+                auto idle = e.activity;
+                auto after = idle_after_;
+                auto dir = checkpoint_dir_;
+                e.worker->Post([s, idle, after, dir] { Evict(*s, *idle, after, dir); });
+            }
+        }
+    }
+
+    std::string checkpoint_dir_;
+    std::mutex mu_;
+    std::map<std::string, Entry> entries_;
+    std::vector<Entry> dropped_;
+    int64_t seq_ = 0;
+
+    std::chrono::duration<double> idle_after_{0};
+    std::mutex idle_mu_;
+    std::condition_variable idle_cv_;
+    bool idle_stop_ = false;
+    std::thread idle_thread_;
+};
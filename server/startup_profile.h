@@ -0,0 +1,110 @@
+// Wall time per bootstrap step, reported in the ready line when
+// MOJO_REPL_PROFILE_STARTUP is set. Compare configurations with
+// tools/bench_startup.py.
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+
+class StartupProfile {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    StartupProfile() : enabled_(std::getenv("MOJO_REPL_PROFILE_STARTUP") != nullptr) {}
+
+    bool enabled() const { return enabled_; }
+
+    // Start a new run; the first Mark() measures from here.
+    void Begin() {
+        std::lock_guard<std::mutex> lock(mu_);
+        steps_.clear();
+        tasks_.clear();
+        start_ = last_ = Clock::now();
+    }
+
+    // Close the step that ran on the main thread since the previous mark.
+    void Mark(const std::string &step) {
+        if (!enabled_) return;
+        auto now = Clock::now();
+        std::lock_guard<std::mutex> lock(mu_);
+        steps_.push_back({step, Ms(last_), Ms(now)});
+        last_ = now;
+    }
+
+    // Background tasks are timed from another thread. StartTask returns a
+    // handle for FinishTask; tasks still running show up without a duration.
+    size_t StartTask(const std::string &task) {
+        std::lock_guard<std::mutex> lock(mu_);
+        double now = Ms(Clock::now());
+        tasks_.push_back({task, now, -1});
+        return tasks_.size() - 1;
+    }
+
+    void FinishTask(size_t handle) {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (handle < tasks_.size()) tasks_[handle].end = Ms(Clock::now());
+    }
+
+    // Main-thread steps, plus background tasks with the steps they overlapped.
+    // serial_ms is what the work done before the last mark would have taken
+    // back to back.
+    nlohmann::json ToJson() const {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto r = [](double ms) { return std::round(ms * 10) / 10; };
+        nlohmann::json steps = nlohmann::json::array(), tasks = nlohmann::json::array();
+        double serial = 0;
+        for (auto &s : steps_) {
+            steps.push_back({{"step", s.name}, {"ms", r(s.end - s.start)}});
+            serial += s.end - s.start;
+        }
+        for (auto &t : tasks_) {
+            double end = t.end < 0 ? Ms(Clock::now()) : t.end;
+            nlohmann::json overlapped = nlohmann::json::array();
+            for (auto &s : steps_)
+                if (s.start < end && t.start < s.end) overlapped.push_back(s.name);
+            nlohmann::json task = {{"task", t.name}, {"start_ms", r(t.start)}, {"overlapped", overlapped}};
+            if (t.end < 0) task["running"] = true;
+            else task["ms"] = r(t.end - t.start);
+            tasks.push_back(task);
+            serial += std::min(end, Ms(last_)) - t.start;
+        }
+        nlohmann::json j = {{"total_ms", r(Ms(last_))}, {"steps", steps}};
+        if (!tasks_.empty()) {
+            j["background"] = tasks;
+            j["serial_ms"] = r(serial);
+        }
+        return j;
+    }
+
+    void Print() const {
+        std::lock_guard<std::mutex> lock(mu_);
+        for (auto &s : steps_) std::cerr << "startup: " << s.name << " " << s.end - s.start << " ms\n";
+        for (auto &t : tasks_) {
+            std::cerr << "startup: [bg] " << t.name << " ";
+            if (t.end < 0) std::cerr << "running";
+            else std::cerr << t.end - t.start << " ms";
+            std::cerr << " (started at " << t.start << " ms)\n";
+        }
+    }
+
+private:
+    struct Interval {
+        std::string name;
+        double start, end;
+    };
+
+    double Ms(Clock::time_point t) const { return std::chrono::duration<double, std::milli>(t - start_).count(); }
+
+    bool enabled_;
+    mutable std::mutex mu_;
+    Clock::time_point start_ = Clock::now(), last_ = start_;
+    std::vector<Interval> steps_, tasks_;
+};
@@ -0,0 +1,126 @@
+// Terminal-semantics compaction of cell output. Progress bars redraw one
+// line with `\r` (and often ESC[K) thousands of times; a notebook shows
+// only the last version, so passing every redraw on wastes megabytes of
+// reply and stream payload. TerminalCompactor applies the redraws as a
+// terminal would and passes on only finished lines, in streaming fashion:
+// memory is bounded by kMaxLine however much is written.
+//
+// A partial line can be shown early with Flush(). If it is then redrawn,
+// the replacement goes out as "\r" + new line, which notebooks render as
+// an overwrite, so the result still displays correctly.
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+class TerminalCompactor {
+public:
+    // Lines longer than this are passed on in pieces.
+    static constexpr size_t kMaxLine = 64 << 10;
+    // Longest escape sequence recognized; longer ones pass through.
+    static constexpr size_t kMaxEscape = 32;
+
+    // out(const char *data, size_t n) receives the compacted bytes.
+    template <class Out> void Feed(const char *data, size_t n, Out &&out) {
+        bytes_in_ += n;
+        for (size_t i = 0; i < n; i++) {
+            char c = data[i];
+            if (!esc_.empty()) {
+                Escape(c, out);
+            } else if (c == '\x1b') {
+                esc_ = c;
+            } else if (c == '\r') {
+                cr_ = true;
+            } else if (c == '\n') {
+                cr_ = false;
+                Emit(out);
+                Put("\n", 1, out);
+                shown_ = false;
+            } else {
+                Text(&c, 1, out);
+            }
+        }
+    }
+
+    // Pass on the current partial line, e.g. before a stream message.
+    template <class Out> void Flush(Out &&out) {
+        if (!line_.empty() || (rewrite_ && shown_)) Emit(out);
+    }
+
+    // End of output: flush everything and start over for the next cell. A
+    // trailing `\r` with nothing after it keeps the line, as a terminal does.
+    template <class Out> void Finish(Out &&out) {
+        if (!esc_.empty()) Literal(out);
+        Flush(out);
+        line_.clear();
+        cr_ = rewrite_ = shown_ = false;
+    }
+
+    size_t bytes_in() const { return bytes_in_; }
+    size_t bytes_out() const { return bytes_out_; }
+
+private:
+    // Printable bytes (and escape sequences we don't interpret) land on the
+    // line; after a `\r` they replace it.
+    template <class Out> void Text(const char *p, size_t n, Out &out) {
+        if (cr_) {
+            Clear();
+            cr_ = false;
+        }
+        line_.append(p, n);
+        if (line_.size() >= kMaxLine) Emit(out);
+    }
+
+    template <class Out> void Escape(char c, Out &out) {
+        esc_ += c;
+        bool csi = esc_.size() > 1 && esc_[1] == '[';
+        if (esc_.size() == 2 && !csi) return Literal(out);
+        if (esc_.size() <= 2) return;
+        if (c >= 0x20 && c <= 0x3F && esc_.size() < kMaxEscape) return;  // parameters
+        if (c == 'K') {
+            // Erase in line: 0 = to the end, 1 = to the cursor, 2 = all. The
+            // cursor is at the start after a `\r` and at the end otherwise.
+            auto param = esc_.substr(2, esc_.size() - 3);
+            bool to_end = param.empty() || param == "0";
+            if (to_end || param == "1" || param == "2") {
+                if (cr_ || !to_end) Clear();
+                esc_.clear();
+                return;
+            }
+        }
+        Literal(out);
+    }
+
+    template <class Out> void Literal(Out &out) {
+        std::string esc;
+        esc.swap(esc_);
+        Text(esc.data(), esc.size(), out);
+    }
+
+    void Clear() {
+        line_.clear();
+        rewrite_ = true;
+    }
+
+    template <class Out> void Emit(Out &out) {
+        if (rewrite_ && shown_) Put("\r", 1, out);
+        if (!line_.empty()) {
+            Put(line_.data(), line_.size(), out);
+            shown_ = true;
+        }
+        line_.clear();
+        rewrite_ = false;
+    }
+
+    template <class Out> void Put(const char *p, size_t n, Out &out) {
+        bytes_out_ += n;
+        out(p, n);
+    }
+
+    std::string line_;    // current line, not yet passed on
+    std::string esc_;     // escape sequence being read
+    bool cr_ = false;     // a `\r` was seen; the next text replaces the line
+    bool rewrite_ = false;  // line_ replaces what was shown of this line
+    bool shown_ = false;  // part of this line was already passed on
+    size_t bytes_in_ = 0, bytes_out_ = 0;
+};
@@ -0,0 +1,103 @@
+"""Tests for the cell parser (server/cell_analysis.h) and dependency graph (server/cell_graph.h), compiled into a small driver."""
+import shutil,subprocess,pytest
+from pathlib import Path
+
+SERVER_DIR = Path(__file__).resolve().parents[1] / "server"
+
+# `defined` / `idents` print the names of the code on stdin, one per line.
+# `deps` reads cells split at \0, each `id\ncode`, records all but the last,
+# and prints the dependents of the last one's id (its code, if any, is the edit).
+DRIVER = r'''
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "cell_graph.h"
+int main(int argc, char **argv) {
+    std::string mode = argc > 1 ? argv[1] : "", in((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+    if (mode == "defined" || mode == "idents") {
+        for (auto &n : mode == "defined" ? defined_names(in) : identifiers(in)) std::cout << n << "\n";
+        return 0;
+    }
+    std::vector<std::pair<std::string, std::string>> cells;
+    size_t start = 0;
+    for (size_t i = 0; i <= in.size(); i++) {
+        if (i < in.size() && in[i] != '\0') continue;
+        auto cell = in.substr(start, i - start);
+        auto nl = cell.find('\n');
+        cells.emplace_back(cell.substr(0, nl), nl == std::string::npos ? "" : cell.substr(nl + 1));
+        start = i + 1;
+    }
+    CellGraph g;
+    for (size_t i = 0; i + 1 < cells.size(); i++) g.Record(cells[i].first, cells[i].second);
+    for (auto *c : g.Dependents(cells.back().first, cells.back().second)) std::cout << c->id << "\n";
+}
+'''
+
+@pytest.fixture(scope='module')
+def run(tmp_path_factory):
+    cxx = shutil.which('c++')
+    if not cxx: pytest.skip("no C++ compiler")
+    d = tmp_path_factory.mktemp('cell_analysis')
+    (d / 'driver.cpp').write_text(DRIVER)
+    subprocess.run([cxx, '-std=c++17', f'-I{SERVER_DIR}', str(d / 'driver.cpp'), '-o', str(d / 'driver')], check=True)
+    def _run(mode, s):
+        out = subprocess.run([str(d / 'driver'), mode], input=s.encode(), capture_output=True, check=True).stdout.decode()
+        return out.split()
+    return _run
+
+def deps(run, cells, root, new_code=''):
+    return run('deps', '\0'.join(f'{i}\n{c}' for i,c in cells + [(root, new_code)]))
+
+def test_defined_names_definitions_and_imports(run):
+    code = 'fn f(x: Int) -> Int:\n    var inner = x\n    return inner\nstruct S:\n    var field: Int\nalias N = 3\n'
+    assert run('defined', code) == ['N', 'S', 'f']
+    code = 'import math\nfrom collections import List, Dict as D\nfrom os import *\nfrom a import (b, c)\n'
+    assert run('defined', code) == ['D', 'List', 'b', 'c', 'math']
+
+def test_defined_names_vars_and_assignments(run):
+    assert run('defined', 'var a = 1\nvar b: Int\nc = 2\nd += 1\ne <<= 1\n') == ['a', 'b', 'c', 'd', 'e']
+    # Comparisons and calls bind nothing.
+    assert run('defined', 'x == 1\ny <= 2\nz >= 3\nw != 4\nprint(q)\n') == []
+    # Nor do assignments inside a block.
+    assert run('defined', 'if True:\n    k = 1\n') == []
+
+def test_defined_names_in_place_mutations(run):
+    assert run('defined', 'xs.append(4)\nys[0] = 1\np.x = 3\nm [1] += 2\n') == ['m', 'p', 'xs', 'ys']
+    # Calls and expressions that only read the name don't count.
+    assert run('defined', 'print(xs[0])\nf(p.x)\n3.5\n') == []
+
+def test_identifiers_skip_comments_strings_and_numbers(run):
+    code = 'var a = b + 3e5 + 0xff  # not_me\nprint("nor_me", \'x\')\ns = """\nlong_string\n"""\n'
+    assert run('idents', code) == ['a', 'b', 'print', 's', 'var']
+    assert run('idents', 'p("esc\\"aped", q)') == ['p', 'q']
+
+def test_dependents_are_transitive_and_in_order(run):
+    cells = [('c1', 'var base = 2'), ('c2', 'var twice = base * 2'), ('c3', 'print("unrelated")'),
+             ('c4', 'print(twice + 1)'), ('c5', 'print(base) # twice')]
+    assert deps(run, cells, 'c1') == ['c2', 'c4', 'c5']
+    assert deps(run, cells, 'c2') == ['c4']
+    assert deps(run, cells, 'c4') == []
+    assert deps(run, cells, 'missing') == []
+
+def test_dependents_include_rebinding_and_edited_names(run):
+    # A later cell that rebinds a name is overwritten by re-running an earlier one.
+    cells = [('c1', 'var x = 1'), ('c2', 'x = 5'), ('c3', 'print("other")')]
+    assert deps(run, cells, 'c1') == ['c2']
+    # Names the edit binds count too.
+    cells = [('c1', 'print(1)'), ('c2', 'print(y)')]
+    assert deps(run, cells, 'c1') == []
+    assert deps(run, cells, 'c1', 'var y = 3') == ['c2']
+
+def test_dependents_follow_mutations(run):
+    cells = [('c1', 'var xs = [1, 2]'), ('c2', 'xs.append(4)'), ('c3', 'print(len(xs))'),
+             ('c4', 'var p = P()'), ('c5', 'p.x = 3'), ('c6', 'print(p.x)')]
+    # Re-running the mutation shows in the cells that read the value.
+    assert deps(run, cells, 'c2') == ['c3']
+    assert deps(run, cells, 'c5') == ['c6']
+    # Re-running the declaration re-runs the mutation as well.
+    assert deps(run, cells, 'c1') == ['c2', 'c3']
+
+def test_dependents_of_a_rerecorded_cell_keep_its_position(run):
+    cells = [('c1', 'var x = 1'), ('c2', 'print(x)'), ('c1', 'var x = 2')]
+    assert deps(run, cells, 'c1') == ['c2']
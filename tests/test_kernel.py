@@ -2,7 +2,7 @@ import logging, re, pytest, time
 import jupyter_client
 import mojokernel
 from mojokernel.kernel import MojoKernel
-from mojokernel.lsp_client import LSPError
+from mojokernel.lsp_client import LSPError, _Pending
 
 def test_version():
     v = mojokernel.__version__
@@ -94,7 +94,25 @@ def test_kernel_completion_and_signature_e2e(kc):
     assert '_ktest_sig(' in txt
 
 
-class _WrapScopeOnlyLSP:
+class _FakeLSP:
+    "Runs each completion synchronously behind the client's async completion API."
+    request_timeout = 2.0
+
+    def complete_async(self, text, cursor_offset, doc=None, notify=None):
+        p = _Pending('textDocument/completion', notify)
+        try: p.msg = dict(result=self.complete(text, cursor_offset))
+        except Exception as e: p.err = e
+        p.set_done()
+        return p
+
+    def finish(self, p, timeout=None):
+        if p.err: raise p.err
+        return p.msg['result']
+
+    def cancel(self, p): pass
+
+
+class _WrapScopeOnlyLSP(_FakeLSP):
     def __init__(self): self.calls = []
 
     def _is_wrapped(self, text): return text.startswith('fn __mojokernel_cell__():\n')
@@ -141,7 +159,7 @@ class _WrapScopeOutdatedBurstLSP(_WrapScopeOnlyLSP):
         return dict(isIncomplete=False, items=[dict(label='sort', kind=2)])
 
 
-class _AlwaysTimeoutLSP:
+class _AlwaysTimeoutLSP(_FakeLSP):
     def complete(self, text, cursor_offset): raise TimeoutError('LSP request timed out: textDocument/completion')
     def signature_help(self, text, cursor_offset): return dict(signatures=[])
     def hover(self, text, cursor_offset): return None
@@ -164,7 +182,7 @@ class _TimeoutThenRecoverLSP(_WrapScopeOnlyLSP):
     def restart(self): self.restart_calls += 1
 
 
-class _UnfilteredLSP:
+class _UnfilteredLSP(_FakeLSP):
     def complete(self, text, cursor_offset):
         items = [dict(label='print', kind=3), dict(label='Int', kind=7), dict(label='len', kind=3), dict(insertText='println', kind=3), dict(label='pri_helper', kind=3)]
         return dict(isIncomplete=False, items=items)
@@ -258,3 +276,137 @@ def test_do_complete_timeout_does_not_restart_lsp():
     out = k.do_complete('var list = [2, 3, 5]\nlist.', len('var list = [2, 3, 5]\nlist.'))
     assert out.get('matches', []) == []
     assert lsp.restart_calls == 0
+
+
+def test_do_complete_waits_for_lsp_start():
+    from concurrent.futures import Future
+    import threading
+    k = _mk_kernel_for_lsp(_UnfilteredLSP())
+    k._lsp_ready = Future()
+    threading.Timer(0.2, k._lsp_ready.set_result, args=(True,)).start()
+    t0 = time.time()
+    out = k.do_complete('pri', 3)
+    assert time.time() - t0 >= 0.15
+    assert out.get('matches', []) == ['print', 'println', 'pri_helper']
+    assert k._lsp_ready is None
+
+
+def test_do_complete_falls_back_when_lsp_start_fails():
+    from concurrent.futures import Future
+    k = _mk_kernel_for_lsp(_UnfilteredLSP())
+    k._lsp_ready = Future()
+    k._lsp_ready.set_exception(RuntimeError('mojo-lsp-server not found'))
+    out = k.do_complete('pri', 3)
+    assert out['status'] == 'ok'
+    assert k.lsp is None
+
+
+class _CountingLSP(_UnfilteredLSP):
+    def __init__(self, incomplete=False): self.calls,self.incomplete = 0,incomplete
+    def complete(self, text, cursor_offset):
+        # Both strategies go out per round trip; count the raw one.
+        if not text.startswith('fn __mojokernel_cell__():\n'): self.calls += 1
+        return dict(super().complete(text, cursor_offset), isIncomplete=self.incomplete)
+
+
+def test_do_complete_narrows_cached_items_as_prefix_grows(monkeypatch):
+    monkeypatch.setenv('MOJO_KERNEL_LSP_DIAG', '1')
+    lsp = _CountingLSP()
+    k = _mk_kernel_for_lsp(lsp)
+    assert k.do_complete('x = p', 5)['matches'] == ['print', 'println', 'pri_helper']
+    out = k.do_complete('x = pri', 7)
+    assert out['matches'] == ['print', 'println', 'pri_helper']
+    out = k.do_complete('x = prin', 8)
+    assert out['matches'] == ['print', 'println']
+    assert lsp.calls == 1
+    dbg = out['metadata']['_mojokernel_debug']
+    assert dbg[0]['stage'] == 'cache'
+    assert dbg[0]['cache']['hits'] == 2 and dbg[0]['cache']['misses'] == 1
+    # Backspacing past the cached prefix, or an edit outside the span, asks the LSP again.
+    k.do_complete('x = ', 4)
+    assert lsp.calls == 2
+    k.do_complete('y = ', 4)
+    assert lsp.calls == 3
+
+
+def test_do_complete_cache_invalidated_by_execute_and_incomplete_lists():
+    lsp = _CountingLSP()
+    k = _mk_kernel_for_lsp(lsp)
+    k.do_complete('p', 1)
+    k._lsp_preamble = 'var a = 1\n'
+    k.do_complete('pr', 2)
+    assert lsp.calls == 2
+    lsp = _CountingLSP(incomplete=True)
+    k = _mk_kernel_for_lsp(lsp)
+    k.do_complete('p', 1)
+    k.do_complete('pr', 2)
+    assert lsp.calls == 2
+
+
+class _DelayedLSP(_FakeLSP):
+    "Answers each document after its own delay, from a timer thread."
+    def __init__(self, delays, items):
+        self.delays,self.items,self.cancelled = delays,items,[]
+
+    def complete_async(self, text, cursor_offset, doc=None, notify=None):
+        import threading
+        p = _Pending('textDocument/completion', notify)
+        p.doc = doc
+        def reply():
+            if p.event.is_set(): return
+            p.msg = dict(result=dict(isIncomplete=False, items=[dict(label=o) for o in self.items[doc]]))
+            p.set_done()
+        threading.Timer(self.delays[doc], reply).start()
+        return p
+
+    def cancel(self, p):
+        self.cancelled.append(p.doc)
+        p.err = LSPError(dict(code=-32800, message='Request cancelled'))
+        p.set_done()
+
+
+def test_do_complete_races_strategies_and_cancels_the_loser():
+    lsp = _DelayedLSP(dict(lsp_wrapped=0.05, lsp_raw=1.0), dict(lsp_wrapped=['sort'], lsp_raw=['sorted']))
+    k = _mk_kernel_for_lsp(lsp)
+    t0 = time.time()
+    out = k.do_complete('list.', 5)
+    assert time.time() - t0 < 0.5
+    assert out['matches'] == ['sort']
+    assert lsp.cancelled == ['lsp_raw']
+
+
+def test_do_complete_race_waits_past_an_empty_result():
+    lsp = _DelayedLSP(dict(lsp_raw=0.01, lsp_wrapped=0.2), dict(lsp_raw=[], lsp_wrapped=['sort']))
+    k = _mk_kernel_for_lsp(lsp)
+    out = k.do_complete('so', 2)
+    assert out['matches'] == ['sort']
+    assert lsp.cancelled == []
+
+
+class _ReactiveEngine:
+    streams_output = True
+    def __init__(self, result): self.result,self.calls = result,[]
+    def execute(self, code, **kw):
+        self.calls.append(kw)
+        return self.result
+
+def test_do_execute_streams_the_output_of_rerun_dependents():
+    from mojokernel.engines.base import ExecutionResult
+    deps = [dict(cell_id='c2', status='ok', stdout='4\n', display_data=[dict(data={'text/plain': 'x'}, metadata={})]),
+            dict(cell_id='c4', status='error', stdout='partial\n', stderr='warn\n', ename='E', evalue='boom'),
+            dict(cell_id='c5', status='not_run')]
+    k = _mk_kernel_for_lsp(None)
+    k.engine,k.reactive,k.iopub_socket,k.execution_count = _ReactiveEngine(ExecutionResult(dependents=deps)),True,None,1
+    sent = []
+    k.send_response = lambda sock, kind, content: sent.append((kind, content))
+    assert k.do_execute('_dg_base = 10', False, cell_id='c1')['status'] == 'ok'
+    assert k.engine.calls[0]['execute_dependents']
+    assert sent == [
+        ('stream', dict(name='stdout', text='[re-ran dependent cell c2: ok]\n')),
+        ('stream', dict(name='stdout', text='4\n')),
+        ('display_data', dict(data={'text/plain': 'x'}, metadata={})),
+        ('stream', dict(name='stderr', text='[re-ran dependent cell c4: error]\n')),
+        ('stream', dict(name='stdout', text='partial\n')),
+        ('stream', dict(name='stderr', text='warn\n')),
+        ('stream', dict(name='stderr', text='boom\n')),
+        ('stream', dict(name='stderr', text='[re-ran dependent cell c5: not_run]\n'))]
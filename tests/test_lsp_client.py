@@ -372,3 +372,293 @@ def test_lsp_client_debug_state_compact_truncates_large_fields():
     assert len(out['last_reader_error']) <= 180
     assert len(out['stderr_tail']) == 2
     assert all(len(o) <= 120 for o in out['stderr_tail'])
+
+
+def _fake_lsp_cmd_echo_document():
+    code = r'''
+import json, sys
+docs = {}
+
+def read_msg():
+    headers = {}
+    while True:
+        line = sys.stdin.buffer.readline()
+        if not line: return None
+        if line in (b"\r\n", b"\n"): break
+        if b":" not in line: continue
+        k,v = line.decode("ascii", "replace").split(":", 1)
+        headers[k.strip().lower()] = v.strip()
+    n = int(headers.get("content-length", "0"))
+    if n <= 0: return None
+    return json.loads(sys.stdin.buffer.read(n).decode("utf-8"))
+
+def send(obj):
+    payload = json.dumps(obj).encode("utf-8")
+    sys.stdout.buffer.write(f"Content-Length: {len(payload)}\r\n\r\n".encode("ascii"))
+    sys.stdout.buffer.write(payload)
+    sys.stdout.buffer.flush()
+
+while True:
+    msg = read_msg()
+    if msg is None: break
+    mid, method, params = msg.get("id"), msg.get("method"), msg.get("params") or {}
+    td = params.get("textDocument", {})
+    if method == "initialize":
+        send({"jsonrpc":"2.0","id":mid,"result":{"capabilities":{"textDocumentSync":{"change":1}}}})
+    elif method == "shutdown":
+        send({"jsonrpc":"2.0","id":mid,"result":None})
+    elif method == "textDocument/didOpen":
+        docs[td["uri"]] = td["text"]
+    elif method == "textDocument/didChange":
+        docs[td["uri"]] = params["contentChanges"][-1]["text"]
+    elif method == "textDocument/didClose":
+        docs.pop(td["uri"], None)
+    elif method == "textDocument/completion":
+        items = [{"label": docs.get(td["uri"], "?").split()[0]}, {"label": f"docs{len(docs)}"}]
+        send({"jsonrpc":"2.0","id":mid,"result":{"isIncomplete":False,"items":items}})
+    elif method == "exit":
+        break
+'''
+    return [sys.executable, '-u', '-c', code]
+
+
+def _mux_stats(c): return c._request('mojokernel/muxStats', None)
+
+
+def test_lsp_mux_shares_one_server_between_clients():
+    import threading
+    from mojokernel.lsp_mux import LSPMux
+    with tempfile.TemporaryDirectory() as d:
+        path = f'{d}/mux.sock'
+        mux = LSPMux(path, cmd=_fake_lsp_cmd_echo_document(), idle_timeout=0)
+        t = threading.Thread(target=mux.serve_forever, daemon=True)
+        t.start()
+        a = MojoLSPClient(mux_socket=path, request_timeout=2.0, shutdown_timeout=0.3)
+        b = MojoLSPClient(mux_socket=path, request_timeout=2.0, shutdown_timeout=0.3)
+        a.start(); b.start()
+        assert a._doc_uri != b._doc_uri
+        assert a._supports_did_change
+        # Each client sees its own document.
+        assert completion_matches(a.complete('alpha x', 7)) == ['alpha', 'docs1']
+        assert completion_matches(b.complete('beta y', 6)) == ['beta', 'docs2']
+        assert completion_matches(a.complete('gamma x', 7)) == ['gamma', 'docs2']
+        st = _mux_stats(a)
+        assert st['clients'] == 2 and st['documents'] == 2 and st['backend_starts'] == 1
+        pid = st['backend_pid']
+        b.shutdown()
+        for _ in range(50):
+            if _mux_stats(a)['clients'] == 1: break
+            time.sleep(0.02)
+        st = _mux_stats(a)
+        assert st['documents'] == 1 and st['backend_pid'] == pid
+        assert completion_matches(a.complete('delta', 5)) == ['delta', 'docs1']
+        a.shutdown()
+        mux.close()
+        t.join(2)
+
+
+def test_lsp_mux_reopens_documents_after_backend_restart():
+    import threading
+    from mojokernel.lsp_mux import LSPMux
+    with tempfile.TemporaryDirectory() as d:
+        path = f'{d}/mux.sock'
+        mux = LSPMux(path, cmd=_fake_lsp_cmd_echo_document(), idle_timeout=0)
+        t = threading.Thread(target=mux.serve_forever, daemon=True)
+        t.start()
+        c = MojoLSPClient(mux_socket=path, request_timeout=2.0, shutdown_timeout=0.3)
+        c.start()
+        assert completion_matches(c.complete('alpha', 5)) == ['alpha', 'docs1']
+        mux.backend._proc.kill()
+        mux.backend._proc.wait()
+        # The client doesn't notice: its document is reopened in the new server.
+        assert completion_matches(c.complete('alpha', 5)) == ['alpha', 'docs1']
+        assert _mux_stats(c)['backend_starts'] == 2
+        c.shutdown()
+        mux.close()
+        t.join(2)
+
+
+def test_lsp_mux_schedules_clients_round_robin():
+    from mojokernel.lsp_mux import LSPMux, _Conn
+
+    class _Sock:
+        def makefile(self, mode): return None
+
+    mux = LSPMux('/nonexistent.sock', cmd=[])
+    a,b = _Conn(1, _Sock()),_Conn(2, _Sock())
+    mux._conns = [a, b]
+    a.queue.extend(dict(id=i, method='m') for i in range(3))
+    b.queue.append(dict(id=10, method='m'))
+    order = []
+    while item := mux._next():
+        conn,msg = item
+        order.append(msg['id'])
+        conn.busy = False
+    assert order == [0, 10, 1, 2]
+
+
+def test_lsp_client_spawns_shared_server_on_demand():
+    with tempfile.TemporaryDirectory() as d:
+        path = f'{d}/mux.sock'
+        env = dict(MOJO_LSP_MUX_IDLE='0.5')
+        a = MojoLSPClient(cmd=_fake_lsp_cmd_echo_document(), env=env, mux_socket=path, request_timeout=2.0, shutdown_timeout=0.3)
+        b = MojoLSPClient(cmd=_fake_lsp_cmd_echo_document(), env=env, mux_socket=path, request_timeout=2.0, shutdown_timeout=0.3)
+        a.start(); b.start()
+        assert completion_matches(a.complete('alpha', 5)) == ['alpha', 'docs1']
+        assert completion_matches(b.complete('beta', 4)) == ['beta', 'docs2']
+        assert _mux_stats(b)['backend_starts'] == 1
+        a.shutdown(); b.shutdown()
+        # Without clients the daemon exits and removes its socket.
+        for _ in range(100):
+            if not Path(path).exists(): break
+            time.sleep(0.05)
+        assert not Path(path).exists()
+
+
+def _fake_lsp_cmd_holds_raw_completion():
+    code = r'''
+import json, sys
+held, cancels = [], 0
+
+def read_msg():
+    headers = {}
+    while True:
+        line = sys.stdin.buffer.readline()
+        if not line: return None
+        if line in (b"\r\n", b"\n"): break
+        if b":" not in line: continue
+        k,v = line.decode("ascii", "replace").split(":", 1)
+        headers[k.strip().lower()] = v.strip()
+    n = int(headers.get("content-length", "0"))
+    if n <= 0: return None
+    return json.loads(sys.stdin.buffer.read(n).decode("utf-8"))
+
+def send(obj):
+    payload = json.dumps(obj).encode("utf-8")
+    sys.stdout.buffer.write(f"Content-Length: {len(payload)}\r\n\r\n".encode("ascii"))
+    sys.stdout.buffer.write(payload)
+    sys.stdout.buffer.flush()
+
+while True:
+    msg = read_msg()
+    if msg is None: break
+    mid, method, params = msg.get("id"), msg.get("method"), msg.get("params") or {}
+    if method == "initialize":
+        send({"jsonrpc":"2.0","id":mid,"result":{"capabilities":{}}})
+    elif method == "shutdown":
+        send({"jsonrpc":"2.0","id":mid,"result":None})
+    elif method == "$/cancelRequest":
+        if params["id"] in held:
+            cancels += 1
+            send({"jsonrpc":"2.0","id":params["id"],"error":{"code":-32800,"message":"cancelled"}})
+    elif method == "textDocument/completion":
+        uri = params["textDocument"]["uri"]
+        if uri.endswith("/slow.mojo"): held.append(mid)
+        else: send({"jsonrpc":"2.0","id":mid,"result":{"isIncomplete":False,"items":[{"label":uri.rsplit("/", 1)[1]}, {"label":f"cancels{cancels}"}]}})
+    elif method == "exit":
+        break
+'''
+    return [sys.executable, '-u', '-c', code]
+
+
+def test_lsp_client_concurrent_requests_on_named_documents_and_cancel():
+    import threading
+    from mojokernel.lsp_client import LSPError
+    c = MojoLSPClient(cmd=_fake_lsp_cmd_holds_raw_completion(), request_timeout=1.0, shutdown_timeout=0.3)
+    c.start()
+    done = threading.Event()
+    slow = c.complete_async('x', 1, doc='slow', notify=done)
+    fast = c.complete_async('x', 1, doc='fast', notify=done)
+    assert done.wait(1.0)
+    assert completion_matches(c.finish(fast)) == ['fast.mojo', 'cancels0']
+    assert not slow.event.is_set()
+    c.cancel(slow)
+    with pytest.raises(LSPError): c.finish(slow)
+    assert completion_matches(c.complete('x', 1)) == ['session.mojo', 'cancels1']
+    c.shutdown()
+
+
+def test_lsp_mux_passes_concurrent_requests_and_cancels():
+    import threading
+    from mojokernel.lsp_client import LSPError
+    from mojokernel.lsp_mux import LSPMux
+    with tempfile.TemporaryDirectory() as d:
+        path = f'{d}/mux.sock'
+        mux = LSPMux(path, cmd=_fake_lsp_cmd_holds_raw_completion(), idle_timeout=0)
+        t = threading.Thread(target=mux.serve_forever, daemon=True)
+        t.start()
+        c = MojoLSPClient(mux_socket=path, request_timeout=1.0, shutdown_timeout=0.3)
+        c.start()
+        done = threading.Event()
+        slow = c.complete_async('x', 1, doc='slow', notify=done)
+        fast = c.complete_async('x', 1, doc='fast', notify=done)
+        assert completion_matches(c.finish(fast)) == ['fast.mojo', 'cancels0']
+        c.cancel(slow)
+        with pytest.raises(LSPError): c.finish(slow)
+        for _ in range(50):
+            if completion_matches(c.complete('x', 1))[1] == 'cancels1': break
+            time.sleep(0.02)
+        assert completion_matches(c.complete('x', 1)) == ['session.mojo', 'cancels1']
+        c.shutdown()
+        mux.close()
+        t.join(2)
+
+
+def test_lsp_mux_keeps_each_clients_messages_in_order():
+    import io, threading
+    from mojokernel.lsp_mux import LSPMux, _Conn
+
+    class _Sock:
+        def makefile(self, mode): return io.BytesIO()
+
+    class _Backend:
+        "Records what reaches the server; replies take a moment and the second notification is slow to send."
+        def __init__(self): self.seen,self.notes = [],0
+        def _needs_restart(self, e=None): return False
+        def _notify(self, method, params):
+            self.notes += 1
+            if self.notes == 2: time.sleep(0.2)
+            self.seen.append(method)
+        def _start_request(self, method, params):
+            self.seen.append(method)
+            return method
+        def _wait(self, pending):
+            time.sleep(0.05)
+            return None
+        def shutdown(self): pass
+
+    mux = LSPMux('/nonexistent.sock', cmd=[])
+    mux.backend = _Backend()
+    conn = _Conn(1, _Sock())
+    mux._conns = [conn]
+    workers = [threading.Thread(target=mux._worker, daemon=True) for _ in range(3)]
+    for w in workers: w.start()
+    msgs = [dict(method='n1'), dict(id=1, method='r1'), dict(method='n2'), dict(id=2, method='r2')]
+    for m in msgs: mux._receive(conn, m)
+    for _ in range(100):
+        if len(mux.backend.seen) == len(msgs): break
+        time.sleep(0.01)
+    with mux._cv:
+        mux._stopping = True
+        mux._cv.notify_all()
+    assert mux.backend.seen == ['n1', 'r1', 'n2', 'r2']
+
+
+def test_mux_socket_dir_is_per_user_and_private(monkeypatch):
+    import os
+    from mojokernel.lsp_client import ensure_private_dir, mux_socket_path
+    monkeypatch.delenv('XDG_RUNTIME_DIR', raising=False)
+    with tempfile.TemporaryDirectory() as d:
+        monkeypatch.setattr(tempfile, 'tempdir', d)
+        path = mux_socket_path()
+        assert Path(path).parent == Path(d) / f'mojokernel-{os.getuid()}'
+        ensure_private_dir(os.path.dirname(path))
+        assert Path(path).parent.stat().st_mode & 0o777 == 0o700
+        shared = Path(d) / 'shared'
+        shared.mkdir()
+        shared.chmod(0o777)
+        with pytest.raises(PermissionError): ensure_private_dir(str(shared))
+        c = MojoLSPClient(cmd=_fake_lsp_cmd_echo_document(), mux_socket=str(shared / 'mux.sock'), request_timeout=2.0)
+        t0 = time.monotonic()
+        with pytest.raises(PermissionError): c.start()
+        assert time.monotonic() - t0 < 2
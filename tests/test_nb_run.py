@@ -0,0 +1,57 @@
+"""Tests for the headless notebook executor (mojo-nb-run)."""
+import json,os,subprocess,pytest
+from pathlib import Path
+
+NB_RUN_BIN = Path(__file__).resolve().parents[1] / "build" / "mojo-nb-run"
+
+def _modular_root():
+    from mojo._package_root import get_package_root
+    return get_package_root()
+
+def _notebook(*sources):
+    cells = [dict(cell_type='code', metadata={}, source=s, outputs=[], execution_count=None) for s in sources]
+    return dict(cells=cells, metadata={}, nbformat=4, nbformat_minor=5)
+
+def _run(tmp_path, notebooks, *args, env=None):
+    if not NB_RUN_BIN.exists(): pytest.skip(f"mojo-nb-run not found at {NB_RUN_BIN}. Run tools/build_server.sh first.")
+    paths = []
+    for i,nb in enumerate(notebooks):
+        p = tmp_path / f'nb{i}.ipynb'
+        p.write_text(json.dumps(nb))
+        paths.append(str(p))
+    root = _modular_root()
+    env = {**os.environ, 'DYLD_LIBRARY_PATH': f'{root}/lib', 'LD_LIBRARY_PATH': f'{root}/lib', **(env or {})}
+    proc = subprocess.run([str(NB_RUN_BIN), root, *args, *paths], capture_output=True, env=env, timeout=300)
+    results = {r['notebook']: r for r in map(json.loads, proc.stdout.decode().splitlines())}
+    return proc, [results[p] for p in paths], [json.loads(Path(p).read_text()) for p in paths]
+
+def test_outputs_written_back(tmp_path):
+    proc, results, nbs = _run(tmp_path, [_notebook('var x = 21', 'print(x * 2)')], '-j', '1')
+    assert proc.returncode == 0, proc.stderr.decode()
+    assert results[0]['status'] == 'ok'
+    assert results[0]['cells'] == 2
+    cell = nbs[0]['cells'][1]
+    assert cell['execution_count'] == 2
+    assert '42' in ''.join(cell['outputs'][0]['text'])
+
+def test_parallel_notebooks_isolated(tmp_path):
+    nbs_in = [_notebook(f'var v = {i}', 'print(v)') for i in range(4)]
+    proc, results, nbs = _run(tmp_path, nbs_in, '-j', '2')
+    assert proc.returncode == 0, proc.stderr.decode()
+    for i,nb in enumerate(nbs): assert str(i) in ''.join(nb['cells'][1]['outputs'][0]['text'])
+
+def test_display_data_outputs(tmp_path):
+    proc, results, nbs = _run(tmp_path, [_notebook('print("x")\ndisplay("text/html", "<b>hi</b>")')], '-j', '1',
+                              env={'MOJO_REPL_FIFO_STDIO': '1', 'MOJO_REPL_DISPLAY_MB': '64'})
+    assert proc.returncode == 0, proc.stderr.decode()
+    outputs = nbs[0]['cells'][0]['outputs']
+    assert [o['output_type'] for o in outputs] == ['stream', 'display_data']
+    assert outputs[1]['data'] == {'text/html': '<b>hi</b>'} and outputs[1]['metadata'] == {}
+
+def test_stops_at_first_error(tmp_path):
+    proc, results, nbs = _run(tmp_path, [_notebook('print(_nb_undefined)', 'print(1)')], '-j', '1')
+    assert proc.returncode != 0
+    assert results[0]['status'] == 'error'
+    cells = nbs[0]['cells']
+    assert cells[0]['outputs'][-1]['output_type'] == 'error'
+    assert cells[1]['execution_count'] is None
@@ -10,24 +10,49 @@ def _modular_root():
     from mojo._package_root import get_package_root
     return get_package_root()
 
-@pytest.fixture(scope='module')
-def server():
-    if not SERVER_BIN.exists():
-        pytest.skip(f"Server binary not found at {SERVER_BIN}. Run tools/build_server.sh first.")
+def _start(extra_env):
     root = _modular_root()
-    env = {**os.environ, 'DYLD_LIBRARY_PATH': f'{root}/lib', 'LD_LIBRARY_PATH': f'{root}/lib'}
+    env = {**os.environ, 'DYLD_LIBRARY_PATH': f'{root}/lib', 'LD_LIBRARY_PATH': f'{root}/lib', **extra_env}
     proc = subprocess.Popen(
         [str(SERVER_BIN), root],
         stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE, env=env)
     # Wait for ready
     line = proc.stdout.readline()
     assert line, "Server produced no output"
-    ready = json.loads(line)
-    assert ready['status'] == 'ready', f"Server not ready: {ready}"
+    proc.ready = json.loads(line)
+    assert proc.ready['status'] == 'ready', f"Server not ready: {proc.ready}"
+    return proc
+
+def _shutdown(proc):
+    if proc.poll() is not None: return
+    try:
+        proc.stdin.write(b'{"type":"shutdown","id":999}\n')
+        proc.stdin.flush()
+        proc.wait(timeout=10)
+    except (BrokenPipeError, subprocess.TimeoutExpired):
+        proc.kill()
+        proc.wait()
+
+@pytest.fixture(scope='module')
+def server():
+    if not SERVER_BIN.exists():
+        pytest.skip(f"Server binary not found at {SERVER_BIN}. Run tools/build_server.sh first.")
+    proc = _start({'MOJO_REPL_FIFO_STDIO': '1', 'MOJO_REPL_DISPLAY_MB': '64'})
     yield proc
-    proc.stdin.write(b'{"type":"shutdown","id":999}\n')
-    proc.stdin.flush()
-    proc.wait(timeout=10)
+    _shutdown(proc)
+
+@pytest.fixture
+def spawn_server():
+    # spawn_server(env) starts a server of its own; each is shut down after the test.
+    if not SERVER_BIN.exists():
+        pytest.skip(f"Server binary not found at {SERVER_BIN}. Run tools/build_server.sh first.")
+    procs = []
+    def spawn(env):
+        procs.append(_start(env))
+        return procs[-1]
+    yield spawn
+    for proc in procs:
+        _shutdown(proc)
 
 def _send(server, req):
     line = json.dumps(req, separators=(',', ':')) + '\n'
@@ -75,3 +100,379 @@ def test_unknown_type(server):
     resp = _send(server, {'type': 'bogus', 'id': 6})
     assert resp['status'] == 'error'
     assert 'ProtocolError' in resp.get('ename', '')
+
+def test_malformed_field_is_a_protocol_error(server):
+    resp = _send(server, {'type': 'limits', 'id': 8, 'memory_mb': 'x'})
+    assert resp['status'] == 'error' and resp['ename'] == 'ProtocolError'
+    # The worker survives it.
+    assert _send(server, {'type': 'execute', 'id': 9, 'code': 'print(9)'})['stdout'].strip() == '9'
+
+def test_execute_reports_resources(server):
+    resp = _send(server, {'type': 'execute', 'id': 7, 'code': 'print(7)'})
+    res = resp['resources']
+    assert res['cell'] >= 1
+    assert res['wall_ms'] >= 0
+    assert res['inferior']['cpu_ms'] >= 0
+    assert 'peak_rss_kb' in res['inferior']
+    assert 'minor_faults' in res['server']
+
+def test_stats_aggregates(server):
+    resp = _send(server, {'type': 'stats', 'id': 8})
+    assert resp['status'] == 'ok'
+    totals = resp['totals']
+    assert totals['cells'] >= 1
+    assert totals['inferior_peak_rss_kb'] > 0
+    assert resp['inferior']['rss_kb'] > 0
+
+def test_timeout_interrupts_cell(server):
+    resp = _send(server, {'type': 'execute', 'id': 20, 'timeout_ms': 1000,
+                          'code': 'print("before")\nwhile True:\n    pass'})
+    assert resp['status'] == 'error'
+    assert resp['ename'] == 'TimeoutError'
+    assert resp['timeout_ms'] == 1000
+    assert 'before' in resp['stdout']
+    assert not resp.get('needs_reset')
+    resp = _send(server, {'type': 'execute', 'id': 21, 'code': 'print(3)'})
+    assert resp['status'] == 'ok'
+
+def test_cpu_limit_stops_cell_and_reset_recovers(server):
+    resp = _send(server, {'type': 'limits', 'id': 9, 'cpu_s': 0.5})
+    assert resp['limits']['cpu_s'] == 0.5
+    resp = _send(server, {'type': 'execute', 'id': 10, 'code': 'while True:\n    pass'})
+    assert resp['status'] == 'error'
+    assert resp['ename'] == 'ResourceLimitExceeded'
+    assert resp['limit']['kind'] == 'cpu'
+    assert resp['needs_reset']
+    resp = _send(server, {'type': 'execute', 'id': 11, 'code': 'print(1)'})
+    assert resp['status'] == 'error' and resp['needs_reset']
+    _send(server, {'type': 'limits', 'id': 12, 'cpu_s': 0})
+    assert _send(server, {'type': 'reset', 'id': 13})['status'] == 'ok'
+    resp = _send(server, {'type': 'execute', 'id': 14, 'code': 'print(5)'})
+    assert resp['status'] == 'ok'
+    assert '5' in resp['stdout']
+
+def test_huge_output_spills_and_pages(server):
+    code = 'for i in range(60000):\n    print("0123456789" * 10)'
+    resp = _send(server, {'type': 'execute', 'id': 30, 'code': code})
+    assert resp['status'] == 'ok'
+    assert len(resp['stdout']) < 4200 * 1024
+    assert 'bytes omitted' in resp['stdout']
+    spill = resp['spill']['stdout']
+    assert spill['total_bytes'] == 60000 * 101
+    assert spill['size'] == spill['total_bytes'] - spill['offset']
+    page = _send(server, {'type': 'read_output', 'id': 31, 'path': spill['path'], 'offset': 0, 'length': 202})
+    assert page['status'] == 'ok' and page['length'] == 202 and not page['eof']
+    assert page['size'] == spill['size']
+
+def test_read_output_pages_are_exact(server):
+    import base64
+    resp = _send(server, {'type': 'execute', 'id': 33, 'code': 'for i in range(40000):\n    print("é" * 50)'})
+    path = resp['spill']['stdout']['path']
+    raw = _send(server, {'type': 'read_output', 'id': 34, 'path': path, 'length': 4096, 'encoding': 'base64'})
+    assert raw['encoding'] == 'base64' and raw['length'] == 4096
+    data = base64.b64decode(raw['data'])
+    start = offset = next(i for i, b in enumerate(data) if b & 0xC0 != 0x80)
+    # Text pages stop before a sequence they would cut and say where to go on.
+    text = ''
+    while offset < 1000:
+        page = _send(server, {'type': 'read_output', 'id': 35, 'path': path, 'offset': offset, 'length': 101})
+        assert page['encoding'] == 'utf-8' and page['next_offset'] == offset + page['length']
+        text += page['data']
+        offset = page['next_offset']
+    assert text.encode() == data[start:offset]
+
+def test_read_output_rejects_foreign_paths(server):
+    resp = _send(server, {'type': 'read_output', 'id': 32, 'path': '/etc/passwd'})
+    assert resp['status'] == 'error'
+    assert resp['ename'] == 'ProtocolError'
+
+def test_startup_profile_with_fast_settings(spawn_server):
+    proc = spawn_server({'MOJO_REPL_PROFILE_STARTUP': '1', 'MOJO_REPL_FAST_STARTUP': '1'})
+    ready = proc.ready
+    steps = [s['step'] for s in ready['startup']['steps']]
+    assert steps[0] == 'initialize' and steps[-1] == 'get_repl'
+    assert 'fast_settings' in steps and ready['startup']['fast']
+    tasks = {t['task']: t for t in ready['startup']['background']}
+    assert 'plugin_load' in tasks['parse_entry_point']['overlapped']
+    resp = _send(proc, {'type': 'execute', 'id': 1, 'code': 'print(42)'})
+    assert resp['status'] == 'ok' and '42' in resp['stdout']
+
+def test_warmup_before_ready_keeps_session_clean(spawn_server):
+    proc = spawn_server({'MOJO_REPL_WARMUP': 'before'})
+    assert proc.ready['warmup']['ok'], proc.ready['warmup']
+    resp = _send(proc, {'type': 'execute', 'id': 1, 'code': 'print(6 * 7)'})
+    assert resp['status'] == 'ok'
+    assert resp['stdout'].strip() == '42'
+    assert resp['resources']['cell'] == 1
+
+def test_definition_cache_hits_after_restart(tmp_path, spawn_server):
+    import time
+    # The last definition relies on the import-only cell before it.
+    prelude = ['fn _dc_square(x: Int) -> Int:\n    return x * x',
+               'struct _DcPoint:\n    var x: Int\n    fn __init__(out self, x: Int):\n        self.x = x',
+               'from math import sqrt',
+               'fn _dc_root(x: Float64) -> Float64:\n    return sqrt(x)']
+    use = 'print(_dc_square(_DcPoint(7).x), _dc_root(49.0))'
+    env = {'MOJO_REPL_DEF_CACHE': str(tmp_path)}
+    proc = spawn_server(env)
+    for i, cell in enumerate(prelude):
+        resp = _send(proc, {'type': 'execute', 'id': i, 'code': cell})
+        assert resp['status'] == 'ok' and resp.get('def_cache') == (None if cell.startswith('from') else 'miss')
+    assert _send(proc, {'type': 'execute', 'id': 9, 'code': use})['stdout'].split() == ['49', '7.0']
+    for _ in range(600):
+        stats = _send(proc, {'type': 'stats', 'id': 10})['def_cache']
+        if stats['pending'] == 0 and stats['built'] + stats['build_failures'] == 3: break
+        time.sleep(0.1)
+    assert stats['built'] == 3
+    _shutdown(proc)
+    proc = spawn_server(env)
+    for i, cell in enumerate(prelude):
+        resp = _send(proc, {'type': 'execute', 'id': i, 'code': cell})
+        assert resp['status'] == 'ok' and resp.get('def_cache') == (None if cell.startswith('from') else 'hit'), resp
+    assert _send(proc, {'type': 'execute', 'id': 9, 'code': use})['stdout'].split() == ['49', '7.0']
+    assert _send(proc, {'type': 'stats', 'id': 10})['def_cache']['importable']
+
+def test_replay_coalesces_definitions_and_attributes_errors(server):
+    cells = ['fn _rp_a() -> Int:\n    return 1',
+             'fn _rp_b() -> Int:\n    return _rp_a() + 1',
+             {'code': 'print(_rp_b())', 'side_effect_free': True},
+             'fn _rp_bad() -> Int:\n    return _rp_missing',
+             'var _rp_x = _rp_b()',
+             'print(_rp_x)']
+    resp = _send(server, {'type': 'replay', 'id': 40, 'cells': cells})
+    assert resp['status'] == 'ok'
+    by_index = {c['index']: c for c in resp['cells']}
+    assert by_index[2]['status'] == 'skipped'
+    assert by_index[0]['status'] == by_index[1]['status'] == 'ok'
+    assert by_index[3]['status'] == 'error'
+    assert by_index[4]['status'] == 'ok'
+    assert '2' in by_index[5]['stdout']
+    summary = resp['summary']
+    assert summary['skipped'] == 1 and summary['errors'] == 1
+    # One failed batch of three definitions, its three retries, then two cells.
+    assert summary['submissions'] == 6
+
+def test_checkpoint_and_restore(tmp_path, spawn_server):
+    ckpt = str(tmp_path / 'session.ckpt')
+    proc = spawn_server({})
+    cells = ['fn _ck_double(x: Int) -> Int:\n    return 2 * x',
+             'var _ck_n: Int = 21',
+             'var _ck_xs = List[Float64](length=100000, fill=0.5)',
+             '_ck_n = _ck_double(_ck_n)',
+             '_ck_xs[7] = 3.25',
+             'var _ck_s = String("hello")']
+    for i, code in enumerate(cells):
+        assert _send(proc, {'type': 'execute', 'id': i, 'code': code})['status'] == 'ok'
+    resp = _send(proc, {'type': 'checkpoint', 'id': 20, 'path': ckpt})
+    assert resp['status'] == 'ok', resp
+    assert '_ck_n' in resp['memory_vars'] and '_ck_xs' in resp['memory_vars']
+    assert '_ck_s' in resp['replay_vars']
+    resp = _send(proc, {'type': 'restore', 'id': 21, 'path': ckpt})
+    assert resp['status'] == 'ok', resp
+    resp = _send(proc, {'type': 'execute', 'id': 22,
+                        'code': 'print(_ck_n, _ck_xs[7], len(_ck_xs), _ck_s, _ck_double(1))'})
+    assert resp['stdout'].split() == ['42', '3.25', '100000', 'hello', '2']
+
+def test_restore_replays_vars_that_rerun_cells_read(tmp_path, spawn_server):
+    ckpt = str(tmp_path / 'session.ckpt')
+    proc = spawn_server({})
+    cells = ['var _ckh_n: Int = 3', 'var _ckh_s = String(_ckh_n)', '_ckh_n = 10']
+    for i, code in enumerate(cells):
+        assert _send(proc, {'type': 'execute', 'id': i, 'code': code})['status'] == 'ok'
+    resp = _send(proc, {'type': 'checkpoint', 'id': 20, 'path': ckpt})
+    assert resp['status'] == 'ok', resp
+    before = _send(proc, {'type': 'stats', 'id': 21})['totals']['cells']
+    resp = _send(proc, {'type': 'restore', 'id': 22, 'path': ckpt})
+    assert resp['status'] == 'ok', resp
+    assert '_ckh_n' in resp['replay_vars'] and resp['rerun_cells'] == 3
+    assert _send(proc, {'type': 'stats', 'id': 23})['totals']['cells'] == before
+    resp = _send(proc, {'type': 'execute', 'id': 24, 'code': 'print(_ckh_s, _ckh_n)'})
+    assert resp['stdout'].split() == ['3', '10']
+
+def test_restore_redeclared_vars_and_side_effect_cells(tmp_path, spawn_server):
+    ckpt = str(tmp_path / 'session.ckpt')
+    proc = spawn_server({})
+    # seed() changes no var, but the String built after it depends on it.
+    cells = ['var _ckr_x: Int = 1', 'var _ckr_x: Int = 2', 'from random import seed, random_float64',
+             'seed(7)', 'var _ckr_s = String(random_float64())', 'print(_ckr_x)']
+    for i, code in enumerate(cells):
+        resp = _send(proc, {'type': 'execute', 'id': i, 'code': code})
+        if i == 1 and resp['status'] != 'ok': pytest.skip("this REPL rejects redeclaring a var")
+        assert resp['status'] == 'ok', resp
+    before = _send(proc, {'type': 'execute', 'id': 10, 'code': 'print(_ckr_s)'})['stdout']
+    assert _send(proc, {'type': 'checkpoint', 'id': 20, 'path': ckpt})['status'] == 'ok'
+    resp = _send(proc, {'type': 'restore', 'id': 21, 'path': ckpt})
+    assert resp['status'] == 'ok', resp
+    assert '_ckr_x' in resp['memory_vars'] and resp['skipped_cells'] == 1
+    resp = _send(proc, {'type': 'execute', 'id': 22, 'code': 'print(_ckr_x)\nprint(_ckr_s)'})
+    assert resp['stdout'] == '2\n' + before
+
+def test_fork_session_branches_state(server):
+    for i, code in enumerate(['fn _fk_inc(x: Int) -> Int:\n    return x + 1', 'var _fk_n: Int = 10']):
+        assert _send(server, {'type': 'execute', 'id': i, 'code': code})['status'] == 'ok'
+    resp = _send(server, {'type': 'fork_session', 'id': 2, 'new_session': 'what-if'})
+    assert resp['status'] == 'ok' and resp['session'] == 'what-if', resp
+    try:
+        assert _send(server, {'type': 'execute', 'id': 3, 'session': 'what-if',
+                              'code': '_fk_n = _fk_inc(_fk_n) * 100'})['status'] == 'ok'
+        branch = _send(server, {'type': 'execute', 'id': 4, 'session': 'what-if', 'code': 'print(_fk_n)'})
+        main = _send(server, {'type': 'execute', 'id': 5, 'code': 'print(_fk_n)'})
+        assert branch['stdout'].strip() == '1100'
+        assert main['stdout'].strip() == '10'
+        listed = _send(server, {'type': 'list_sessions', 'id': 6})['sessions']
+        assert [e['session'] for e in listed] == ['main', 'what-if']
+    finally:
+        assert _send(server, {'type': 'close_session', 'id': 7, 'session': 'what-if'})['status'] == 'ok'
+    resp = _send(server, {'type': 'execute', 'id': 8, 'session': 'what-if', 'code': 'print(1)'})
+    assert resp['status'] == 'error' and resp['ename'] == 'SessionError'
+
+def _read(server):
+    line = server.stdout.readline()
+    assert line, "Server returned no response"
+    return json.loads(line)
+
+def test_open_session_runs_independently(server):
+    resp = _send(server, {'type': 'open_session', 'id': 1, 'new_session': 'second'})
+    assert resp['status'] == 'ok' and resp['session'] == 'second', resp
+    try:
+        assert _send(server, {'type': 'execute', 'id': 2, 'session': 'second', 'code': 'var _os_x = 7'})['status'] == 'ok'
+        resp = _send(server, {'type': 'execute', 'id': 3, 'code': 'print(_os_x)'})
+        assert resp['status'] == 'error'
+        # A slow cell in main doesn't hold up the other session.
+        slow = 'from time import sleep\nsleep(3.0)'
+        for req in ({'type': 'execute', 'id': 4, 'code': slow},
+                    {'type': 'execute', 'id': 5, 'session': 'second', 'code': 'print(_os_x)'}):
+            server.stdin.write((json.dumps(req) + '\n').encode())
+        server.stdin.flush()
+        first, second = _read(server), _read(server)
+        assert first['id'] == 5 and first['stdout'].strip() == '7'
+        assert second['id'] == 4 and second['status'] == 'ok'
+        listed = _send(server, {'type': 'list_sessions', 'id': 6})
+        assert {e['session'] for e in listed['sessions']} == {'main', 'second'}
+        assert listed['server']['modules'] > 0
+    finally:
+        assert _send(server, {'type': 'close_session', 'id': 7, 'session': 'second'})['status'] == 'ok'
+
+def test_requests_queued_behind_close_get_a_reply(server):
+    assert _send(server, {'type': 'open_session', 'id': 1, 'new_session': 'closing'})['status'] == 'ok'
+    for req in ({'type': 'execute', 'id': 2, 'session': 'closing', 'code': 'from time import sleep\nsleep(1.0)'},
+                {'type': 'close_session', 'id': 3, 'session': 'closing'},
+                {'type': 'execute', 'id': 4, 'session': 'closing', 'code': 'print(1)'}):
+        server.stdin.write((json.dumps(req) + '\n').encode())
+    server.stdin.flush()
+    replies = {r['id']: r for r in (_read(server) for _ in range(3))}
+    assert replies[2]['status'] == 'ok' and replies[3]['status'] == 'ok'
+    assert replies[4]['status'] == 'error' and replies[4]['ename'] == 'SessionClosed', replies[4]
+
+def test_session_ids_cannot_name_paths(server):
+    resp = _send(server, {'type': 'fork_session', 'id': 1, 'new_session': '../x'})
+    assert resp['status'] == 'error' and 'invalid session id' in resp['evalue']
+
+def test_idle_session_is_evicted_and_resumed(spawn_server):
+    import time
+    proc = spawn_server({'MOJO_REPL_IDLE_MINUTES': '0.02'})
+    for i, code in enumerate(['fn _ie_f() -> Int:\n    return 5', 'var _ie_xs = List[Int](length=1000, fill=3)']):
+        assert _send(proc, {'type': 'execute', 'id': i, 'code': code})['status'] == 'ok'
+    for _ in range(100):
+        main = _send(proc, {'type': 'list_sessions', 'id': 5})['sessions'][0]
+        if main['evicted']: break
+        time.sleep(0.1)
+    assert main['evicted'] and 'inferior_rss_kb' not in main, main
+    resp = _send(proc, {'type': 'execute', 'id': 6, 'code': 'print(_ie_f() + _ie_xs[999])'})
+    assert resp['status'] == 'ok' and resp['stdout'].strip() == '8', resp
+    main = _send(proc, {'type': 'list_sessions', 'id': 7})['sessions'][0]
+    assert main['resumes'] == 1 and main['last_resume_ms'] > 0
+
+def test_status_answers_while_a_cell_runs(server):
+    resp = _send(server, {'type': 'status', 'id': 1})
+    assert resp['status'] == 'ok' and resp['state'] == 'idle' and resp['queue_depth'] == 0
+    assert resp['process_state'] == 'stopped' and resp['pid'] > 0
+    slow = {'type': 'execute', 'id': 2, 'code': 'from time import sleep\nsleep(2.0)'}
+    queued = {'type': 'execute', 'id': 3, 'code': 'print(1)'}
+    for req in (slow, queued):
+        server.stdin.write((json.dumps(req) + '\n').encode())
+    server.stdin.flush()
+    import time
+    time.sleep(1.0)
+    resp = _send(server, {'type': 'status', 'id': 4})
+    assert resp['id'] == 4 and resp['state'] == 'running', resp
+    assert resp['request']['id'] == 2 and resp['request']['elapsed_ms'] > 500
+    assert resp['queue_depth'] == 1
+    assert [_read(server)['id'] for _ in range(2)] == [2, 3]
+
+def test_execute_streams_output(server):
+    code = 'from time import sleep\nfor i in range(3):\n    print("tick", i)\n    sleep(0.2)'
+    server.stdin.write((json.dumps({'type': 'execute', 'id': 1, 'code': code, 'stream': True}) + '\n').encode())
+    server.stdin.flush()
+    chunks = []
+    while True:
+        msg = _read(server)
+        assert msg['id'] == 1
+        if msg['status'] != 'stream': break
+        chunks.append(msg)
+    assert msg['status'] == 'ok' and msg['streamed'] and msg['stdout'] == ''
+    assert ''.join(c['text'] for c in chunks if c['name'] == 'stdout') == 'tick 0\ntick 1\ntick 2\n'
+    assert len(chunks) >= 2  # sleeps separate the flushes
+    assert _send(server, {'type': 'stats', 'id': 2})['stdio']['mode'] == 'fifo'
+
+def test_compact_progress_output(server):
+    code = 'for i in range(2000):\n    print("\\rstep", i, end="")\nprint()\nprint("done")'
+    raw = _send(server, {'type': 'execute', 'id': 1, 'code': code, 'compact': False})
+    assert raw['status'] == 'ok' and raw['stdout'].count('\r') == 2000
+    resp = _send(server, {'type': 'execute', 'id': 2, 'code': code, 'compact': True})
+    assert resp['status'] == 'ok'
+    assert resp['stdout'] == 'step 1999\ndone\n'
+    stats = _send(server, {'type': 'stats', 'id': 3})
+    assert stats['stdio']['compacted_bytes'] > 10000
+
+def test_display_data(server):
+    code = ('print("before")\n'
+            'display("text/html", "<b>hi</b>")\n'
+            'display_bytes("image/png", List[UInt8](137, 80, 78, 71))\n'
+            'display("application/json", "{\\"n\\": 3}")')
+    resp = _send(server, {'type': 'execute', 'id': 1, 'code': code})
+    assert resp['status'] == 'ok', resp
+    assert resp['stdout'] == 'before\n'
+    assert [b['data'] for b in resp['display_data']] == [
+        {'text/html': '<b>hi</b>'}, {'image/png': 'iVBORw=='}, {'application/json': {'n': 3}}]
+    server.stdin.write((json.dumps({'type': 'execute', 'id': 2, 'code': 'display("text/plain", "live")', 'stream': True}) + '\n').encode())
+    server.stdin.flush()
+    msg = _read(server)
+    assert msg['status'] == 'display_data' and msg['data'] == {'text/plain': 'live'}
+    assert _read(server)['status'] == 'ok'
+    assert _send(server, {'type': 'stats', 'id': 3})['display']['bundles'] == 4
+
+def test_display_hook_only_for_display_identifiers(spawn_server):
+    proc = spawn_server({'MOJO_REPL_FIFO_STDIO': '1', 'MOJO_REPL_DISPLAY_MB': '64'})
+    resp = _send(proc, {'type': 'execute', 'id': 1, 'code': '# display later\nvar display_width = 3\nprint("display")'})
+    assert resp['status'] == 'ok', resp
+    assert not _send(proc, {'type': 'stats', 'id': 2})['display']['defined']
+    # A cell that defines its own display() keeps it.
+    assert _send(proc, {'type': 'execute', 'id': 3, 'code': 'fn display(x: Int):\n    print("mine", x)'})['status'] == 'ok'
+    assert _send(proc, {'type': 'execute', 'id': 4, 'code': 'display(5)'})['stdout'] == 'mine 5\n'
+
+def test_packet_stats_in_timing(spawn_server):
+    proc = spawn_server({'MOJO_REPL_PACKET_STATS': '1', 'MOJO_REPL_REMOTE_TUNING': '1'})
+    resp = _send(proc, {'type': 'execute', 'id': 1, 'code': 'print(40 + 2)'})
+    assert resp['status'] == 'ok' and resp['stdout'].strip() == '42'
+    gdb = resp['timing']['gdb_remote']
+    assert gdb['round_trips'] > 0 and gdb['bytes_sent'] > 0 and gdb['bytes_received'] > 0
+    assert sum(gdb['by_type'].values()) == gdb['round_trips']
+    totals = _send(proc, {'type': 'stats', 'id': 2})['gdb_remote']
+    assert totals['round_trips'] >= gdb['round_trips']
+
+def test_execute_dependents(spawn_server):
+    proc = spawn_server({})
+    # Declared outside the graph so that re-run cells only assign.
+    assert _send(proc, {'type': 'execute', 'id': 20, 'code': 'var _dg_base = 0\nvar _dg_twice = 0'})['status'] == 'ok'
+    cells = [('c1', '_dg_base = 2'), ('c2', '_dg_twice = _dg_base * 2'),
+             ('c3', 'print("unrelated")'), ('c4', 'print(_dg_twice + 1)')]
+    for i, (cid, code) in enumerate(cells):
+        assert _send(proc, {'type': 'execute', 'id': i, 'code': code, 'cell_id': cid})['status'] == 'ok'
+    deps = _send(proc, {'type': 'dependents', 'id': 10, 'cell_id': 'c1'})
+    assert deps['known'] and [d['cell_id'] for d in deps['dependents']] == ['c2', 'c4']
+    resp = _send(proc, {'type': 'execute', 'id': 11, 'code': '_dg_base = 10', 'cell_id': 'c1',
+                        'execute_dependents': True})
+    assert resp['status'] == 'ok', resp
+    assert [(d['cell_id'], d['status']) for d in resp['dependents']] == [('c2', 'ok'), ('c4', 'ok')]
+    assert resp['dependents'][1]['stdout'].strip() == '21'
@@ -0,0 +1,59 @@
+"""Tests for TerminalCompactor (server/terminal_output.h), compiled into a small driver."""
+import shutil,subprocess,pytest
+from pathlib import Path
+
+SERVER_DIR = Path(__file__).resolve().parents[1] / "server"
+
+# Feeds stdin to the compactor in chunks split at \0; \1 calls Flush().
+DRIVER = r'''
+#include <iostream>
+#include <iterator>
+#include <string>
+#include "terminal_output.h"
+int main() {
+    std::string in((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+    TerminalCompactor c;
+    auto out = [](const char *p, size_t n) { std::cout.write(p, n); };
+    size_t start = 0;
+    for (size_t i = 0; i <= in.size(); i++) {
+        if (i < in.size() && in[i] != '\0' && in[i] != '\1') continue;
+        c.Feed(in.data() + start, i - start, out);
+        if (i < in.size() && in[i] == '\1') c.Flush(out);
+        start = i + 1;
+    }
+    c.Finish(out);
+}
+'''
+
+@pytest.fixture(scope='module')
+def compact(tmp_path_factory):
+    cxx = shutil.which('c++')
+    if not cxx: pytest.skip("no C++ compiler")
+    d = tmp_path_factory.mktemp('compactor')
+    (d / 'driver.cpp').write_text(DRIVER)
+    subprocess.run([cxx, '-std=c++17', f'-I{SERVER_DIR}', str(d / 'driver.cpp'), '-o', str(d / 'driver')], check=True)
+    return lambda s: subprocess.run([str(d / 'driver')], input=s.encode(), capture_output=True, check=True).stdout.decode()
+
+def test_carriage_return_overwrites_line(compact):
+    assert compact('10%\r20%\r100%\ndone\n') == '100%\ndone\n'
+    # Text after `\r` replaces the whole line, even if shorter.
+    assert compact('abcdef\rxy\n') == 'xy\n'
+    # A trailing `\r` keeps the line, as a terminal does.
+    assert compact('last\r') == 'last'
+
+def test_erase_in_line(compact):
+    assert compact('50%\r\x1b[K100%\n') == '100%\n'
+    assert compact('abc\x1b[2Kxy\n') == 'xy\n'
+    # At the end of the line ESC[K erases nothing.
+    assert compact('abc\x1b[K\n') == 'abc\n'
+    # Other sequences pass through.
+    assert compact('\x1b[31mred\x1b[0m\n') == '\x1b[31mred\x1b[0m\n'
+
+def test_input_split_across_chunks(compact):
+    assert compact('1%\0\r2\0%\r\x1b\0[\0K3%\n') == '3%\n'
+    # A line shown early by Flush is overwritten with `\r` when redrawn.
+    assert compact('10%\1\r20%\n') == '10%\r20%\n'
+
+def test_crlf_line_endings(compact):
+    assert compact('one\r\ntwo\r\n') == 'one\ntwo\n'
+    assert compact('a\r\n\r\nb\n') == 'a\n\nb\n'
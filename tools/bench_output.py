@@ -0,0 +1,75 @@
+#!/usr/bin/env python
+"""Benchmark mojo-repl-server output throughput: one cell printing --mb MB,
+read through the server's stdio FIFOs (`fifo`, MOJO_REPL_FIFO_STDIO=1), LLDB's
+STDIO buffer (`lldb`, the default) and FIFOs with streaming (`stream`).
+Reports cell wall time, MB/s, time to the first streamed chunk and the
+server's peak RSS.
+Usage: tools/bench_output.py [--mb 1024] [-n RUNS]
+"""
+import argparse,json,os,statistics,subprocess,time
+from pathlib import Path
+
+def _cell(mb):
+    # 1 KiB per line, including print's newline.
+    return ('var __bench_line = String()\n'
+            'for _ in range(1023):\n'
+            '    __bench_line += "x"\n'
+            f'for _ in range({mb * 1024}):\n'
+            '    print(__bench_line)')
+
+def run_once(server_bin, modular_root, mb, extra_env, stream):
+    env = {**os.environ, 'DYLD_LIBRARY_PATH': f'{modular_root}/lib', 'LD_LIBRARY_PATH': f'{modular_root}/lib',
+           'MOJO_REPL_SPILL_DIR': os.environ.get('TMPDIR', '/tmp'), **extra_env}
+    proc = subprocess.Popen([str(server_bin), modular_root],
+        stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, env=env)
+    assert json.loads(proc.stdout.readline())['status'] == 'ready'
+    req = {'type': 'execute', 'id': 1, 'code': _cell(mb), 'stream': stream}
+    t0 = time.perf_counter()
+    proc.stdin.write((json.dumps(req) + '\n').encode())
+    proc.stdin.flush()
+    first_chunk, streamed = None, 0
+    while True:
+        resp = json.loads(proc.stdout.readline())
+        if resp.get('status') != 'stream': break
+        if first_chunk is None: first_chunk = (time.perf_counter() - t0) * 1000
+        streamed += len(resp['text'])
+    wall = (time.perf_counter() - t0) * 1000
+    assert resp['status'] == 'ok', f"Cell failed: {resp}"
+    proc.stdin.write(b'{"type":"stats","id":2}\n')
+    proc.stdin.flush()
+    stats = json.loads(proc.stdout.readline())
+    proc.stdin.write(b'{"type":"shutdown","id":3}\n')
+    proc.stdin.flush()
+    proc.wait(timeout=30)
+    for spill in resp.get('spill', {}).values():
+        try: os.unlink(spill['path'])
+        except OSError: pass
+    total = resp.get('spill', {}).get('stdout', {}).get('total_bytes', len(resp['stdout'])) or streamed
+    return wall, total, first_chunk, stats['server']['peak_rss_kb']
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument('--mb', type=int, default=1024)
+    ap.add_argument('-n', '--runs', type=int, default=3)
+    args = ap.parse_args()
+    fifo = {'MOJO_REPL_FIFO_STDIO': '1'}
+    variants = [('fifo', fifo, False), ('lldb', {}, False), ('stream', fifo, True)]
+
+    server_bin = Path(__file__).resolve().parents[1] / "build" / "mojo-repl-server"
+    from mojo._package_root import get_package_root
+    modular_root = get_package_root()
+
+    results = {name: [] for name, _, _ in variants}
+    for _ in range(args.runs):
+        for name, env, stream in variants:
+            results[name].append(run_once(server_bin, modular_root, args.mb, env, stream))
+
+    for name, runs in results.items():
+        wall = statistics.median(r[0] for r in runs)
+        mb = runs[0][1] / 2**20
+        line = f"{name:>8}: {wall:9.1f} ms  {mb / (wall / 1000):8.1f} MB/s  ({mb:.0f} MB)"
+        if runs[0][2] is not None: line += f"  first chunk {statistics.median(r[2] for r in runs):7.1f} ms"
+        line += f"  server peak RSS {max(r[3] for r in runs) / 1024:7.1f} MB"
+        print(line)
+
+if __name__ == '__main__': main()
@@ -0,0 +1,56 @@
+#!/usr/bin/env python
+"""Benchmark gdb-remote traffic per cell: median latency of small cells and
+the packets, round trips and bytes each one costs, for the default session
+setup and for MOJO_REPL_REMOTE_TUNING=1. Latency is measured without the
+packet log (it has its own cost); counts come from a second run with
+MOJO_REPL_PACKET_STATS=1.
+Usage: tools/bench_remote.py [-n CELLS] [--top N]
+"""
+import argparse,collections,json,os,statistics,subprocess,time
+from pathlib import Path
+
+CELLS = ['var x{i} = {i}', 'print(x{i} + 1)', 'fn f{i}(a: Int) -> Int:\n    return a * {i}', 'print(f{i}(2))']
+
+def run(server_bin, modular_root, extra_env, n):
+    env = {**os.environ, 'DYLD_LIBRARY_PATH': f'{modular_root}/lib', 'LD_LIBRARY_PATH': f'{modular_root}/lib', **extra_env}
+    proc = subprocess.Popen([str(server_bin), modular_root],
+        stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, env=env)
+    assert json.loads(proc.stdout.readline())['status'] == 'ready'
+    times, timings = [], []
+    for i in range(n):
+        for j, cell in enumerate(CELLS):
+            t0 = time.perf_counter()
+            proc.stdin.write((json.dumps({'type': 'execute', 'id': i * len(CELLS) + j, 'code': cell.format(i=i)}) + '\n').encode())
+            proc.stdin.flush()
+            resp = json.loads(proc.stdout.readline())
+            times.append((time.perf_counter() - t0) * 1000)
+            assert resp['status'] == 'ok', f"Cell failed: {resp}"
+            if 'timing' in resp: timings.append(resp['timing']['gdb_remote'])
+    proc.stdin.write(b'{"type":"shutdown","id":-1}\n')
+    proc.stdin.flush()
+    proc.wait(timeout=30)
+    return times, timings
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument('-n', '--cells', type=int, default=10, help='rounds of the four-cell sequence')
+    ap.add_argument('--top', type=int, default=6, help='packet types to list')
+    args = ap.parse_args()
+    variants = [('default', {}), ('tuned', {'MOJO_REPL_REMOTE_TUNING': '1'})]
+
+    server_bin = Path(__file__).resolve().parents[1] / "build" / "mojo-repl-server"
+    from mojo._package_root import get_package_root
+    modular_root = get_package_root()
+
+    for name, env in variants:
+        times, _ = run(server_bin, modular_root, env, args.cells)
+        _, timings = run(server_bin, modular_root, {**env, 'MOJO_REPL_PACKET_STATS': '1'}, args.cells)
+        med = lambda key: statistics.median(t[key] for t in timings)
+        print(f"{name:>8}: cell median {statistics.median(times):7.1f} ms  round trips {med('round_trips'):6.0f}"
+              f"  sent {med('bytes_sent') / 1024:8.1f} KiB  received {med('bytes_received') / 1024:8.1f} KiB")
+        types = collections.Counter()
+        for t in timings: types.update(t['by_type'])
+        for kind, count in types.most_common(args.top):
+            print(f"{'':>10}{kind:<20}{count / len(timings):8.1f} per cell")
+
+if __name__ == '__main__': main()
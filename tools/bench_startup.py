@@ -0,0 +1,73 @@
+#!/usr/bin/env python
+"""Benchmark mojo-repl-server cold start: time to ready and to the first cell,
+per bootstrap step, for the default path and for each variant.
+Usage: tools/bench_startup.py [-n RUNS] [--variant NAME=ENV=VAL[,ENV=VAL]...]
+Default variants: `default`, `serial` (MOJO_REPL_SERIAL_STARTUP=1), `fast`
+(MOJO_REPL_FAST_STARTUP=1) and `warmup` (MOJO_REPL_WARMUP=before).
+"""
+import argparse,json,os,statistics,subprocess,time
+from pathlib import Path
+
+def _timed_cell(proc, id, code):
+    t0 = time.perf_counter()
+    proc.stdin.write((json.dumps({'type': 'execute', 'id': id, 'code': code}) + '\n').encode())
+    proc.stdin.flush()
+    resp = json.loads(proc.stdout.readline())
+    assert resp['status'] == 'ok', f"Cell {code!r} failed: {resp}"
+    return (time.perf_counter() - t0) * 1000
+
+def run_once(server_bin, modular_root, extra_env):
+    env = {**os.environ, 'DYLD_LIBRARY_PATH': f'{modular_root}/lib', 'LD_LIBRARY_PATH': f'{modular_root}/lib',
+           'MOJO_REPL_PROFILE_STARTUP': '1', **extra_env}
+    t0 = time.perf_counter()
+    proc = subprocess.Popen([str(server_bin), modular_root],
+        stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, env=env)
+    ready = json.loads(proc.stdout.readline())
+    t_ready = time.perf_counter() - t0
+    assert ready['status'] == 'ready', f"Server not ready: {ready}"
+    # The first cell catches settings that only move cost out of startup; a
+    # second, different cell is the steady-state reference.
+    t_first = _timed_cell(proc, 1, 'print(1)')
+    t_steady = _timed_cell(proc, 2, 'print(2)')
+    proc.stdin.write(b'{"type":"shutdown","id":3}\n')
+    proc.stdin.flush()
+    proc.wait(timeout=30)
+    steps = {s['step']: s['ms'] for s in ready.get('startup', {}).get('steps', [])}
+    return t_ready * 1000, t_first, t_steady, steps
+
+def parse_variant(spec):
+    name, _, envs = spec.partition('=')
+    return name, dict(kv.split('=', 1) for kv in envs.split(',') if kv)
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument('-n', '--runs', type=int, default=5)
+    ap.add_argument('--variant', action='append', default=[])
+    args = ap.parse_args()
+    variants = [parse_variant(v) for v in args.variant] or [
+        ('default', {}), ('serial', {'MOJO_REPL_SERIAL_STARTUP': '1'}), ('fast', {'MOJO_REPL_FAST_STARTUP': '1'}),
+        ('warmup', {'MOJO_REPL_WARMUP': 'before'})]
+
+    server_bin = Path(__file__).resolve().parents[1] / "build" / "mojo-repl-server"
+    from mojo._package_root import get_package_root
+    modular_root = get_package_root()
+
+    # Interleave variants so drift in page cache or load affects all equally.
+    results = {name: [] for name, _ in variants}
+    run_once(server_bin, modular_root, {})  # warm the page cache
+    for _ in range(args.runs):
+        for name, env in variants:
+            results[name].append(run_once(server_bin, modular_root, env))
+
+    for name, runs in results.items():
+        ready = [r[0] for r in runs]
+        first = [r[1] for r in runs]
+        steady = [r[2] for r in runs]
+        print(f"{name:>10}: ready median {statistics.median(ready):8.1f} ms (min {min(ready):.1f})"
+              f"  first cell median {statistics.median(first):7.1f} ms"
+              f"  steady cell median {statistics.median(steady):7.1f} ms")
+        for step in runs[0][3]:
+            ms = [r[3].get(step, 0) for r in runs]
+            print(f"{'':>12}{step:<16}{statistics.median(ms):8.1f} ms")
+
+if __name__ == '__main__': main()
@@ -44,6 +44,9 @@ BASE_LD="-L$MODULAR_ROOT/lib -l$LLDB_LIB"
 c++ $CFLAGS server/repl_server.cpp $BASE_LD -L$LLVM_LIB -lLLVMSupport -lLLVMDemangle -o build/mojo-repl-server
 echo "Built build/mojo-repl-server"
 
+c++ $CFLAGS server/nb_run.cpp $BASE_LD -L$LLVM_LIB -lLLVMSupport -lLLVMDemangle -o build/mojo-nb-run
+echo "Built build/mojo-nb-run"
+
 mkdir -p mojokernel/bin
 cp build/mojo-repl-server mojokernel/bin/
 echo "Copied to mojokernel/bin/"